@@ -449,8 +449,8 @@ void Array<T>::resize(int m)
 			ASL_BAD_ALLOC();
 		b = (T*) ( p + sizeof(Data) );
 		_a = b;
-		s1 = s;
 		d().s = s1;
+		s1 = s;
 	}
 	if(n<m) asl_construct(b+n, m-n);
 	else asl_destroy(_a+m, n-m);
@@ -0,0 +1,141 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_ASYNCHTTP_H
+#define ASL_ASYNCHTTP_H
+
+#include <asl/Http.h>
+#include <asl/Mutex.h>
+#include <asl/Pointer.h>
+
+namespace asl {
+
+struct AsyncHttpLoop;
+
+/**
+An AsyncHttp client sends many HTTP requests concurrently from a single event-loop thread, without blocking the
+caller. Each request returns a Call object that can be waited for later, and can also have a function called when
+its response arrives. This way a server handler can query several backends at the same time:
+
+~~~
+AsyncHttp http;
+AsyncHttp::Call users = http.get("http://users-service/api/users/12");
+AsyncHttp::Call orders = http.get("http://orders-service/api/orders?user=12", 0.5); // half a second deadline
+http.request(HttpRequest("POST", "http://audit/log", Var("user", 12)), 2.0, [](HttpResponse& res) {
+	...
+});
+Var user = users.wait().json();
+if (orders.wait().code() == 200)
+	...
+~~~
+
+Each request has a deadline (by default `setTimeout()`, 30 seconds) after which it fails with code 0 and
+`timedOut()` true. At most `setMaxConcurrent()` requests are in progress at once, and further ones wait in a queue.
+Host names are resolved in the calling thread. Callbacks run in the event-loop thread, so they should be short.
+HTTPS connections are established (including the TLS handshake) synchronously by the event loop, but requests are
+then sent without blocking, as on plain connections.
+\ingroup Sockets
+*/
+
+class ASL_API AsyncHttp
+{
+public:
+	/** Base class of response handlers */
+	struct Callback
+	{
+		virtual ~Callback() {}
+		virtual void operator()(HttpResponse& response) = 0;
+	};
+	struct CallState;
+	/**
+	A request in progress, whose response can be waited for
+	*/
+	class ASL_API Call
+	{
+	public:
+		Call();
+		Call(const Call& c);
+		~Call();
+		void operator=(const Call& c);
+		/** Waits until the request finishes and returns its response */
+		HttpResponse& wait();
+		/** Waits up to `timeout` seconds for the request to finish and returns true if it did */
+		bool wait(double timeout);
+		/** Returns true if the request has finished, successfully or not */
+		bool done() const;
+		/** Returns true if the request was aborted because its deadline passed */
+		bool timedOut() const;
+		/** Returns the response, which is complete only after the request finishes */
+		HttpResponse& response();
+	protected:
+		friend class AsyncHttp;
+		friend struct AsyncHttpLoop;
+		Shared<CallState> _state;
+	};
+
+	AsyncHttp();
+	~AsyncHttp();
+	/**
+	Sets the maximum number of requests in progress at the same time
+	*/
+	void setMaxConcurrent(int n);
+	/**
+	Sets the default deadline of requests in seconds
+	*/
+	void setTimeout(double timeout) { _timeout = timeout; }
+	/**
+	Starts sending a request that must finish within `timeout` seconds (or the default timeout if negative)
+	*/
+	Call request(const HttpRequest& request, double timeout = -1) { return send(request, timeout, NULL); }
+	/**
+	Starts sending a request and calls `f(response)` in the event-loop thread when it finishes; `f` can be a
+	function, a function object such as a lambda, or a pointer to a Callback subclass, which will be deleted.
+	*/
+	template<class F>
+	Call request(const HttpRequest& request, double timeout, const F& f)
+	{
+		return send(request, timeout, callback(f));
+	}
+	/**
+	Starts a GET request for the given URL
+	*/
+	Call get(const String& url, double timeout = -1)
+	{
+		HttpRequest req("GET", url);
+		return request(req, timeout);
+	}
+	/**
+	Waits until all requests have finished
+	*/
+	void wait();
+	/**
+	Returns the number of requests queued or in progress
+	*/
+	int pending() const;
+protected:
+	template<class F>
+	struct FunctionCallback : public Callback
+	{
+		F f;
+		FunctionCallback(const F& f_) : f(f_) {}
+		void operator()(HttpResponse& response) { f(response); }
+	};
+	template<class F>
+	static Callback* callback(const F& f) { return new FunctionCallback<F>(f); }
+	template<class C>
+	static Callback* callback(C* c) { return c; }
+	static Callback* callback(void (*f)(HttpResponse&))
+	{
+		return new FunctionCallback<void (*)(HttpResponse&)>(f);
+	}
+	Call send(const HttpRequest& request, double timeout, Callback* callback);
+	AsyncHttpLoop* _loop;
+	double _timeout;
+private:
+	AsyncHttp(const AsyncHttp&);
+	void operator=(const AsyncHttp&);
+};
+
+}
+
+#endif
@@ -0,0 +1,632 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_BTREEMAP_H
+#define ASL_BTREEMAP_H
+
+#include <asl/Map.h>
+#include <string.h>
+
+namespace asl {
+
+/**
+A BTreeMap is an ordered map of keys to values like Map, but stored in a B+ tree instead of a sorted array, so
+inserting and removing elements takes logarithmic time even in maps of millions of elements (while in a Map it
+takes time proportional to its length). Keys are ordered with the global `compare()` functions, as in Map.
+
+~~~
+BTreeMap<String, int> index;
+index["pear"] = 3;
+index.set("apple", 1);
+foreach2(String& name, int n, index)      // iterates in key order
+	printf("%s: %i\n", *name, n);
+~~~
+
+Elements are kept in leaves of up to 32 elements linked in order, so ranges of keys can be iterated after
+finding their first element:
+
+~~~
+foreach2(String& name, int n, index.range("a", "m"))   // keys in ["a", "m")
+	...
+BTreeMap<String, int>::Enumerator e = index.upperBound("pear");  // first key after "pear"
+~~~
+
+A map can be built in linear time from data already sorted by key, with the constructor taking a Map or with
+`loadSorted()`. Inserting keys in increasing order is also efficient as it leaves nodes full. Pointers to values are
+invalidated when elements are inserted or removed. As other containers, copies of a BTreeMap share their contents,
+and `clone()` makes an independent copy.
+\ingroup Containers
+*/
+template<class K, class T>
+class BTreeMap
+{
+public:
+	struct KeyVal
+	{
+		K key;
+		T value;
+		KeyVal(const K& k) : key(k), value() {}
+		KeyVal(const K& k, const T& v) : key(k), value(v) {}
+	};
+protected:
+	enum { LEAF_MAX = 32, LEAF_MIN = LEAF_MAX / 2, INNER_MAX = 64, INNER_MIN = INNER_MAX / 2 };
+	struct Node
+	{
+		int n;       // number of elements in a leaf, or of children in an inner node
+		bool leaf;
+	};
+	// elements and keys are stored uninitialized, and moved with memcpy as in Array
+	struct Leaf : public Node
+	{
+		Leaf* prev, *next;
+		ULong space[(LEAF_MAX * sizeof(KeyVal) + 7) / 8];
+		KeyVal* items() { return (KeyVal*)space; }
+		Leaf() : prev(0), next(0) { this->n = 0; this->leaf = true; }
+	};
+	struct Inner : public Node
+	{
+		Node* child[INNER_MAX];
+		ULong space[(INNER_MAX * sizeof(K) + 7) / 8];
+		K* keys() { return (K*)space; } // key i is the smallest key under child i + 1
+		Inner() { this->n = 0; this->leaf = false; }
+	};
+	struct Data
+	{
+		AtomicCount rc;
+		int n;
+		Node* root;
+		Leaf* first, *last;
+		Data() : rc(1), n(0) { root = first = last = new Leaf; }
+	};
+	Data* _d;
+
+	// index of the first element with a key not less than `key`
+	static int lowerIndex(Leaf* leaf, const K& key)
+	{
+		int i = 0, j = leaf->n;
+		const KeyVal* a = leaf->items();
+		while (i < j)
+		{
+			int m = (i + j) >> 1;
+			if (compare(a[m].key, key) < 0)
+				i = m + 1;
+			else
+				j = m;
+		}
+		return i;
+	}
+	static int upperIndex(Leaf* leaf, const K& key)
+	{
+		int i = 0, j = leaf->n;
+		const KeyVal* a = leaf->items();
+		while (i < j)
+		{
+			int m = (i + j) >> 1;
+			if (compare(a[m].key, key) <= 0)
+				i = m + 1;
+			else
+				j = m;
+		}
+		return i;
+	}
+	// index of the child where `key` belongs
+	static int childIndex(Inner* node, const K& key)
+	{
+		int i = 0, j = node->n - 1;
+		const K* k = node->keys();
+		while (i < j)
+		{
+			int m = (i + j) >> 1;
+			if (compare(k[m], key) <= 0)
+				i = m + 1;
+			else
+				j = m;
+		}
+		return i;
+	}
+	Leaf* leafOf(const K& key) const
+	{
+		Node* node = _d->root;
+		while (!node->leaf)
+			node = ((Inner*)node)->child[childIndex((Inner*)node, key)];
+		return (Leaf*)node;
+	}
+	static void destroy(Node* node)
+	{
+		if (node->leaf)
+		{
+			Leaf* leaf = (Leaf*)node;
+			asl_destroy(leaf->items(), leaf->n);
+			delete leaf;
+		}
+		else
+		{
+			Inner* inner = (Inner*)node;
+			for (int i = 0; i < inner->n; i++)
+				destroy(inner->child[i]);
+			asl_destroy(inner->keys(), inner->n - 1);
+			delete inner;
+		}
+	}
+	void release()
+	{
+		if (--_d->rc == 0)
+		{
+			destroy(_d->root);
+			delete _d;
+		}
+	}
+	// adds `child` at position `i` of `node`, with `key` as the smallest key under it
+	static void insertChild(Inner* node, int i, const K& key, Node* child)
+	{
+		memmove((void*)(node->child + i + 1), node->child + i, (node->n - i) * sizeof(Node*));
+		memmove((void*)(node->keys() + i), node->keys() + i - 1, (node->n - i) * sizeof(K));
+		asl_construct_copy(node->keys() + i - 1, key);
+		node->child[i] = child;
+		node->n++;
+	}
+	// removes child `i` (and the key before it) from `node`
+	static void removeChild(Inner* node, int i)
+	{
+		asl_destroy(node->keys() + i - 1);
+		memmove((void*)(node->keys() + i - 1), node->keys() + i, (node->n - 1 - i) * sizeof(K));
+		memmove((void*)(node->child + i), node->child + i + 1, (node->n - 1 - i) * sizeof(Node*));
+		node->n--;
+	}
+	/*
+	Splits the full child `c` of `node` in two. The left half keeps all elements if the new key goes after them at
+	the right edge of the tree, so that inserting keys in increasing order fills nodes completely.
+	*/
+	void split(Inner* node, int c, const K& key, bool rightmost)
+	{
+		Node* x = node->child[c];
+		if (x->leaf)
+		{
+			Leaf* a = (Leaf*)x, *b = new Leaf;
+			int h = a->n / 2;
+			bool append = rightmost && compare(a->items()[a->n - 1].key, key) < 0;
+			if (append)
+				h = a->n;
+			memcpy((void*)b->items(), a->items() + h, (a->n - h) * sizeof(KeyVal));
+			b->n = a->n - h;
+			a->n = h;
+			b->next = a->next;
+			b->prev = a;
+			if (a->next)
+				a->next->prev = b;
+			else
+				_d->last = b;
+			a->next = b;
+			insertChild(node, c + 1, append ? key : b->items()[0].key, b);
+		}
+		else
+		{
+			Inner* a = (Inner*)x, *b = new Inner;
+			int h = a->n / 2;
+			if (rightmost && compare(a->keys()[a->n - 2], key) <= 0)
+				h = a->n - 1;
+			memcpy((void*)b->child, a->child + h, (a->n - h) * sizeof(Node*));
+			memcpy((void*)b->keys(), a->keys() + h, (a->n - 1 - h) * sizeof(K));
+			b->n = a->n - h;
+			a->n = h;
+			insertChild(node, c + 1, a->keys()[h - 1], b);
+			asl_destroy(a->keys() + h - 1);
+		}
+	}
+	static bool full(Node* node)
+	{
+		return node->n == (node->leaf ? (int)LEAF_MAX : (int)INNER_MAX);
+	}
+	// finds or adds the key, splitting full nodes on the way down so that there is room for it
+	T& insert(const K& key)
+	{
+		if (full(_d->root))
+		{
+			Inner* root = new Inner;
+			root->child[0] = _d->root;
+			root->n = 1;
+			_d->root = root;
+			split(root, 0, key, true);
+		}
+		Node* node = _d->root;
+		bool rightmost = true;
+		while (!node->leaf)
+		{
+			Inner* inner = (Inner*)node;
+			int c = childIndex(inner, key);
+			if (full(inner->child[c]))
+			{
+				split(inner, c, key, rightmost && c == inner->n - 1);
+				c = childIndex(inner, key);
+			}
+			rightmost = rightmost && c == inner->n - 1;
+			node = inner->child[c];
+		}
+		Leaf* leaf = (Leaf*)node;
+		int i = lowerIndex(leaf, key);
+		KeyVal* a = leaf->items();
+		if (i < leaf->n && compare(a[i].key, key) == 0)
+			return a[i].value;
+		memmove((void*)(a + i + 1), a + i, (leaf->n - i) * sizeof(KeyVal));
+		new (a + i) KeyVal(key);
+		leaf->n++;
+		_d->n++;
+		return a[i].value;
+	}
+	// refills child `c` of `node` after it lost an element, by merging it with a sibling or taking one from it
+	void rebalance(Inner* node, int c)
+	{
+		if (node->n < 2)
+			return;
+		int j = c > 0 ? c - 1 : c;
+		Node* x = node->child[j], *y = node->child[j + 1];
+		if (x->leaf)
+		{
+			Leaf* a = (Leaf*)x, *b = (Leaf*)y;
+			if (a->n + b->n <= LEAF_MAX)
+			{
+				memcpy((void*)(a->items() + a->n), b->items(), b->n * sizeof(KeyVal));
+				a->n += b->n;
+				a->next = b->next;
+				if (b->next)
+					b->next->prev = a;
+				else
+					_d->last = a;
+				delete b;
+				removeChild(node, j + 1);
+				return;
+			}
+			if (c == j + 1)
+			{
+				memmove((void*)(b->items() + 1), b->items(), b->n * sizeof(KeyVal));
+				memcpy((void*)b->items(), a->items() + a->n - 1, sizeof(KeyVal));
+				a->n--;
+				b->n++;
+			}
+			else
+			{
+				memcpy((void*)(a->items() + a->n), b->items(), sizeof(KeyVal));
+				memmove((void*)b->items(), b->items() + 1, (b->n - 1) * sizeof(KeyVal));
+				a->n++;
+				b->n--;
+			}
+			node->keys()[j] = b->items()[0].key;
+		}
+		else
+		{
+			Inner* a = (Inner*)x, *b = (Inner*)y;
+			if (a->n + b->n <= INNER_MAX)
+			{
+				asl_construct_copy(a->keys() + a->n - 1, node->keys()[j]);
+				memcpy((void*)(a->keys() + a->n), b->keys(), (b->n - 1) * sizeof(K));
+				memcpy((void*)(a->child + a->n), b->child, b->n * sizeof(Node*));
+				a->n += b->n;
+				delete b;
+				removeChild(node, j + 1);
+				return;
+			}
+			if (c == j + 1)
+			{
+				memmove((void*)(b->keys() + 1), b->keys(), (b->n - 1) * sizeof(K));
+				memmove((void*)(b->child + 1), b->child, b->n * sizeof(Node*));
+				memcpy((void*)b->keys(), node->keys() + j, sizeof(K));
+				memcpy((void*)(node->keys() + j), a->keys() + a->n - 2, sizeof(K));
+				b->child[0] = a->child[a->n - 1];
+				a->n--;
+				b->n++;
+			}
+			else
+			{
+				memcpy((void*)(a->keys() + a->n - 1), node->keys() + j, sizeof(K));
+				a->child[a->n] = b->child[0];
+				a->n++;
+				memcpy((void*)(node->keys() + j), b->keys(), sizeof(K));
+				memmove((void*)b->keys(), b->keys() + 1, (b->n - 2) * sizeof(K));
+				memmove((void*)b->child, b->child + 1, (b->n - 1) * sizeof(Node*));
+				b->n--;
+			}
+		}
+	}
+	bool remove(Node* node, const K& key)
+	{
+		if (node->leaf)
+		{
+			Leaf* leaf = (Leaf*)node;
+			int i = lowerIndex(leaf, key);
+			KeyVal* a = leaf->items();
+			if (i == leaf->n || compare(a[i].key, key) != 0)
+				return false;
+			asl_destroy(a + i);
+			memmove((void*)(a + i), a + i + 1, (leaf->n - i - 1) * sizeof(KeyVal));
+			leaf->n--;
+			_d->n--;
+			return true;
+		}
+		Inner* inner = (Inner*)node;
+		int c = childIndex(inner, key);
+		if (!remove(inner->child[c], key))
+			return false;
+		if (inner->child[c]->n < (inner->child[c]->leaf ? (int)LEAF_MIN : (int)INNER_MIN))
+			rebalance(inner, c);
+		return true;
+	}
+	/*
+	Builds the tree from `n` elements sorted by key given by an enumerator, filling leaves and nodes evenly.
+	*/
+	template<class E>
+	void build(E e, int n)
+	{
+		destroy(_d->root);
+		int m = max((n + LEAF_MAX - 1) / LEAF_MAX, 1);
+		Array<Node*> level(m);
+		Array<K> mins(m);
+		Leaf* prev = 0;
+		for (int k = 0; k < m; k++)
+		{
+			Leaf* leaf = new Leaf;
+			int size = n / m + (k < n % m ? 1 : 0);
+			for (int i = 0; i < size; i++, ++e)
+				new (leaf->items() + i) KeyVal(~e, *e);
+			leaf->n = size;
+			if (size > 0)
+				mins[k] = leaf->items()[0].key;
+			leaf->prev = prev;
+			if (prev)
+				prev->next = leaf;
+			else
+				_d->first = leaf;
+			prev = leaf;
+			level[k] = leaf;
+		}
+		_d->last = prev;
+		while (level.length() > 1)
+		{
+			int count = level.length(), m = (count + INNER_MAX - 1) / INNER_MAX;
+			Array<Node*> upper(m);
+			Array<K> upperMins(m);
+			for (int k = 0, j = 0; k < m; k++)
+			{
+				Inner* inner = new Inner;
+				int size = count / m + (k < count % m ? 1 : 0);
+				upperMins[k] = mins[j];
+				for (int i = 0; i < size; i++, j++)
+				{
+					inner->child[i] = level[j];
+					if (i > 0)
+						asl_construct_copy(inner->keys() + i - 1, mins[j]);
+				}
+				inner->n = size;
+				upper[k] = inner;
+			}
+			level = upper;
+			mins = upperMins;
+		}
+		_d->root = level[0];
+		_d->n = n;
+	}
+	struct ArrayPairs
+	{
+		const Array<K>& keys;
+		const Array<T>& values;
+		int i;
+		ArrayPairs(const Array<K>& k, const Array<T>& v) : keys(k), values(v), i(0) {}
+		void operator++() { i++; }
+		const T& operator*() const { return values[i]; }
+		const K& operator~() const { return keys[i]; }
+	};
+public:
+	BTreeMap() : _d(new Data) {}
+	/**
+	Creates a BTreeMap with the contents of a Map, in linear time
+	*/
+	BTreeMap(const Map<K, T>& m) : _d(new Data)
+	{
+		build(m.all(), m.length());
+	}
+	BTreeMap(const BTreeMap& b) : _d(b._d)
+	{
+		++_d->rc;
+	}
+	~BTreeMap()
+	{
+		release();
+	}
+	void operator=(const BTreeMap& b)
+	{
+		++b._d->rc;
+		release();
+		_d = b._d;
+	}
+	/**
+	Returns an independent copy of this map
+	*/
+	BTreeMap clone() const
+	{
+		BTreeMap b;
+		b.build(all(), length());
+		return b;
+	}
+	/**
+	Replaces the contents of the map with the given keys and values, in linear time if the keys are sorted and
+	different (otherwise they are inserted one by one)
+	*/
+	BTreeMap& loadSorted(const Array<K>& keys, const Array<T>& values)
+	{
+		for (int i = 1; i < keys.length(); i++)
+			if (compare(keys[i - 1], keys[i]) >= 0)
+			{
+				clear();
+				for (int j = 0; j < keys.length(); j++)
+					set(keys[j], values[j]);
+				return *this;
+			}
+		build(ArrayPairs(keys, values), keys.length());
+		return *this;
+	}
+	/**
+	Returns the number of elements in the map
+	*/
+	int length() const
+	{
+		return _d->n;
+	}
+	/**
+	Removes all elements
+	*/
+	void clear()
+	{
+		destroy(_d->root);
+		_d->root = _d->first = _d->last = new Leaf;
+		_d->n = 0;
+	}
+	/**
+	Returns a pointer to the value for the given key or a null pointer if it is not found
+	*/
+	const T* find(const K& key) const
+	{
+		Leaf* leaf = leafOf(key);
+		int i = lowerIndex(leaf, key);
+		return (i < leaf->n && compare(leaf->items()[i].key, key) == 0) ? &leaf->items()[i].value : 0;
+	}
+	T* find(const K& key)
+	{
+		return (T*)((const BTreeMap*)this)->find(key);
+	}
+	/**
+	Returns true if an element with the given key exists
+	*/
+	bool has(const K& key) const
+	{
+		return find(key) != 0;
+	}
+	/**
+	Returns the value for the given key or the value `def` if it is not found
+	*/
+	const T& get(const K& key, const T& def) const
+	{
+		const T* p = find(key);
+		return p ? *p : def;
+	}
+	/**
+	Returns a reference to the value associated to the given key, creating one if the key does not exist
+	*/
+	T& operator[](const K& key)
+	{
+		return insert(key);
+	}
+	T& operator[](const K& key) const
+	{
+		return ((BTreeMap*)this)->insert(key);
+	}
+	/**
+	Sets the value for the given key
+	*/
+	BTreeMap& set(const K& key, const T& value)
+	{
+		insert(key) = value;
+		return *this;
+	}
+	/**
+	Removes the element with the given key and returns true if it existed
+	*/
+	bool remove(const K& key)
+	{
+		bool removed = remove(_d->root, key);
+		while (!_d->root->leaf && _d->root->n == 1)
+		{
+			Inner* root = (Inner*)_d->root;
+			_d->root = root->child[0];
+			delete root;
+		}
+		return removed;
+	}
+	/**
+	Returns an array containing all keys of this map, in order
+	*/
+	Array<K> keys() const
+	{
+		Array<K> k;
+		k.reserve(length());
+		for (Enumerator e = all(); e; ++e)
+			k << ~e;
+		return k;
+	}
+
+	struct Enumerator
+	{
+		Leaf* leaf;
+		int i;
+		Leaf* endLeaf;
+		int endI;
+		Enumerator() : leaf(0), i(0), endLeaf(0), endI(0) {}
+		Enumerator(Leaf* l, int j) : leaf(l), i(j), endLeaf(0), endI(0) { skip(); }
+		void skip()
+		{
+			while (leaf && i >= leaf->n)
+			{
+				leaf = leaf->next;
+				i = 0;
+			}
+		}
+		void operator++()
+		{
+			i++;
+			skip();
+		}
+		T& operator*() { return leaf->items()[i].value; }
+		T* operator->() { return &leaf->items()[i].value; }
+		const K& operator~() const { return leaf->items()[i].key; }
+		operator bool() const { return leaf != 0 && (leaf != endLeaf || i != endI); }
+		Enumerator all() { return *this; }
+	};
+	/**
+	A range of elements of the map, that can be iterated with `foreach2`
+	*/
+	struct Range
+	{
+		typedef typename BTreeMap::Enumerator Enumerator;
+		Enumerator e;
+		Range(const Enumerator& e_) : e(e_) {}
+		Enumerator all() const { return e; }
+	};
+	/** Returns an enumerator for this map */
+	Enumerator all() const { return Enumerator(_d->first, 0); }
+	/**
+	Returns an enumerator starting at the first element with a key not less than `key`
+	*/
+	Enumerator lowerBound(const K& key) const
+	{
+		Leaf* leaf = leafOf(key);
+		return Enumerator(leaf, lowerIndex(leaf, key));
+	}
+	/**
+	Returns an enumerator starting at the first element with a key greater than `key`
+	*/
+	Enumerator upperBound(const K& key) const
+	{
+		Leaf* leaf = leafOf(key);
+		return Enumerator(leaf, upperIndex(leaf, key));
+	}
+	/**
+	Returns the range of elements with keys not less than `from` and less than `to`
+	*/
+	Range range(const K& from, const K& to) const
+	{
+		Enumerator e = lowerBound(from), end = lowerBound(to);
+		if (compare(from, to) >= 0)
+			return Range(Enumerator());
+		e.endLeaf = end.leaf;
+		e.endI = end.i;
+		return Range(e);
+	}
+	/**
+	Returns the range of elements with keys not less than `from`
+	*/
+	Range range(const K& from) const
+	{
+		return Range(lowerBound(from));
+	}
+};
+
+}
+#endif
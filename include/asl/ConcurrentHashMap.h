@@ -0,0 +1,210 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_CONCURRENTHASHMAP_H
+#define ASL_CONCURRENTHASHMAP_H
+
+#include <asl/HashMap.h>
+#include <asl/Mutex.h>
+#include <asl/Thread.h>
+
+namespace asl {
+
+#ifndef ASL_CACHE_LINE
+#define ASL_CACHE_LINE 64
+#endif
+
+/**
+A hash map that can be used from many threads at the same time. It is divided in shards, each a HashMap with its own
+ReadWriteLock, and each key belongs to one shard chosen from its hash. Lookups only lock their shard for reading, so
+any number of them can run in parallel, and modifications only block operations on the same shard.
+
+~~~
+ConcurrentHashMap<String, Session> sessions;
+
+// in any request thread
+Session session;
+if (sessions.get(id, session))
+	...
+sessions.set(id, newSession);
+int hits = hitCounts.compute(url, [](int& n) { n++; });
+~~~
+
+Values are returned by copy, as a reference could be invalidated by other threads. Operations that read and modify
+an element (`getOrInsert()`, `compute()`, `remove()`) are atomic. Iterating with `forEach()` locks one shard at a time,
+so it sees each shard in a consistent state, while `snapshot()` returns an ordinary HashMap copy. A
+ConcurrentHashMap cannot be copied.
+\ingroup Threading
+*/
+template<class K, class V, class H = Hasher<K> >
+class ConcurrentHashMap
+{
+	struct Shard
+	{
+		ReadWriteLock lock;
+		HashMap<K, V, H> map;
+		char pad[ASL_CACHE_LINE];
+	};
+	Shard* _shards;
+	int _mask;
+	H _hash;
+	ConcurrentHashMap(const ConcurrentHashMap&);
+	void operator=(const ConcurrentHashMap&);
+
+	// uses the high bits of the hash, as the shard's map uses the low ones
+	Shard& shardOf(const K& key) const
+	{
+		return _shards[(int)(_hash(key) >> 40) & _mask];
+	}
+public:
+	/**
+	Creates a map with the given number of shards (rounded to a power of 2), or by default 4 per processor
+	*/
+	ConcurrentHashMap(int shards = 0)
+	{
+		int n = nextPoT(max(shards > 0 ? shards : 4 * Thread::numProcessors(), 1));
+		_shards = new Shard[n];
+		_mask = n - 1;
+	}
+	~ConcurrentHashMap()
+	{
+		delete[] _shards;
+	}
+	/**
+	Returns the number of elements (which may be changing in other threads)
+	*/
+	int length() const
+	{
+		int n = 0;
+		for (int i = 0; i <= _mask; i++)
+		{
+			ReadLock _(_shards[i].lock);
+			n += _shards[i].map.length();
+		}
+		return n;
+	}
+	/**
+	Checks if the given key exists in the map
+	*/
+	bool has(const K& key) const
+	{
+		Shard& s = shardOf(key);
+		ReadLock _(s.lock);
+		return s.map.has(key);
+	}
+	/**
+	Copies the value for the given key into `value` and returns true, or returns false if the key is not found
+	*/
+	bool get(const K& key, V& value) const
+	{
+		Shard& s = shardOf(key);
+		ReadLock _(s.lock);
+		const V* p = s.map.find(key);
+		if (!p)
+			return false;
+		value = *p;
+		return true;
+	}
+	/**
+	Returns the value for the given key or the value `def` if it is not found
+	*/
+	V get(const K& key, const V& def) const
+	{
+		Shard& s = shardOf(key);
+		ReadLock _(s.lock);
+		const V* p = s.map.find(key);
+		return p ? *p : def;
+	}
+	/**
+	Sets the value for the given key, adding it or replacing the previous one
+	*/
+	void set(const K& key, const V& value)
+	{
+		Shard& s = shardOf(key);
+		WriteLock _(s.lock);
+		s.map[key] = value;
+	}
+	/**
+	Returns the value for the given key, inserting `value` first if the key is not in the map
+	*/
+	V getOrInsert(const K& key, const V& value)
+	{
+		Shard& s = shardOf(key);
+		{
+			ReadLock _(s.lock);
+			if (const V* p = s.map.find(key))
+				return *p;
+		}
+		WriteLock _(s.lock);
+		if (const V* p = s.map.find(key))
+			return *p;
+		return s.map[key] = value;
+	}
+	/**
+	Calls `f(value)` with a reference to the value for the given key (default constructed if the key is new), with
+	the key's shard locked, and returns the resulting value; `f` should be short and must not use this map
+	*/
+	template<class F>
+	V compute(const K& key, const F& f)
+	{
+		Shard& s = shardOf(key);
+		WriteLock _(s.lock);
+		V& value = s.map[key];
+		f(value);
+		return value;
+	}
+	/**
+	Removes the given key and returns true if it was in the map
+	*/
+	bool remove(const K& key)
+	{
+		Shard& s = shardOf(key);
+		WriteLock _(s.lock);
+		int n = s.map.length();
+		s.map.remove(key);
+		return s.map.length() < n;
+	}
+	/**
+	Removes all elements
+	*/
+	void clear()
+	{
+		for (int i = 0; i <= _mask; i++)
+		{
+			WriteLock _(_shards[i].lock);
+			_shards[i].map.clear();
+		}
+	}
+	/**
+	Calls `f(key, value)` for all elements, locking each shard for reading while its elements are visited;
+	`f` must not modify this map
+	*/
+	template<class F>
+	void forEach(const F& f) const
+	{
+		for (int i = 0; i <= _mask; i++)
+		{
+			ReadLock _(_shards[i].lock);
+			foreach2(K& k, V& v, _shards[i].map)
+				f(k, v);
+		}
+	}
+	/**
+	Returns a copy of the contents as a HashMap
+	*/
+	HashMap<K, V, H> snapshot() const
+	{
+		HashMap<K, V, H> m;
+		for (int i = 0; i <= _mask; i++)
+		{
+			ReadLock _(_shards[i].lock);
+			foreach2(K& k, V& v, _shards[i].map)
+				m[k] = v;
+		}
+		return m;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,348 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_CONCURRENTQUEUE_H
+#define ASL_CONCURRENTQUEUE_H
+
+#include <asl/Array.h>
+#include <asl/atomic.h>
+#include <asl/time.h>
+#include <asl/Mutex.h>
+
+namespace asl {
+
+#ifndef ASL_CACHE_LINE
+#define ASL_CACHE_LINE 64
+#endif
+
+// queue positions wrap around, so they are added and compared as unsigned numbers
+inline int seqAdd(int a, int b) { return (int)((unsigned)a + (unsigned)b); }
+inline int seqDiff(int a, int b) { return (int)((unsigned)a - (unsigned)b); }
+
+/**
+A bounded, lock-free queue for any number of producer and consumer threads. Its capacity (rounded up to a power
+of 2) is fixed at construction, and `tryPut()` fails if the queue is full while `tryGet()` fails if it is empty.
+
+~~~
+ConcurrentQueue<Job> jobs(1024);
+// producers
+if (!jobs.tryPut(job))
+	reject(job);
+// consumers
+Job job;
+while (jobs.tryGet(job))
+	process(job);
+~~~
+
+Each slot has a sequence number telling whether it is ready to be written or read for a given position, so
+producers and consumers only contend on the atomic increment of their own position. Use a BlockingQueue to wait
+until there is room or items.
+\ingroup Threading
+*/
+template<class T>
+class ConcurrentQueue
+{
+	struct Cell
+	{
+		volatile int seq;
+		T data;
+	};
+	Array<Cell> _cells;
+	int _mask;
+	char _pad0[ASL_CACHE_LINE];
+	volatile int _tail;
+	char _pad1[ASL_CACHE_LINE];
+	volatile int _head;
+	char _pad2[ASL_CACHE_LINE];
+	ConcurrentQueue(const ConcurrentQueue&);
+	void operator=(const ConcurrentQueue&);
+public:
+	/**
+	Creates a queue that can hold at least `capacity` items
+	*/
+	ConcurrentQueue(int capacity)
+	{
+		int n = 2;
+		while (n < capacity)
+			n *= 2;
+		_cells.resize(n);
+		for (int i = 0; i < n; i++)
+			_cells[i].seq = i;
+		_mask = n - 1;
+		_head = _tail = 0;
+	}
+	/**
+	Returns the maximum number of items
+	*/
+	int capacity() const { return _mask + 1; }
+	/**
+	Returns the approximate number of items
+	*/
+	int length() const { return max(seqDiff(atomicLoad(&_tail), atomicLoad(&_head)), 0); }
+	/**
+	Adds an item at the end if there is room, and returns false if the queue is full
+	*/
+	bool tryPut(const T& x)
+	{
+		int pos = atomicLoad(&_tail);
+		Cell* cell;
+		while (1)
+		{
+			cell = &_cells[pos & _mask];
+			int d = seqDiff(atomicLoad(&cell->seq), pos);
+			if (d == 0)
+			{
+				if (atomicCas(&_tail, pos, seqAdd(pos, 1)))
+					break;
+			}
+			else if (d < 0)
+				return false;
+			pos = atomicLoad(&_tail);
+		}
+		cell->data = x;
+		atomicStore(&cell->seq, seqAdd(pos, 1));
+		return true;
+	}
+	/**
+	Takes the first item into `x` if there is one, and returns false if the queue is empty
+	*/
+	bool tryGet(T& x)
+	{
+		int pos = atomicLoad(&_head);
+		Cell* cell;
+		while (1)
+		{
+			cell = &_cells[pos & _mask];
+			int d = seqDiff(atomicLoad(&cell->seq), seqAdd(pos, 1));
+			if (d == 0)
+			{
+				if (atomicCas(&_head, pos, seqAdd(pos, 1)))
+					break;
+			}
+			else if (d < 0)
+				return false;
+			pos = atomicLoad(&_head);
+		}
+		x = cell->data;
+		cell->data = T();
+		atomicStore(&cell->seq, seqAdd(pos, _mask + 1));
+		return true;
+	}
+};
+
+/**
+A bounded, lock-free queue for exactly one producer thread and one consumer thread. It is cheaper than a
+ConcurrentQueue as each side only reads the other's position, without atomic read-modify-write operations.
+\ingroup Threading
+*/
+template<class T>
+class SpscQueue
+{
+	Array<T> _items;
+	int _mask;
+	char _pad0[ASL_CACHE_LINE];
+	volatile int _tail;
+	char _pad1[ASL_CACHE_LINE];
+	volatile int _head;
+	char _pad2[ASL_CACHE_LINE];
+	SpscQueue(const SpscQueue&);
+	void operator=(const SpscQueue&);
+public:
+	/**
+	Creates a queue that can hold at least `capacity` items
+	*/
+	SpscQueue(int capacity)
+	{
+		int n = 2;
+		while (n < capacity)
+			n *= 2;
+		_items.resize(n);
+		_mask = n - 1;
+		_head = _tail = 0;
+	}
+	int capacity() const { return _mask + 1; }
+	int length() const { return seqDiff(atomicLoad(&_tail), atomicLoad(&_head)); }
+	/**
+	Adds an item at the end if there is room (call only from the producer thread)
+	*/
+	bool tryPut(const T& x)
+	{
+		int t = _tail;
+		if (seqDiff(t, atomicLoad(&_head)) > _mask)
+			return false;
+		_items[t & _mask] = x;
+		atomicStore(&_tail, seqAdd(t, 1));
+		return true;
+	}
+	/**
+	Takes the first item if there is one (call only from the consumer thread)
+	*/
+	bool tryGet(T& x)
+	{
+		int h = _head;
+		if (atomicLoad(&_tail) == h)
+			return false;
+		x = _items[h & _mask];
+		_items[h & _mask] = T();
+		atomicStore(&_head, seqAdd(h, 1));
+		return true;
+	}
+};
+
+/**
+A BlockingQueue wraps a bounded lock-free queue (by default a ConcurrentQueue) so that producers can wait until
+there is room and consumers can wait until there are items, optionally with a timeout. Waiting threads first spin
+for a short time and then sleep until woken by the other side, which only takes a lock when someone is sleeping.
+
+~~~
+BlockingQueue<Message> inbox(256);
+// producer
+inbox.put(msg);
+// consumer
+Array<Message> batch;
+while (inbox.drain(batch, 64, 1.0) > 0)
+{
+	process(batch);
+	batch.clear();
+}
+~~~
+\ingroup Threading
+*/
+template<class T, class Q = ConcurrentQueue<T> >
+class BlockingQueue
+{
+	enum { SPIN = 100 };
+	Q _q;
+	Mutex _mutex;
+	Condition _notEmpty, _notFull;
+	volatile int _getters, _putters;
+	BlockingQueue(const BlockingQueue&);
+	void operator=(const BlockingQueue&);
+
+	void wake(volatile int& waiting, Condition& c)
+	{
+		atomicFence();
+		if (atomicLoad(&waiting) > 0)
+		{
+			Lock _(_mutex);
+			c.signal();
+		}
+	}
+public:
+	/**
+	Creates a queue that can hold at least `capacity` items
+	*/
+	BlockingQueue(int capacity) : _q(capacity), _notEmpty(_mutex), _notFull(_mutex), _getters(0), _putters(0) {}
+	int capacity() const { return _q.capacity(); }
+	int length() const { return _q.length(); }
+	/**
+	Adds an item if there is room, without waiting, and returns false if the queue is full
+	*/
+	bool tryPut(const T& x)
+	{
+		if (!_q.tryPut(x))
+			return false;
+		wake(_getters, _notEmpty);
+		return true;
+	}
+	/**
+	Takes the first item if there is one, without waiting, and returns false if the queue is empty
+	*/
+	bool tryGet(T& x)
+	{
+		if (!_q.tryGet(x))
+			return false;
+		wake(_putters, _notFull);
+		return true;
+	}
+	/**
+	Adds an item, waiting up to `timeout` seconds (or forever if negative) for room; returns false on timeout
+	*/
+	bool put(const T& x, double timeout = -1)
+	{
+		for (int i = 0; i < SPIN; i++)
+			if (tryPut(x))
+				return true;
+		double deadline = now() + timeout;
+		bool ok;
+		{
+			Lock _(_mutex);
+			atomicInc(&_putters);
+			while (!(ok = _q.tryPut(x)))
+			{
+				double t = deadline - now();
+				if (timeout < 0)
+					_notFull.wait();
+				else if (t <= 0)
+					break;
+				else
+					_notFull.wait(t);
+			}
+			atomicDec(&_putters);
+		}
+		if (ok)
+			wake(_getters, _notEmpty);
+		return ok;
+	}
+	/**
+	Takes the first item into `x`, waiting up to `timeout` seconds (or forever if negative) for one; returns false on
+	timeout
+	*/
+	bool get(T& x, double timeout = -1)
+	{
+		for (int i = 0; i < SPIN; i++)
+			if (tryGet(x))
+				return true;
+		double deadline = now() + timeout;
+		bool ok;
+		{
+			Lock _(_mutex);
+			atomicInc(&_getters);
+			while (!(ok = _q.tryGet(x)))
+			{
+				double t = deadline - now();
+				if (timeout < 0)
+					_notEmpty.wait();
+				else if (t <= 0)
+					break;
+				else
+					_notEmpty.wait(t);
+			}
+			atomicDec(&_getters);
+		}
+		if (ok)
+			wake(_putters, _notFull);
+		return ok;
+	}
+	/**
+	Takes the first item, waiting as long as needed
+	*/
+	T get()
+	{
+		T x;
+		get(x);
+		return x;
+	}
+	/**
+	Appends up to `max` items to `items`, waiting up to `timeout` seconds for the first one (not waiting if 0, or
+	forever if negative) and then taking only those already available; returns the number of items taken
+	*/
+	int drain(Array<T>& items, int max, double timeout = 0)
+	{
+		T x;
+		if (!(timeout == 0 ? tryGet(x) : get(x, timeout)))
+			return 0;
+		items << x;
+		int n = 1;
+		while (n < max && tryGet(x))
+		{
+			items << x;
+			n++;
+		}
+		return n;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,372 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_FLATHASHMAP_H
+#define ASL_FLATHASHMAP_H
+
+#include <asl/HashMap.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ASL_FLATHASH_SSE2
+#endif
+
+namespace asl {
+
+/*
+A group of 16 control bytes of a FlatHashMap. Each byte is EMPTY, DELETED, or 7 bits of the hash of the
+key in that slot. The match functions return a bit mask with bit `i` set if slot `i` of the group matches.
+*/
+struct FlatHashGroup
+{
+	enum { SIZE = 16, EMPTY = 0x80, DELETED = 0xfe };
+#ifdef ASL_FLATHASH_SSE2
+	__m128i ctrl;
+	FlatHashGroup(const byte* p) : ctrl(_mm_loadu_si128((const __m128i*)p)) {}
+	int match(byte h) const { return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h))); }
+	int matchEmpty() const { return match(EMPTY); }
+	int matchFree() const { return _mm_movemask_epi8(ctrl); }
+#else
+	const byte* ctrl;
+	FlatHashGroup(const byte* p) : ctrl(p) {}
+	int match(byte h) const
+	{
+		int m = 0;
+		for (int i = 0; i < SIZE; i++)
+			m |= (ctrl[i] == h) << i;
+		return m;
+	}
+	int matchEmpty() const { return match(EMPTY); }
+	int matchFree() const
+	{
+		int m = 0;
+		for (int i = 0; i < SIZE; i++)
+			m |= (ctrl[i] >> 7) << i;
+		return m;
+	}
+#endif
+};
+
+/** Returns the index of the lowest bit set in a nonzero number */
+inline int lowestBit(unsigned x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(x);
+#else
+	int i = 0;
+	while (!(x & 1)) { x >>= 1; i++; }
+	return i;
+#endif
+}
+
+/**
+A FlatHashMap is a hash map with the same interface as HashMap but stored as a single table with open addressing:
+keys and values are kept inline in the table (no allocation per element), and a parallel array of one control byte
+per slot holds 7 bits of each key's hash. A lookup finds a group of 16 slots from the hash and compares all their
+control bytes with one SIMD instruction (SSE2 where available), so only slots whose hash bits match have their key
+compared, and probing ends at the first group with an empty slot.
+
+~~~
+FlatHashMap<String, int> counts;
+counts["apple"]++;
+if (int* n = counts.find("pear"))
+	...
+foreach2(String& name, int n, counts)
+	printf("%s: %i\n", *name, n);
+~~~
+
+The table keeps at most 7/8 of its slots used and doubles when it gets fuller. Removed elements leave a mark that
+is reused by later insertions. Pointers to values are invalidated when the table grows. Keys are hashed by the hasher
+`H` as in HashMap. As other containers, copies of a FlatHashMap share their contents, and `clone()` makes an
+independent copy.
+\ingroup Containers
+*/
+template<class K, class T, class H = Hasher<K> >
+class FlatHashMap
+{
+protected:
+	struct KeyVal
+	{
+		K key;
+		T value;
+		KeyVal(const K& k) : key(k), value() {}
+		KeyVal(const KeyVal& b) : key(b.key), value(b.value) {}
+	};
+	struct Data
+	{
+		AtomicCount rc;
+		int n;         // number of elements
+		int deleted;   // number of deleted marks
+		int mask;      // number of slots - 1, the number of slots being a multiple of 16 and a power of 2
+		byte* ctrl;
+		KeyVal* slots;
+	};
+	Data* _d;
+	H _hash;
+
+	unsigned mix(const K& key, byte& h2) const
+	{
+		ULong h = _hash(key);
+		h2 = (byte)(h >> 57);
+		return (unsigned)h;
+	}
+	static Data* alloc(int slots)
+	{
+		Data* d = new Data;
+		d->n = 0;
+		d->deleted = 0;
+		d->mask = slots - 1;
+		d->ctrl = (byte*)malloc(slots);
+		d->slots = (KeyVal*)malloc(slots * sizeof(KeyVal));
+		if (!d->ctrl || !d->slots)
+			ASL_BAD_ALLOC();
+		memset(d->ctrl, FlatHashGroup::EMPTY, slots);
+		++d->rc;
+		return d;
+	}
+	static void destroy(Data* d)
+	{
+		for (int i = 0; i <= d->mask; i++)
+			if (d->ctrl[i] < 0x80)
+				asl_destroy(d->slots + i);
+		free(d->ctrl);
+		free(d->slots);
+		delete d;
+	}
+	void release()
+	{
+		if (--_d->rc == 0)
+			destroy(_d);
+	}
+	static int slotsFor(int n)
+	{
+		int s = FlatHashGroup::SIZE;
+		while (s - s / 8 <= n)
+			s *= 2;
+		return s;
+	}
+	// returns the slot of the key, or -1
+	int indexOf(const K& key, unsigned pos, byte h2) const
+	{
+		int groups = (_d->mask + 1) / FlatHashGroup::SIZE;
+		for (int g = pos & (groups - 1), step = 1;; g = (g + step++) & (groups - 1))
+		{
+			FlatHashGroup group(_d->ctrl + g * FlatHashGroup::SIZE);
+			for (int m = group.match(h2); m; m &= m - 1)
+			{
+				int i = g * FlatHashGroup::SIZE + lowestBit(m);
+				if (_d->slots[i].key == key)
+					return i;
+			}
+			if (group.matchEmpty())
+				return -1;
+		}
+	}
+	// returns the first empty or deleted slot in the probe sequence
+	static int freeSlot(const Data* d, unsigned pos)
+	{
+		int groups = (d->mask + 1) / FlatHashGroup::SIZE;
+		for (int g = pos & (groups - 1), step = 1;; g = (g + step++) & (groups - 1))
+		{
+			int m = FlatHashGroup(d->ctrl + g * FlatHashGroup::SIZE).matchFree();
+			if (m)
+				return g * FlatHashGroup::SIZE + lowestBit(m);
+		}
+	}
+	// moves the elements to new arrays of the given size, kept in the same Data so that copies still share it
+	void resize(int slots)
+	{
+		byte* ctrl = _d->ctrl;
+		KeyVal* kv = _d->slots;
+		int mask = _d->mask;
+		_d->ctrl = (byte*)malloc(slots);
+		_d->slots = (KeyVal*)malloc(slots * sizeof(KeyVal));
+		if (!_d->ctrl || !_d->slots)
+			ASL_BAD_ALLOC();
+		memset(_d->ctrl, FlatHashGroup::EMPTY, slots);
+		_d->mask = slots - 1;
+		_d->deleted = 0;
+		for (int i = 0; i <= mask; i++)
+		{
+			if (ctrl[i] >= 0x80)
+				continue;
+			byte h2;
+			unsigned pos = mix(kv[i].key, h2);
+			int j = freeSlot(_d, pos);
+			_d->ctrl[j] = h2;
+			memcpy((void*)(_d->slots + j), (const void*)(kv + i), sizeof(KeyVal));
+		}
+		free(ctrl);
+		free(kv);
+	}
+	T& insert(const K& key)
+	{
+		byte h2;
+		unsigned pos = mix(key, h2);
+		int i = indexOf(key, pos, h2);
+		if (i >= 0)
+			return _d->slots[i].value;
+		int slots = _d->mask + 1;
+		if (_d->n + _d->deleted >= slots - slots / 8)
+			resize(_d->n >= slots / 2 ? slots * 2 : slots);
+		i = freeSlot(_d, pos);
+		if (_d->ctrl[i] == FlatHashGroup::DELETED)
+			_d->deleted--;
+		_d->ctrl[i] = h2;
+		new (_d->slots + i) KeyVal(key);
+		_d->n++;
+		return _d->slots[i].value;
+	}
+public:
+	FlatHashMap() : _d(alloc(FlatHashGroup::SIZE)) {}
+	/**
+	Creates a map with room for `n` elements before it needs to grow
+	*/
+	FlatHashMap(int n) : _d(alloc(slotsFor(n))) {}
+	FlatHashMap(const FlatHashMap& b) : _d(b._d), _hash(b._hash)
+	{
+		++_d->rc;
+	}
+	~FlatHashMap()
+	{
+		release();
+	}
+	void operator=(const FlatHashMap& b)
+	{
+		++b._d->rc;
+		release();
+		_d = b._d;
+		_hash = b._hash;
+	}
+	/**
+	Returns an independent copy of this map
+	*/
+	FlatHashMap clone() const
+	{
+		FlatHashMap b;
+		b._hash = _hash;
+		b.resize(_d->mask + 1);
+		for (int i = 0; i <= _d->mask; i++)
+		{
+			if (_d->ctrl[i] < 0x80)
+			{
+				asl_construct_copy(b._d->slots + i, _d->slots[i]);
+				b._d->n++;
+			}
+			b._d->ctrl[i] = _d->ctrl[i];
+		}
+		b._d->deleted = _d->deleted;
+		return b;
+	}
+	/**
+	Clears the map removing all elements.
+	*/
+	void clear()
+	{
+		for (int i = 0; i <= _d->mask; i++)
+			if (_d->ctrl[i] < 0x80)
+				asl_destroy(_d->slots + i);
+		memset(_d->ctrl, FlatHashGroup::EMPTY, _d->mask + 1);
+		_d->n = 0;
+		_d->deleted = 0;
+	}
+	/**
+	Returns a reference to the value associated to the given key,
+	creating one if the key does not exist.
+	*/
+	T& operator[](const K& key)
+	{
+		return insert(key);
+	}
+	const T& operator[](const K& key) const
+	{
+		return ((FlatHashMap*)this)->insert(key);
+	}
+	/**
+	Returns the value for the given key or the value `def` if it is not found
+	*/
+	const T& get(const K& key, const T& def) const
+	{
+		const T* p = find(key);
+		return p ? *p : def;
+	}
+	/**
+	Returns a pointer to the value for the given key or a null pointer if it is not found
+	*/
+	const T* find(const K& key) const
+	{
+		byte h2;
+		unsigned pos = mix(key, h2);
+		int i = indexOf(key, pos, h2);
+		return i >= 0 ? &_d->slots[i].value : 0;
+	}
+	T* find(const K& key)
+	{
+		return (T*)((const FlatHashMap*)this)->find(key);
+	}
+	/**
+	Checks if the given key exists in the map
+	*/
+	bool has(const K& key) const
+	{
+		return find(key) != 0;
+	}
+	/**
+	Removes the given key
+	*/
+	void remove(const K& key)
+	{
+		byte h2;
+		unsigned pos = mix(key, h2);
+		int i = indexOf(key, pos, h2);
+		if (i < 0)
+			return;
+		asl_destroy(_d->slots + i);
+		// a lookup stops at a group with an empty slot, so if this group has one, the slot can be made empty
+		int g = i & ~(FlatHashGroup::SIZE - 1);
+		if (FlatHashGroup(_d->ctrl + g).matchEmpty())
+			_d->ctrl[i] = FlatHashGroup::EMPTY;
+		else
+		{
+			_d->ctrl[i] = FlatHashGroup::DELETED;
+			_d->deleted++;
+		}
+		_d->n--;
+	}
+	/**
+	Returns the number of elements in the map
+	*/
+	int length() const
+	{
+		return _d->n;
+	}
+	/**
+	Returns the fraction of slots used
+	*/
+	float fillFactor() const
+	{
+		return (float)_d->n / (_d->mask + 1);
+	}
+
+	struct Enumerator
+	{
+		Data* d;
+		int i;
+		Enumerator() : d(0), i(0) {}
+		Enumerator(const FlatHashMap& m) : d(m._d), i(-1) { ++*this; }
+		void operator++()
+		{
+			while (++i <= d->mask && d->ctrl[i] >= 0x80) {}
+		}
+		T& operator*() { return d->slots[i].value; }
+		T* operator->() { return &d->slots[i].value; }
+		const K& operator~() { return d->slots[i].key; }
+		operator bool() const { return i <= d->mask; }
+		Enumerator all() { return *this; }
+	};
+	Enumerator all() { return Enumerator(*this); }
+};
+
+}
+#endif
@@ -0,0 +1,400 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_FUTURE_H
+#define ASL_FUTURE_H
+
+#include <asl/Thread.h>
+#include <asl/Pointer.h>
+
+#ifdef ASL_EXP_THREADING
+
+namespace asl {
+
+template<class T>
+class Promise;
+
+struct FutureStateBase
+{
+	Mutex mutex;
+	Condition changed;
+	volatile bool done;
+	Array<Task*> continuations;
+	FutureStateBase() : done(false) { changed.use(mutex); }
+	~FutureStateBase()
+	{
+		for (int i = 0; i < continuations.length(); i++)
+			delete continuations[i];
+	}
+	// marks the state as done (with the mutex locked) and returns the continuations to schedule
+	Array<Task*> finish()
+	{
+		Array<Task*> tasks = continuations;
+		continuations = Array<Task*>();
+		done = true;
+		changed.signal();
+		return tasks;
+	}
+	static void spawn(const Array<Task*>& tasks)
+	{
+		for (int i = 0; i < tasks.length(); i++)
+			TaskPool::global().spawn(tasks[i]);
+	}
+};
+
+template<class T>
+struct FutureState : public FutureStateBase
+{
+	T value;
+};
+
+template<>
+struct FutureState<void> : public FutureStateBase
+{
+};
+
+/*
+Calls a function and sets a promise with its result, or just sets it if the function returns void
+*/
+template<class R>
+struct FutureSetter
+{
+	template<class F>
+	static void run(const Promise<R>& promise, const F& f) { promise.set(f()); }
+};
+
+template<>
+struct FutureSetter<void>
+{
+	template<class P, class F>
+	static void run(const P& promise, const F& f) { f(); promise.set(); }
+};
+
+/*
+The parts of a Future that do not depend on the type of its value
+*/
+template<class T>
+class FutureBase
+{
+public:
+	/**
+	Returns true if the value has been set
+	*/
+	bool ready() const { return _state->done; }
+	/**
+	Waits up to `timeout` seconds for the value to be set and returns true if it was
+	*/
+	bool wait(double timeout)
+	{
+		FutureState<T>& s = *_state;
+		TaskPool& pool = TaskPool::global();
+		bool help = pool.isWorker();
+		double deadline = now() + timeout;
+		while (!s.done)
+		{
+			double t = deadline - now();
+			if (t <= 0)
+				return false;
+			if (help && pool.runPending())
+				continue;
+			Lock _(s.mutex);
+			if (!s.done)
+				s.changed.wait(help ? min(t, 0.001) : t);
+		}
+		return true;
+	}
+	/**
+	Calls `f()`, without arguments, in the task pool when the value is set (or right away if it is already)
+	*/
+	template<class F>
+	void onReady(const F& f) const
+	{
+		Task* task = TaskPool::task(f);
+		{
+			Lock _(_state->mutex);
+			if (!_state->done)
+			{
+				_state->continuations << task;
+				return;
+			}
+		}
+		TaskPool::global().spawn(task);
+	}
+protected:
+	FutureBase(const Shared<FutureState<T> >& s) : _state(s) {}
+	// waits until the value is set, running other tasks meanwhile if called from a pool thread
+	void await()
+	{
+		FutureState<T>& s = *_state;
+		TaskPool& pool = TaskPool::global();
+		bool help = pool.isWorker();
+		while (!s.done)
+		{
+			if (help && pool.runPending())
+				continue;
+			Lock _(s.mutex);
+			if (s.done)
+				break;
+			if (help)
+				s.changed.wait(0.001);
+			else
+				s.changed.wait();
+		}
+	}
+	Shared<FutureState<T> > _state;
+};
+
+/**
+A Future is a value that will be available later, when some task or thread sets it through a Promise. It can be
+waited for, with or without a timeout, or given a function to run with the value when it arrives, which gives a new
+Future for the result of that function:
+
+~~~
+Future<String> page = async([=]() { return Http::get(url).text(); });
+Future<int> words = page.then([](const String& text) { return text.split().length(); });
+...
+if (words.wait(2.0))
+	printf("%i words\n", words.value());
+~~~
+
+`async()` runs a function in the threads of `TaskPool::global()`, and continuations given to `then()` run there too,
+so they should not block for long. Waiting for a future from a pool thread runs other pending tasks meanwhile.
+Several futures can be combined with `whenAll()` and `whenAny()`. Futures are shared: copies refer to the same value.
+
+A `Future<void>` only signals that something finished, and its continuations take no argument. It is what `async()`
+and `then()` return for functions that return nothing:
+
+~~~
+Future<void> saved = async([=]() { File(path).put(data); });
+saved.then([]() { printf("saved\n"); });
+~~~
+
+Needs lambda support.
+\ingroup Threading
+*/
+template<class T>
+class Future : public FutureBase<T>
+{
+public:
+	/**
+	Creates a future that is not associated with any promise and will never be ready
+	*/
+	Future() : FutureBase<T>(new FutureState<T>()) {}
+	using FutureBase<T>::wait;
+	/**
+	Waits until the value is set and returns it
+	*/
+	T& wait()
+	{
+		this->await();
+		return this->_state->value;
+	}
+	/**
+	Returns the value, which is only valid after the future is ready
+	*/
+	T& value() { return this->_state->value; }
+	const T& value() const { return this->_state->value; }
+	/**
+	Returns a future for the result of `f(value)`, which will be called in the task pool when this future is ready
+	*/
+	template<class F>
+	Future<decltype((*(F*)0)(*(T*)0))> then(const F& f) const
+	{
+		typedef decltype((*(F*)0)(*(T*)0)) R;
+		Promise<R> promise;
+		Future<T> self = *this;
+		this->onReady([=]() mutable {
+			FutureSetter<R>::run(promise, [&]() { return f(self.value()); });
+		});
+		return promise.future();
+	}
+protected:
+	friend class Promise<T>;
+	Future(const Shared<FutureState<T> >& s) : FutureBase<T>(s) {}
+};
+
+template<>
+class Future<void> : public FutureBase<void>
+{
+public:
+	Future() : FutureBase<void>(new FutureState<void>()) {}
+	using FutureBase<void>::wait;
+	/**
+	Waits until the future is ready
+	*/
+	void wait() { await(); }
+	/**
+	Returns a future for the result of `f()`, which will be called in the task pool when this future is ready
+	*/
+	template<class F>
+	Future<decltype((*(F*)0)())> then(const F& f) const
+	{
+		typedef decltype((*(F*)0)()) R;
+		Promise<R> promise;
+		onReady([=]() {
+			FutureSetter<R>::run(promise, f);
+		});
+		return promise.future();
+	}
+protected:
+	friend class Promise<void>;
+	Future(const Shared<FutureState<void> >& s) : FutureBase<void>(s) {}
+};
+
+/**
+A Promise is the producing side of a Future: some thread sets its value with `set()`, and that makes the futures
+obtained with `future()` ready. If a promise is never set, its futures are never ready.
+
+~~~
+Promise<Var> promise;
+Future<Var> result = promise.future();
+Thread thread([=]() mutable {
+	promise.set(Json::decode(socket.readLine()));
+});
+...
+Var data = result.wait();
+~~~
+\ingroup Threading
+*/
+template<class T>
+class Promise
+{
+public:
+	Promise() : _state(new FutureState<T>()) {}
+	/**
+	Returns the future for this promise's value
+	*/
+	Future<T> future() const { return Future<T>(_state); }
+	/**
+	Sets the value, waking up waiting threads and scheduling continuations; returns false, ignoring the value, if it
+	was already set
+	*/
+	bool set(const T& value) const
+	{
+		Array<Task*> continuations;
+		{
+			Lock _(_state->mutex);
+			if (_state->done)
+				return false;
+			_state->value = value;
+			continuations = _state->finish();
+		}
+		FutureStateBase::spawn(continuations);
+		return true;
+	}
+protected:
+	Shared<FutureState<T> > _state;
+};
+
+template<>
+class Promise<void>
+{
+public:
+	Promise() : _state(new FutureState<void>()) {}
+	Future<void> future() const { return Future<void>(_state); }
+	/**
+	Makes the futures ready; returns false if they already were
+	*/
+	bool set() const
+	{
+		Array<Task*> continuations;
+		{
+			Lock _(_state->mutex);
+			if (_state->done)
+				return false;
+			continuations = _state->finish();
+		}
+		FutureStateBase::spawn(continuations);
+		return true;
+	}
+protected:
+	Shared<FutureState<void> > _state;
+};
+
+/**
+Runs `f()` in the task pool and returns a future for its result
+\ingroup Threading
+*/
+template<class F>
+Future<decltype((*(F*)0)())> async(const F& f)
+{
+	typedef decltype((*(F*)0)()) R;
+	Promise<R> promise;
+	TaskPool::global().spawn([=]() {
+		FutureSetter<R>::run(promise, f);
+	});
+	return promise.future();
+}
+
+/**
+Returns a future that is ready when all the given futures are ready, with their values in the same order
+\ingroup Threading
+*/
+template<class T>
+Future<Array<T> > whenAll(const Array<Future<T> >& futures)
+{
+	struct All
+	{
+		AtomicCount left;
+		Array<Future<T> > futures;
+		Promise<Array<T> > promise;
+		All(const Array<Future<T> >& f) : left(f.length()), futures(f.clone()) {}
+	};
+	Shared<All> all = new All(futures);
+	if (futures.length() == 0)
+		all->promise.set(Array<T>());
+	for (int i = 0; i < futures.length(); i++)
+		futures[i].onReady([=]() {
+			if (--all->left != 0)
+				return;
+			Array<T> values(all->futures.length());
+			for (int j = 0; j < values.length(); j++)
+				values[j] = all->futures[j].value();
+			all->promise.set(values);
+		});
+	return all->promise.future();
+}
+
+/**
+Returns a future that is ready when all the given futures of type void are ready
+\ingroup Threading
+*/
+inline Future<void> whenAll(const Array<Future<void> >& futures)
+{
+	struct All
+	{
+		AtomicCount left;
+		Promise<void> promise;
+		All(int n) : left(n) {}
+	};
+	Shared<All> all = new All(futures.length());
+	if (futures.length() == 0)
+		all->promise.set();
+	for (int i = 0; i < futures.length(); i++)
+		futures[i].onReady([=]() {
+			if (--all->left == 0)
+				all->promise.set();
+		});
+	return all->promise.future();
+}
+
+/**
+Returns a future that is ready when any of the given futures is ready, with the index of the first one
+\ingroup Threading
+*/
+template<class T>
+Future<int> whenAny(const Array<Future<T> >& futures)
+{
+	Promise<int> promise;
+	for (int i = 0; i < futures.length(); i++)
+		futures[i].onReady([=]() {
+			promise.set(i);
+		});
+	return promise.future();
+}
+
+}
+
+#endif
+
+#endif
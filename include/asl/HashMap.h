@@ -6,50 +6,10 @@
 
 #include <asl/Array.h>
 #include <asl/String.h>
+#include <asl/hash.h>
 
 namespace asl {
 
-inline int hash(int x)
-{
-	return x;
-}
-
-inline int hash(const String& s)
-{
-	int h = 0, n = s.length();
-	const char* p = s;
-	for(int i=0; i<n; i++)
-		h = 33*h + p[i];
-	return h;
-}
-
-inline int hash(const Array<byte>& s)
-{
-	int h = 0, n = s.length();
-	const byte* p = s;
-	for (int i = 0; i<n; i++)
-		h = 33 * h + p[i];
-	return h;
-}
-
-template<typename T>
-inline int hash(T* p)
-{
-	return ((int)p) >> 2;
-}
-
-template<typename T>
-inline int hash(const T& x)
-{
-	int h = 0;
-	const byte* p = (const byte*)&x;
-	for(int i=0; i<sizeof(x); i++)
-		h = 33*h + p[i];
-	return h;
-}
-
-#define ASL_HMAP_SKIP (2 + (sizeof(AtomicCount)-1)/sizeof(void*))
-
 inline int nextPoT(int n)
 {
 	n--;
@@ -63,8 +23,9 @@ inline int nextPoT(int n)
 
 /**
 This class implements a hash map, an unordered map of keys to values. It is similar to
-class Map but elements will not keep a defined order. There must be a global function `hash(const K&)`
-for the key type `K` (there is a default hash function that may fit). Inserting and finding elements is
+class Map but elements will not keep a defined order. Keys are hashed by the hasher `H`, by default `Hasher<K>`,
+which uses the global function `hash64(const K&, ULong seed)` (see \ref Hashing; there is a default that may fit).
+Use `RandomHasher<K>` for keys from untrusted sources. Inserting and finding elements is
 usually faster than in a Map. The class has reference counting as all containers.
 
 ~~~
@@ -85,9 +46,13 @@ foreach2(String& name, float value, constants)
     cout << "Contstant " << *name << " has value: " << value << endl;
 }
 ~~~
+
+When the map gets full it doubles its number of buckets, but elements are moved to the new buckets a few at a time
+in the following insertions and removals, with lookups checking the old buckets not yet moved, so no single
+insertion has to rehash the whole map. If the final size is known, `reserve()` allocates the buckets beforehand.
 \ingroup Containers
 */
-template<class K, class T>
+template<class K, class T, class H = Hasher<K> >
 class HashMap
 {
 protected:
@@ -97,47 +62,157 @@ protected:
 		T value;
 		KeyVal* next;
 		KeyVal() {next=0;}
-		KeyVal(const K& n): key(n) {}
+		KeyVal(const K& n): key(n), value() {}
 		KeyVal(const K& n, const T& v): key(n), value(v) {}
 		KeyVal(const KeyVal& p): key(p.key), value(p.value) {}
 		void operator=(const KeyVal& p) {key=p.key; value=p.value;}
 	};
+	enum { MIGRATE_BINS = 4 };
+	struct Data
+	{
+		AtomicCount rc;
+		int n;
+		Array<KeyVal*> bins;
+		Array<KeyVal*> old;    // buckets being migrated to `bins`, from bin `next` on
+		int next;
+		Data(int m) : rc(1), n(0), bins(m), next(0)
+		{
+			for(int i=0; i<m; i++)
+				bins[i] = 0;
+		}
+	};
+	Data* _d;
+	H _hash;
 
-	public:
-	Array< KeyVal* > a;
-	int& _n() { return *(int*)&a[0]; }
-	int _n() const { return *(const int*)&a[0]; }
-	AtomicCount& _rc() { return *(AtomicCount*)&a[1]; }
-public:
-	HashMap(): a(256 + ASL_HMAP_SKIP)
+	static void free(KeyVal** bins, int i0, int i1)
 	{
-		for(int i=0; i<a.length(); i++)
-			a[i] = 0;
-		asl_construct((AtomicCount*)&a[1]);
-		_rc() = 1;
+		for(int i=i0; i<i1; i++)
+		{
+			KeyVal* p = bins[i];
+			while(p)
+			{
+				KeyVal* next = p->next;
+				delete p;
+				p = next;
+			}
+		}
 	}
 
-	HashMap(int n)
+	void release()
 	{
-		a.resize(nextPoT(n)+ASL_HMAP_SKIP);
-		for(int i=0; i<a.length(); i++)
-			a[i] = 0;
-		asl_construct((AtomicCount*)&a[1]);
-		_rc() = 1;
+		if(--_d->rc == 0)
+		{
+			clear();
+			delete _d;
+		}
 	}
 
-	HashMap(const HashMap& b) : a(b.a)
+	// moves a chain of elements to the new buckets
+	void move(KeyVal* p)
 	{
-		++_rc();
+		KeyVal** bins = _d->bins.ptr();
+		int mask = _d->bins.length() - 1;
+		while(p)
+		{
+			KeyVal* next = p->next;
+			KeyVal** q = &bins[(int)_hash(p->key) & mask];
+			p->next = *q;
+			*q = p;
+			p = next;
+		}
+	}
+
+	// moves the elements of the next `count` old buckets to the new ones
+	void migrate(int count)
+	{
+		Data& d = *_d;
+		int m = d.old.length();
+		for(int i1=min(d.next + count, m); d.next<i1; d.next++)
+		{
+			// new buckets are cleared when they start receiving elements, which only come from this old bucket
+			d.bins[d.next] = d.bins[d.next + m] = 0;
+			move(d.old[d.next]);
+		}
+		if(d.next == m)
+		{
+			d.old = Array<KeyVal*>();
+			d.next = 0;
+		}
+	}
+
+	// switches to a table of m buckets: when doubling, elements are moved incrementally, otherwise all at once
+	void grow(int m)
+	{
+		if(_d->old.length())
+			migrate(_d->old.length());
+		Array<KeyVal*> old = _d->bins;
+		_d->bins = Array<KeyVal*>(m);
+		if(m == 2 * old.length())
+		{
+			_d->old = old;
+			_d->next = 0;
+			return;
+		}
+		for(int i=0; i<m; i++)
+			_d->bins[i] = 0;
+		for(int i=0; i<old.length(); i++)
+			move(old[i]);
+	}
+
+	// returns the bucket where the key is or would be
+	KeyVal** binOf(const K& key) const
+	{
+		int h = (int)_hash(key);
+		Data& d = *_d;
+		if(d.old.length())
+		{
+			int i = h & (d.old.length() - 1);
+			if(i >= d.next)
+				return &d.old[i];
+		}
+		return &d.bins[h & (d.bins.length() - 1)];
+	}
+
+	T& insert(const K& key)
+	{
+		if(_d->old.length())
+			migrate(MIGRATE_BINS);
+		else if(_d->n >= _d->bins.length() - _d->bins.length() / 8)
+			grow(_d->bins.length() * 2);
+		KeyVal** q = binOf(key);
+		while(*q)
+		{
+			if((*q)->key == key)
+				return (*q)->value;
+			q = &(*q)->next;
+		}
+		KeyVal* p = new KeyVal(key);
+		p->next = 0;
+		*q = p;
+		_d->n++;
+		return p->value;
+	}
+
+public:
+	HashMap(): _d(new Data(256)) {}
+
+	/**
+	Creates a map with room for about `n` elements
+	*/
+	HashMap(int n): _d(new Data(nextPoT(max(n, 8)))) {}
+
+	HashMap(const HashMap& b) : _d(b._d), _hash(b._hash)
+	{
+		++_d->rc;
 	}
 	
 	HashMap& dup()
 	{
-		HashMap b(a.length() - ASL_HMAP_SKIP);
+		HashMap b(_d->bins.length());
+		b._hash = _hash;
 		foreach2(K& k, T& v, *this)
 			b[k] = v;
-		swap(a, b.a);
-		--b._rc();
+		swap(_d, b._d);
 		return *this;
 	}
 	
@@ -150,27 +225,17 @@ public:
 		return b.dup();
 	}
 
-	int binOf(const K& key) const
-	{
-		return (hash(key) & (a.length() - ASL_HMAP_SKIP - 1)) + ASL_HMAP_SKIP;
-	}
-
 	void operator=(const HashMap& b)
 	{
-		if (--_rc() == 0) {
-			clear();
-			asl_destroy((AtomicCount*)&a[1]);
-		}
-		a = b.a;
-		++_rc();
+		++b._d->rc;
+		release();
+		_d = b._d;
+		_hash = b._hash;
 	}
 
 	~HashMap()
 	{
-		if(--_rc() == 0) {
-			clear();
-			asl_destroy((AtomicCount*)&a[1]);
-		}
+		release();
 	}
 
 	/**
@@ -178,22 +243,32 @@ public:
 	*/
 	void clear()
 	{
-		for(int i=ASL_HMAP_SKIP; i<a.length(); i++)
+		Data& d = *_d;
+		if(d.old.length())
 		{
-			if(a[i])
-			{
-				KeyVal* p = a[i];
-				KeyVal* next;
-				do {
-					next = p->next;
-					delete p;
-					p = next;
-				}
-				while(p);
-			}
-			a[i] = 0;
+			free(d.bins.ptr(), 0, d.next);
+			free(d.bins.ptr(), d.old.length(), d.old.length() + d.next);
+			free(d.old.ptr(), d.next, d.old.length());
+			d.old = Array<KeyVal*>();
+			d.next = 0;
 		}
-		_n() = 0;
+		else
+			free(d.bins.ptr(), 0, d.bins.length());
+		for(int i=0; i<d.bins.length(); i++)
+			d.bins[i] = 0;
+		d.n = 0;
+	}
+
+	/**
+	Makes room for `n` elements, so that inserting them will not need to grow the map
+	*/
+	void reserve(int n)
+	{
+		int m = nextPoT(max(n + n / 7 + 1, 8));
+		if(m > _d->bins.length())
+			grow(m);
+		else if(_d->old.length())
+			migrate(_d->old.length());
 	}
 
 	/*
@@ -202,73 +277,29 @@ public:
 	float fillFactor() const
 	{
 		float y = 0;
-		for(int i=ASL_HMAP_SKIP; i<a.length(); i++)
-			if(a[i] != 0)
-				y++;
-		return y/a.length();
+		for(Enumerator e(*this); e; e.nextBin())
+			y++;
+		return y/(_d->bins.length() + _d->old.length() - _d->next);
 	}
 
 #ifdef ASL_HMAP_STATS
 	Map<int,int> stats() const
 	{
 		Map<int,int> m;
-		for(int i=ASL_HMAP_SKIP; i<a.length(); i++)
+		for(Enumerator e(*this); e; e.nextBin())
 		{
-			if(a[i] != 0)
-			{
-				KeyVal* p = a[i];
-				int count = 1;
-				while (p = p->next)
-					count++;
-				if(!m.has(count))
-					m[count]=1;
-				else
-					m[count]++;
-			}
+			KeyVal* p = e.p;
+			int count = 1;
+			while (p = p->next)
+				count++;
+			if(!m.has(count))
+				m[count]=1;
+			else
+				m[count]++;
 		}
 		return m;
 	}
 #endif
-	void rehash()
-	{
-		if (_n() < a.length() * 7 / 8 || a.length() > 280000)
-			return;
-
-		Array<KeyVal*> b((a.length() - ASL_HMAP_SKIP) * 8 + ASL_HMAP_SKIP);
-		for (int i = 0; i<ASL_HMAP_SKIP; i++)
-			b[i] = a[i];
-		for (int i = ASL_HMAP_SKIP; i<b.length(); i++)
-			b[i] = 0;
-		int n = _n();
-
-		for (int i = ASL_HMAP_SKIP; i < a.length(); i++)
-		{
-			if (a[i])
-			{
-				KeyVal* p = a[i];
-				KeyVal* next;
-				do {
-					next = p->next;
-					int bin = (hash(p->key) & (b.length() - ASL_HMAP_SKIP - 1)) + ASL_HMAP_SKIP;
-
-					KeyVal* p2 = b[bin], *q2 = p2;
-					while (p2) {
-						q2 = p2;
-						p2 = p2->next;
-					}
-					p->next = 0;
-					if (!q2)
-						b[bin] = p;
-					else
-						q2->next = p;
-					p = next;
-				} while (p);
-			}
-		}
-		a = b;
-//		_rc() = rc;
-		_n() = n;
-	}
 
 	/**
 	Returns a reference to the value associated to the given key,
@@ -276,46 +307,12 @@ public:
 	*/
 	const T& operator[](const K& key) const
 	{
-		((HashMap*)this)->rehash();
-		int bin = binOf(key);
-		KeyVal* p = a[bin], *q = p;
-		while(p)
-		{
-			if(p->key == key)
-				return p->value;
-			q = p;
-			p = p->next;
-		}
-		p = new KeyVal(key);
-		p->next = 0;
-		if(!q)
-			a[bin] = p;
-		else
-			q->next = p;
-		++((HashMap*)this)->_n();
-		return p->value;
+		return ((HashMap*)this)->insert(key);
 	}
 
 	T& operator[](const K& key)
 	{
-		rehash();
-		int bin = binOf(key);
-		KeyVal* p = a[bin], *q = p;
-		while(p)
-		{
-			if(p->key == key)
-				return p->value;
-			q = p;
-			p = p->next;
-		}
-		p = new KeyVal(key);
-		p->next = 0;
-		if(!q)
-			a[bin] = p;
-		else
-			q->next = p;
-		++_n();
-		return p->value;
+		return insert(key);
 	}
 	
 	/**
@@ -323,31 +320,49 @@ public:
 	*/
 	const T& get(const K& key, const T& def) const
 	{
-		return has(key)? (*this)[key] : def;
+		const T* p = find(key);
+		return p? *p : def;
 	}
 	
+	/**
+	Returns a pointer to the value for the given key or a null pointer if it is not found
+	*/
+	const T* find(const K& key) const
+	{
+		KeyVal* p = *binOf(key);
+		while(p)
+		{
+			if(p->key == key)
+				return &p->value;
+			p = p->next;
+		}
+		return 0;
+	}
+
+	T* find(const K& key)
+	{
+		return (T*)((const HashMap*)this)->find(key);
+	}
+
 	/**
 	Removes the given key
 	*/
 	void remove(const K& key)
 	{
-		int bin = binOf(key);
-		KeyVal* p = a[bin], *q = p;
-		while(p)
+		if(_d->old.length())
+			migrate(MIGRATE_BINS);
+		KeyVal** q = binOf(key);
+		while(*q)
 		{
+			KeyVal* p = *q;
 			if(p->key == key)
 			{
-				KeyVal* n = p->next;
+				*q = p->next;
 				delete p;
-				if(q!=p)
-					q->next = n;
-				else
-					a[bin] = 0;
-				--_n();
+				--_d->n;
 				return;
 			}
-			q = p;
-			p = p->next;
+			q = &p->next;
 		}
 	}
 	/**
@@ -355,56 +370,57 @@ public:
 	*/
 	bool has(const K& key) const
 	{
-		KeyVal* p = a[binOf(key)];
-		while(p)
-		{
-			if(p->key == key)
-				return true;
-			p = p->next;
-		}
-		return false;
+		return find(key) != 0;
 	}
 	/**
 	Returns the number of elements in the map
 	*/
 	int length() const
 	{
-		return _n();
+		return _d->n;
 	}
 
 	struct Enumerator
 	{
-		typedef typename HashMap<K,T>::KeyVal KeyVal;
-		typename Array<KeyVal*>::Enumerator e;
+		typedef typename HashMap<K,T,H>::KeyVal KeyVal;
+		typedef typename HashMap<K,T,H>::Data Data;
+		Data* d;
+		int i;
 		KeyVal* p;
-		Enumerator() {}
-		Enumerator(const HashMap& _d): e(_d.a)
+		Enumerator(): d(0), i(0), p(0) {}
+		Enumerator(const HashMap& m): d(m._d), i(-1), p(0)
 		{
-			for(int i=0; i<ASL_HMAP_SKIP; ++i)
-				++e;
-			p = *e;
-			while(p == 0 && e)
-			{
-				++e;
-				if(e)
-					p = *e;
-			}
+			nextBin();
+		}
+		// the buckets in use are the new ones already migrated to, and the old ones not yet migrated
+		KeyVal* bin(int j) const
+		{
+			int m = d->old.length();
+			if(!m)
+				return d->bins[j];
+			if(j < d->next)
+				return d->bins[j];
+			if(j < m)
+				return d->old[j];
+			return j - m < d->next ? d->bins[j] : 0;
+		}
+		void nextBin()
+		{
+			p = 0;
+			int m = d->bins.length();
+			while(!p && ++i < m)
+				p = bin(i);
 		}
 		void operator++()
 		{
 			p = p->next;
-			while(p == 0 && e)
-			{
-				++e;
-				if(e)
-					p = *e;
-			}
-
+			if(!p)
+				nextBin();
 		}
 		T& operator*() {return p->value;}
 		T* operator->() {return &(p->value);}
 		const K& operator~() {return p->key;}
-		operator bool() const {return p!=0 || e;}
+		operator bool() const {return p!=0;}
 		Enumerator all() {return *this;}
 	};
 	Enumerator all() {return Enumerator(*this);}
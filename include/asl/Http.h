@@ -54,6 +54,9 @@ Base class of HttpRequest and HttpResponse with common functionality.
 class ASL_API HttpMessage
 {
 	friend class Http;
+	friend class AsyncHttp;
+	friend struct AsyncHttpLoop;
+	friend class HttpServer;
 public:
 	HttpMessage();
 	HttpMessage(const Dic<>& headers);
@@ -61,9 +64,9 @@ public:
 	/**
 	Returns the value of the specified header
 	*/
-	String operator[] (const String& header) const
+	String operator[] (const String& name) const
 	{
-		return _headers.get(header, "");
+		return header(name);
 	}
 	/**
 	Adds a message header with name `header` and value `value`
@@ -80,7 +83,15 @@ public:
 
 	bool containsFile() const { return _fileBody; }
 
-	const Dic<>& headers() const { return _headers; }
+	/**
+	Returns all headers as a dictionary (received headers are only copied to it when this is first called)
+	*/
+	const Dic<>& headers() const
+	{
+		if (_nhrefs > 0)
+			((HttpMessage*)this)->materialize();
+		return _headers;
+	}
 
 	Socket& socket() const
 	{
@@ -140,20 +151,31 @@ public:
 	*/
 	int write(const char* buffer, int n);
 	/**
-	Sends the content of the given file in the message body
+	Sends the content of the given file in the message body, or `count` bytes of it starting at `offset`. Without
+	chunked encoding this uses Socket::sendFile(), which avoids copying the data on Linux.
 	*/
-	void writeFile(const String& path);
+	void writeFile(const String& path, Long offset = 0, Long count = -1);
 	/**
-	Sends the content of the given file as the message body and sets the content-length header
+	Sends the content of the given file (or `count` bytes of it starting at `offset`) as the message body and sets the
+	content-length header
 	*/
-	void putFile(const String& path);
+	void putFile(const String& path, Long offset = 0, Long count = -1);
 
 	operator String() const { return text(); }
 	operator Var() const { return data(); }
 
 protected:
-	void readHeaders();
-	void readBody();
+	/* A received header as offsets into `_head`; kept until headers are modified or requested as a Dic */
+	struct HeaderRef { unsigned short name, nameLen, value, valueLen; };
+	enum { MAX_HEADER_REFS = 32 };
+	int readHead(int maxSize);
+	static int headEnd(const char* p, int n, int from);
+	bool parseHeaders(int i);
+	void materialize();
+	int findHeader(const String& name) const;
+	bool readBody();
+	String headerBlock();
+	int writeBody(const void* data, int n);
 	String _command;
 	Dic<> _headers;
 	Array<byte> _body;
@@ -162,6 +184,9 @@ protected:
 	bool _fileBody;
 	bool _chunked;
 	bool _headersSent;
+	String _head;
+	HeaderRef _hrefs[MAX_HEADER_REFS];
+	int _nhrefs;
 };
 
 
@@ -177,40 +202,50 @@ header automatically set.
 class ASL_API HttpRequest : public HttpMessage
 {
 public:
-	HttpRequest() { _recursion = 0; }
+	HttpRequest() { _recursion = 0; _pending = 0; _nparams = 0; }
 	/**
 	Constructs an HttpRequest with the given method
 	*/
-	HttpRequest(const String& method, const String& url) : _method(method), _url(url) { _recursion = 0; }
+	HttpRequest(const String& method, const String& url) : _method(method), _url(url) { _recursion = 0; _pending = 0; _nparams = 0; }
 	/**
 	Constructs an HttpRequest with the given method and headers
 	*/
-	HttpRequest(const String& method, const String& url, const Dic<>& headers) : HttpMessage(headers), _method(method), _url(url) { _recursion = 0; }
+	HttpRequest(const String& method, const String& url, const Dic<>& headers) : HttpMessage(headers), _method(method), _url(url) { _recursion = 0; _pending = 0; _nparams = 0; }
 	/**
 	Constructs an HttpRequest with the given method and body
 	*/
 	template<class T>
-	HttpRequest(const String& method, const String& url, const T& data) : _method(method), _url(url) { put(data); _recursion = 0; }
+	HttpRequest(const String& method, const String& url, const T& data) : _method(method), _url(url) { put(data); _recursion = 0; _pending = 0; _nparams = 0; }
 	/**
 	Constructs an HttpRequest with the given method, headers and body
 	*/
 	template<class T>
-	HttpRequest(const String& method, const String& url, const T& data, const Dic<>& headers) : HttpMessage(headers), _method(method), _url(url) { put(data); _recursion = 0; }
-	HttpRequest(Socket& s) : HttpMessage(s)
+	HttpRequest(const String& method, const String& url, const T& data, const Dic<>& headers) : HttpMessage(headers), _method(method), _url(url) { put(data); _recursion = 0; _pending = 0; _nparams = 0; }
+	/**
+	Constructs an HttpRequest reading it from the socket, with a head of at most `maxHead` bytes
+	*/
+	HttpRequest(Socket& s, int maxHead = 65536) : HttpMessage(s)
 	{
 		_recursion = 0;
-		read();
+		_pending = 0;
+		_nparams = 0;
+		read(maxHead);
 	}
 	~HttpRequest();
-	void read();
-	const String& resource() const
-	{
-		return _res;
-	}
-	const String& path() const
-	{
-		return _path;
-	}
+	/**
+	Reads the request from the socket. The request line and headers are parsed in a single pass and kept in place;
+	strings such as the path or the header dictionary are only created when requested. A request whose head (the
+	request line and headers) is larger than `maxHead` bytes is not read.
+	*/
+	void read(int maxHead = 65536);
+	/**
+	Returns the requested resource (the path including the query)
+	*/
+	const String& resource() const;
+	/**
+	Returns the path part of the resource
+	*/
+	const String& path() const;
 	/**
 	Returns the HTTP method (GET, POST, etc)
 	*/
@@ -255,19 +290,23 @@ public:
 		return _argument;
 	}
 	/**
+	Returns the value of a path parameter named in the pattern of the HttpRouter route that matched this request,
+	such as `id` in `/api/users/:id`, or an empty string if there is no such parameter.
+	*/
+	String param(const String& name) const;
+	/**
+	Returns a pointer to the value of a path parameter and its length in `length`, without copying it, or null if
+	there is no such parameter. The value is not null-terminated.
+	*/
+	const char* param(const String& name, int& length) const;
+	/**
 	Returns the address of the remote host (the client)
 	*/
-	const InetAddress& sender()
-	{
-		return _addr;
-	}
+	const InetAddress& sender();
 	/**
 	Returns the complete query string that follows the `?` character in the URL path
 	*/
-	const String& querystring() const
-	{
-		return _querystring;
-	}
+	const String& querystring() const;
 	/**
 	Returns the query converted to a Dic, assuming that it consists of keys and values like
 	`key1=value1&key2=value2`.
@@ -279,6 +318,7 @@ public:
 	*/
 	const String& query(const String& key);
 	friend class HttpResponse;
+	friend class HttpRouter;
 	const Array<String>& parts() const;
 
 	void setRecursion(int n) { _recursion = n; }
@@ -286,17 +326,29 @@ public:
 	int recursion() const { return _recursion; }
 
 protected:
+	enum { PENDING_RES = 1, PENDING_PATH = 2, PENDING_QUERY = 4, PENDING_PARTS = 8, PENDING_ADDR = 16 };
+	void pathView(const char*& p, int& n) const;
 	String _method;
 	String _url;
-	String _res;
+	mutable String _res;
 	InetAddress _addr;
-	Array<String> _parts;
-	String _path;
-	String _querystring;
+	mutable Array<String> _parts;
+	mutable String _path;
+	mutable String _querystring;
 	String _fragment;
 	Dic<> _query;
 	String _argument;
 	int _recursion;
+	int _target, _pathLen, _queryLen, _targetLen; // request target as offsets into _head
+	mutable int _pending;                         // which members still have to be extracted from _head
+	struct PathParam
+	{
+		const String* name;
+		int start, length;                        // value as offsets into the path
+	};
+	enum { MAX_PATH_PARAMS = 8 };
+	PathParam _params[MAX_PATH_PARAMS];
+	int _nparams;
 };
 
 /**
@@ -383,11 +435,44 @@ Using IPv6 addresses is supported with square brackets in the host part `[ipv6]:
 ~~~
 auto res = Http::get("http://[::1]:80/path");
 ~~~
+
+Applications making many requests to the same servers can keep connections open between requests with
+`Http::setKeepAlive()`:
+
+~~~
+Http::setKeepAlive(8, 30);   // up to 8 idle connections per host, for 30 seconds
+~~~
 */
 
 class ASL_API Http
 {
 public:
+	/** Statistics of the client connection pool */
+	struct PoolStats
+	{
+		Long connections;  // new connections opened
+		Long reused;       // requests sent over an idle pooled connection
+		Long retries;      // pooled connections found closed by the server and replaced
+		int idle;          // connections currently idle in the pool
+		PoolStats() : connections(0), reused(0), retries(0), idle(0) {}
+	};
+	/**
+	Enables reusing connections for successive requests to the same host: after a complete response, up to `maxIdle`
+	connections per host are kept open for up to `timeout` seconds. A request sent over a pooled connection that
+	the server had already closed is sent again over a new one (unless it is a POST or PATCH). A `maxIdle` of 0 (the
+	default) disables the pool and closes all idle connections.
+	*/
+	static void setKeepAlive(int maxIdle, double timeout = 30);
+	/** Returns the statistics of the connection pool */
+	static PoolStats poolStats();
+	/** Closes all idle pooled connections */
+	static void closeIdle();
+	/**
+	Sets the maximum size of the head (status line and headers) of responses, 256 KB by default; a larger one fails
+	*/
+	static void setMaxHeadSize(int bytes);
+	/** Returns the maximum size of the head of responses */
+	static int maxHeadSize();
 	/** Sends an HTTP request and returns the response.
 	*/
 	static HttpResponse request(HttpRequest& req);
@@ -0,0 +1,127 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_HTTPROUTER_H
+#define ASL_HTTPROUTER_H
+
+#include <asl/Http.h>
+
+namespace asl {
+
+/**
+An HttpRouter selects the function that handles an HTTP request by its method and path. Routes are added with a
+method and a path pattern, whose segments can be literal names, named parameters like `:id`, or a final `*` that
+matches the rest of the path:
+
+~~~
+router.add("GET", "/api/users/:id", this, &MyServer::getUser);
+router.add("GET", "/api/users/:id/photos", this, &MyServer::getPhotos);
+router.add("POST", "/api/login", [](HttpRequest& req, HttpResponse& res) {
+	...
+});
+~~~
+
+The patterns are compiled to a tree of path segments, so finding the route takes time proportional to the number of
+segments in the path and not to the number of routes. Literal segments take precedence over parameters, and those
+over wildcards. A parameter must have the same name in all routes where it is at the same position. In the
+handler, parameters are read with `request.param("id")` and the part matched by `*` with `request.suffix()`. The
+method can be `*` to match any method.
+
+An HttpServer has a router, available as `router()`, that is tried before calling its `serve()` function.
+\ingroup Sockets
+*/
+
+class ASL_API HttpRouter
+{
+public:
+	/** Base class of route handlers */
+	struct Handler
+	{
+		virtual ~Handler() {}
+		virtual void operator()(HttpRequest& request, HttpResponse& response) = 0;
+	};
+	HttpRouter();
+	~HttpRouter();
+	/**
+	Adds a route to a handler object which will be owned by the router. Returns false (and deletes the handler) if
+	there is already a route with the same method and pattern, or if the pattern has a parameter whose name differs
+	from that of another route's parameter at the same position.
+	*/
+	bool add(const String& method, const String& pattern, Handler* handler);
+	/**
+	Adds a route to a function, or a function object such as a lambda, called as `f(request, response)`, or to
+	a pointer to a Handler subclass.
+	*/
+	template<class F>
+	bool add(const String& method, const String& pattern, const F& f)
+	{
+		return add(method, pattern, handler(f));
+	}
+	bool add(const String& method, const String& pattern, void (*f)(HttpRequest&, HttpResponse&))
+	{
+		return add(method, pattern, (Handler*)new FunctionHandler<void (*)(HttpRequest&, HttpResponse&)>(f));
+	}
+	/**
+	Adds a route to a member function of an object, such as the server itself.
+	*/
+	template<class C>
+	bool add(const String& method, const String& pattern, C* object, void (C::*f)(HttpRequest&, HttpResponse&))
+	{
+		return add(method, pattern, (Handler*)new MemberHandler<C>(object, f));
+	}
+	/**
+	Finds the route for the request and calls its handler, returning true, or returns false if no route matches.
+	If the path matches but the method does not, the response code is set to 405 and the `Allow` header lists the
+	methods of the routes for that path.
+	*/
+	bool dispatch(HttpRequest& request, HttpResponse& response);
+	/** Returns true if no routes have been added */
+	bool empty() const { return _root->literals.length() == 0 && !_root->param && !_root->wildcard && !_root->routes.length(); }
+protected:
+	template<class F>
+	static Handler* handler(const F& f) { return new FunctionHandler<F>(f); }
+	template<class H>
+	static Handler* handler(H* h) { return h; }
+	template<class F>
+	struct FunctionHandler : public Handler
+	{
+		F f;
+		FunctionHandler(const F& f_) : f(f_) {}
+		void operator()(HttpRequest& request, HttpResponse& response) { f(request, response); }
+	};
+	template<class C>
+	struct MemberHandler : public Handler
+	{
+		C* object;
+		void (C::*f)(HttpRequest&, HttpResponse&);
+		MemberHandler(C* o, void (C::*f_)(HttpRequest&, HttpResponse&)) : object(o), f(f_) {}
+		void operator()(HttpRequest& request, HttpResponse& response) { (object->*f)(request, response); }
+	};
+	struct Route
+	{
+		String method;
+		Handler* handler;
+	};
+	struct Node
+	{
+		String segment;         // literal segment or parameter name
+		Array<Node*> literals;  // literal children sorted by segment
+		Node* param;
+		Node* wildcard;
+		Array<Route> routes;
+		Node() : param(0), wildcard(0) {}
+		~Node();
+		Node* literal(const char* s, int n) const;
+		Route* route(const String& method);
+	};
+	struct Match;
+	Node* match(Node* node, const char* s, const char* e, Match& m);
+	Node* _root;
+private:
+	HttpRouter(const HttpRouter&);
+	void operator=(const HttpRouter&);
+};
+
+}
+
+#endif
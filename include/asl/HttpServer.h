@@ -8,10 +8,12 @@
 #include <asl/String.h>
 #include <asl/SocketServer.h>
 #include <asl/Http.h>
+#include <asl/HttpRouter.h>
 
 namespace asl {
 
 class WebSocketServer;
+struct HttpFileCache;
 
 /**
 This class can be used to create application-specific HTTP servers.
@@ -60,12 +62,28 @@ A server like that will respond to requests such as `/api/clients/132337` or `/a
 
 Each request is handled in a separate thread. So, you should probably use mutexes for synchronization.
 
+Instead of testing paths in `serve()`, handlers can be registered by method and path pattern in the server's
+`router()`, which is tried first, so `serve()` is only called for requests that no route matches:
+
+~~~
+router().add("GET", "/api/clients/:id", this, &RestServer::getClient);
+~~~
+
+With `setEventDriven()` idle keep-alive connections do not need a thread: I/O threads read and serve one request
+each time a connection has input. With `setThreadPool()` requests are served by a fixed set of threads, and clients
+arriving when the queue is full get a *503 Service Unavailable* response. A pool is always used in event-driven mode
+(with one I/O thread unless `setEventDriven()` sets more), so that idle connections do not hold its threads.
+
+With `setFileCache()` frequently requested static files are kept in memory together with their response headers, so
+that serving them needs no file access.
+
 */
 
 class ASL_API HttpServer: public SocketServer
 {
 public:
 	HttpServer(int port = -1);
+	~HttpServer();
 	void setRoot(const String& root);
 	void addMimeType(const String& ext, const String& type);
 	/**
@@ -84,26 +102,68 @@ public:
 	Enbles or disables cross-domain (CORS) support
 	*/
 	void setCrossDomain(bool on) { _cors = on; }
+	/**
+	Sets the maximum size of the head (request line and headers) of requests, 64 KB by default; the connection
+	of a client sending a larger one is closed
+	*/
+	void setMaxHeadSize(int bytes) { _maxHead = bytes; }
 
 	/**
 	Serves a static file from the configured root folder
 	*/
 	void serveFile(HttpRequest& request, HttpResponse& response);
 
+	/** Statistics of the static file cache */
+	struct FileCacheStats
+	{
+		Long hits, misses, evictions, bytes;
+		int files;
+		FileCacheStats() : hits(0), misses(0), evictions(0), bytes(0), files(0) {}
+		/** Returns the fraction of file requests that were served from the cache */
+		double hitRatio() const { return (hits + misses > 0) ? double(hits) / (hits + misses) : 0.0; }
+	};
+	/**
+	Enables caching in memory the files served by serveFile(), up to `maxBytes` of content in total,
+	evicting the least recently used ones when full. Files larger than `maxFileSize` are not cached. A cached file is
+	checked for modification (along with its `.gz` sibling) at most once per second. If a file has a precompressed
+	`.gz` sibling that is not older, it is sent to clients accepting gzip encoding, with its own ETag. A `maxBytes`
+	of 0 disables the cache.
+	*/
+	void setFileCache(Long maxBytes, Long maxFileSize = 1024 * 1024);
+	/**
+	Returns the current hits, misses, evictions and size of the file cache
+	*/
+	FileCacheStats fileCacheStats() const;
+
 	/**
 	Links this socket with the given WebSocket server to process incoming WebSocket connections
 	*/
 	void link(WebSocketServer& wsserver) { _wsserver = &wsserver; }
 
+	/**
+	Returns the router used to find handlers for requests before calling `serve()`
+	*/
+	HttpRouter& router() { return _router; }
+
 protected:
 	String _webroot;
 	String _proto;
 	Dic<> _mimetypes;
 	String _methods;
 	bool _cors;
+	int _maxHead;
 	WebSocketServer* _wsserver;
+	HttpRouter _router;
+	HttpFileCache* _fileCache;
+	friend struct HttpFileCache;
+	friend struct HttpConnectionThread;
 private:
+	enum { REQUEST_PARTIAL, REQUEST_READY, REQUEST_LARGE, REQUEST_BAD };
 	void serve(Socket client);
+	int onInput(Socket client);
+	void reject(Socket client);
+	int requestState(Socket& client);
+	int serveRequest(Socket& client);
 };
 }
 #endif
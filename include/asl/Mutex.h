@@ -11,10 +11,45 @@
 #include <semaphore.h>
 #include <errno.h> // ETIMEDOUT
 #include <unistd.h>
+#include <sched.h>
+#endif
+
+#if defined(__linux__) && !defined(ASL_PTHREAD_MUTEX)
+#define ASL_FUTEX_MUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#include <time.h>
 #endif
 
 namespace asl {
 
+/**
+Hints the processor that the thread is busy-waiting
+*/
+inline void cpuPause()
+{
+#if defined(_MSC_VER)
+	YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/**
+Gives up the rest of the current thread's time slice
+*/
+inline void yieldThread()
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
 #ifdef _WIN32
 
 /**
@@ -189,8 +224,71 @@ public:
 
 #else // !_WIN32
 
+#ifdef ASL_FUTEX_MUTEX
+
+inline int futexWait(volatile int* p, int value, const struct timespec* timeout = 0)
+{
+	return (int)syscall(SYS_futex, (int*)p, FUTEX_WAIT_PRIVATE, value, timeout, 0, 0);
+}
+
+inline void futexWake(volatile int* p, int n)
+{
+	syscall(SYS_futex, (int*)p, FUTEX_WAKE_PRIVATE, n, 0, 0, 0);
+}
+
+/*
+On Linux a Mutex is a futex word: 0 when unlocked, 1 when locked, and 2 when locked and other threads may be
+sleeping on it. Locking and unlocking without contention is a single atomic operation, without system calls. A
+thread that finds it locked spins for a while before sleeping. Define ASL_PTHREAD_MUTEX to use pthreads instead.
+*/
+class Mutex
+{
+	enum { SPIN = 100 };
+	volatile int _state;
+	void lockContended()
+	{
+		int c = _state;
+		if (c != 2)
+			c = __sync_lock_test_and_set(&_state, 2);
+		while (c != 0)
+		{
+			futexWait(&_state, 2);
+			c = __sync_lock_test_and_set(&_state, 2);
+		}
+	}
+public:
+	Mutex() : _state(0)
+	{}
+	void lock()
+	{
+		if (__sync_bool_compare_and_swap(&_state, 0, 1))
+			return;
+		for (int i = 0; i < SPIN; i++)
+		{
+			cpuPause();
+			if (_state == 0 && __sync_bool_compare_and_swap(&_state, 0, 1))
+				return;
+		}
+		lockContended();
+	}
+	bool trylock()
+	{
+		return __sync_bool_compare_and_swap(&_state, 0, 1);
+	}
+	void unlock()
+	{
+		if (__sync_fetch_and_sub(&_state, 1) != 1)
+		{
+			__sync_lock_release(&_state);
+			futexWake(&_state, 1);
+		}
+	}
+	friend class Condition;
+};
+
+#else
+
 static pthread_mutex_t mutex_init = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t cond_init = PTHREAD_COND_INITIALIZER;
 
 class Mutex
 {
@@ -217,6 +315,8 @@ public:
 	friend class Condition;
 };
 
+#endif
+
 #ifndef __APPLE__
 
 class Semaphore
@@ -342,6 +442,58 @@ public:
 };
 #endif
 
+#ifdef ASL_FUTEX_MUTEX
+
+/*
+A futex-based condition variable: waiters sleep on a sequence number that `signal()` increments, and then lock the
+mutex again marking it as contended.
+*/
+class Condition
+{
+	volatile int _seq;
+	Mutex* _mut;
+public:
+	Condition() : _seq(0), _mut(0)
+	{
+	}
+	Condition(Mutex& m) : _seq(0)
+	{
+		use(m);
+	}
+	void use(Mutex& m)
+	{
+		_mut = &m;
+	}
+	void signal()
+	{
+		__sync_fetch_and_add(&_seq, 1);
+		futexWake(&_seq, INT_MAX);
+	}
+	void wait()
+	{
+		int seq = _seq;
+		_mut->unlock();
+		futexWait(&_seq, seq);
+		_mut->lockContended();
+	}
+	bool wait(double timeout)
+	{
+		int seq = _seq;
+		_mut->unlock();
+		struct timespec to;
+		timeout = timeout > 0 ? timeout : 0;
+		to.tv_sec = (time_t)floor(timeout);
+		to.tv_nsec = (long)((timeout - floor(timeout)) * 1e9);
+		bool timedOut = futexWait(&_seq, seq, &to) != 0 && errno == ETIMEDOUT;
+		_mut->lockContended();
+		return timedOut;
+	}
+};
+
+#else
+
+static pthread_cond_t cond_init = PTHREAD_COND_INITIALIZER;
+
 class Condition
 {
 	pthread_cond_t _cond;
@@ -381,6 +533,8 @@ public:
 	}
 };
 
+#endif
+
 #endif // Linux
 
 /**
@@ -411,6 +565,233 @@ public:
 	}
 };
 
+/**
+A ScopedLock locks any kind of lock object (with `lock()` and `unlock()` functions) on construction and unlocks it
+on destruction, like Lock does with a Mutex.
+
+~~~
+SpinLock spin;
+...
+{
+	ScopedLock<SpinLock> _(spin);
+	counter++;
+}
+~~~
+\ingroup Threading
+*/
+template<class L>
+class ScopedLock
+{
+	L& _m;
+public:
+	ScopedLock(L& m) : _m(m)
+	{
+		_m.lock();
+	}
+	~ScopedLock()
+	{
+		_m.unlock();
+	}
+};
+
+/**
+A ReadWriteLock protects data that is read often and modified rarely: any number of threads can hold it for reading
+at the same time, but a writer holds it alone. Waiting writers are preferred over new readers where the system
+allows it, so that writers are not starved. Use the ReadLock and WriteLock guards:
+
+~~~
+ReadWriteLock lock;
+Dic<String> config;
+
+String get(const String& key)
+{
+	ReadLock _(lock);
+	return config[key];
+}
+
+void set(const String& key, const String& value)
+{
+	WriteLock _(lock);
+	config[key] = value;
+}
+~~~
+\ingroup Threading
+*/
+class ReadWriteLock
+{
+#ifdef _WIN32
+	SRWLOCK _lock;
+public:
+	ReadWriteLock() { InitializeSRWLock(&_lock); }
+	/** Locks for reading, waiting while a writer holds the lock */
+	void lockRead() { AcquireSRWLockShared(&_lock); }
+	/** Releases a read lock */
+	void unlockRead() { ReleaseSRWLockShared(&_lock); }
+	/** Locks for writing, waiting until no other thread holds the lock */
+	void lockWrite() { AcquireSRWLockExclusive(&_lock); }
+	/** Releases the write lock */
+	void unlockWrite() { ReleaseSRWLockExclusive(&_lock); }
+#else
+	pthread_rwlock_t _lock;
+public:
+	ReadWriteLock()
+	{
+		pthread_rwlockattr_t attr;
+		pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+		pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+		pthread_rwlock_init(&_lock, &attr);
+		pthread_rwlockattr_destroy(&attr);
+	}
+	~ReadWriteLock() { pthread_rwlock_destroy(&_lock); }
+	/** Locks for reading, waiting while a writer holds the lock */
+	void lockRead() { pthread_rwlock_rdlock(&_lock); }
+	/** Releases a read lock */
+	void unlockRead() { pthread_rwlock_unlock(&_lock); }
+	/** Locks for writing, waiting until no other thread holds the lock */
+	void lockWrite() { pthread_rwlock_wrlock(&_lock); }
+	/** Releases the write lock */
+	void unlockWrite() { pthread_rwlock_unlock(&_lock); }
+#endif
+private:
+	ReadWriteLock(const ReadWriteLock&);
+	void operator=(const ReadWriteLock&);
+};
+
+/**
+Locks a ReadWriteLock for reading during its lifetime
+\ingroup Threading
+*/
+class ReadLock
+{
+	ReadWriteLock& _m;
+public:
+	ReadLock(ReadWriteLock& m) : _m(m)
+	{
+		_m.lockRead();
+	}
+	~ReadLock()
+	{
+		_m.unlockRead();
+	}
+};
+
+/**
+Locks a ReadWriteLock for writing during its lifetime
+\ingroup Threading
+*/
+class WriteLock
+{
+	ReadWriteLock& _m;
+public:
+	WriteLock(ReadWriteLock& m) : _m(m)
+	{
+		_m.lockWrite();
+	}
+	~WriteLock()
+	{
+		_m.unlockWrite();
+	}
+};
+
+}
+
+#include <asl/atomic.h>
+
+namespace asl {
+
+/**
+A SpinLock is a lock for very short critical sections that never sleeps in the kernel: a thread waiting for it
+spins, pausing the processor, and after a while yields its time slice on each try so the owner can run. It is
+only a word in size, so it can protect each of many small objects. Use it with a ScopedLock.
+\ingroup Threading
+*/
+class SpinLock
+{
+	enum { SPIN = 64 };
+	volatile int _locked;
+public:
+	SpinLock() : _locked(0) {}
+	void lock()
+	{
+		for (int n = 0; !trylock();)
+			while (_locked)
+			{
+				if (n++ < SPIN)
+					cpuPause();
+				else
+					yieldThread();
+			}
+	}
+	bool trylock()
+	{
+		return _locked == 0 && atomicCas(&_locked, 0, 1);
+	}
+	void unlock()
+	{
+		atomicStore(&_locked, 0);
+	}
+};
+
+/**
+A SeqLock holds a small value, such as a struct of a few numbers, that is written by some thread and read by many
+without readers blocking each other or the writer. Readers copy the value and retry if it was being written at the
+same time, as told by a sequence number that is odd while a write is in progress. The type must be plain data
+that can be copied even while being modified.
+
+~~~
+struct Position { double x, y, z; };
+SeqLock<Position> position;
+position.set(p);          // writer
+Position q = position.get(); // readers
+~~~
+\ingroup Threading
+*/
+template<class T>
+class SeqLock
+{
+	volatile int _seq;
+	T _value;
+public:
+	SeqLock() : _seq(0), _value() {}
+	SeqLock(const T& x) : _seq(0), _value(x) {}
+	/**
+	Sets the value; concurrent writers are serialized
+	*/
+	void set(const T& x)
+	{
+		int s;
+		do
+		{
+			s = _seq;
+			if (s & 1)
+				cpuPause();
+		} while ((s & 1) || !atomicCas(&_seq, s, (int)((unsigned)s + 1)));
+		_value = x;
+		atomicStore(&_seq, (int)((unsigned)s + 2));
+	}
+	/**
+	Returns a consistent copy of the value
+	*/
+	T get() const
+	{
+		while (1)
+		{
+			int s = atomicLoad(&_seq);
+			if (s & 1)
+			{
+				cpuPause();
+				continue;
+			}
+			T x = _value;
+			atomicAcquireFence();
+			if (atomicLoad(&_seq) == s)
+				return x;
+		}
+	}
+};
+
 }
 
 #endif
@@ -27,26 +27,112 @@ int x1, x2;
 if(queue.length() >= 2)
 	queue >> x1 >> x2;
 ~~~
+
+The items are kept in a circular buffer that grows as needed, so adding or removing items at either end takes
+constant time. Items can be read by index, from the first (index 0) to the last. Copies of a queue are independent.
+\ingroup Containers
 */
 
 template <class T>
-class Queue: public Array<T>
+class Queue
 {
+	Array<T> _a;  // capacity is 0 or a power of 2
+	int _head, _n;
+	int at(int i) const { return (_head + i) & (_a.length() - 1); }
+	void grow()
+	{
+		int n = _a.length();
+		Array<T> b(n ? 2 * n : 8);
+		for (int i = 0; i < _n; i++)
+			b[i] = _a[at(i)];
+		_a = b;
+		_head = 0;
+	}
 public:
-	Queue& operator>>(T& x)
+	Queue() : _head(0), _n(0) {}
+	Queue(const Queue& q) : _a(q._a.clone()), _head(q._head), _n(q._n) {}
+	void operator=(const Queue& q)
 	{
-		x = (*this)[0];
-		this->remove(0);
-		return *this;
+		_a = q._a.clone();
+		_head = q._head;
+		_n = q._n;
 	}
 	/**
+	Returns the number of items
+	*/
+	int length() const { return _n; }
+	/**
+	Returns the item at position i, 0 being the first
+	*/
+	T& operator[](int i) { return _a[at(i)]; }
+	const T& operator[](int i) const { return _a[at(i)]; }
+	/**
+	Returns the first item, the next one get() returns
+	*/
+	T& first() { return _a[_head]; }
+	/**
+	Returns the last item added
+	*/
+	T& last() { return _a[at(_n - 1)]; }
+	/**
 	Appends an item at the end
 	*/
-	void put(const T& x) {(*this)<< x;}
+	void put(const T& x)
+	{
+		if (_n == _a.length())
+			grow();
+		_a[at(_n++)] = x;
+	}
+	/**
+	Inserts an item at the start, so it will be the next one returned by get()
+	*/
+	void putFirst(const T& x)
+	{
+		if (_n == _a.length())
+			grow();
+		_head = (_head - 1) & (_a.length() - 1);
+		_a[_head] = x;
+		_n++;
+	}
 	/**
 	Gets and removes the item at the start
 	*/
-	T get() {T y; (*this)>> y; return y;}
+	T get()
+	{
+		T y = _a[_head];
+		_a[_head] = T();
+		_head = at(1);
+		_n--;
+		return y;
+	}
+	/**
+	Gets and removes the item at the end
+	*/
+	T getLast()
+	{
+		int i = at(--_n);
+		T y = _a[i];
+		_a[i] = T();
+		return y;
+	}
+	/**
+	Removes all items
+	*/
+	void clear()
+	{
+		_a = Array<T>();
+		_head = _n = 0;
+	}
+	Queue& operator<<(const T& x)
+	{
+		put(x);
+		return *this;
+	}
+	Queue& operator>>(T& x)
+	{
+		x = get();
+		return *this;
+	}
 };
 
 }
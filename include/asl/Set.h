@@ -8,7 +8,8 @@
 namespace asl {
 
 /**
-A set is a container of unique elements in any order. The type of items must have a corresponding global hash() function.
+A set is a container of unique elements in any order. Items are hashed by the hasher `H`, by default `Hasher<T>`,
+so the type of items must have a corresponding global hash64() or hash() function.
 
 ~~~
 Set<int> numbers;
@@ -38,11 +39,11 @@ if(even.containsAny(powers)) // true, even numbers have (some) numbers from the
 ~~~
 \ingroup Containers
 */
-template <class T>
-class Set: public MAP<T,int>
+template <class T, class H = Hasher<T> >
+class Set: public MAP<T,int,H>
 {
 public:
-	Set(int size): MAP<T,int>(size) {}
+	Set(int size): MAP<T,int,H>(size) {}
 	Set() {}
 	Set(const Array<T>& a)
 	{
@@ -101,12 +102,7 @@ public:
 	*/
 	bool operator==(const Set& s) const
 	{
-		if(this->length() != s.length())
-			return false;
-		Enumerator e1 = this->all(), e2 = s.all();
-		for(; e1; ++e1, ++e2)
-			if(*e1 != *e2) return false;
-		return true;
+		return this->length() == s.length() && contains(s);
 	}
 	/**
 	Returns true if both sets don't have the same items
@@ -176,10 +172,10 @@ public:
 	}
 	bool empty() const {return this->length()==0;}
 	
-	struct Enumerator : public MAP<T,int>::Enumerator
+	struct Enumerator : public MAP<T,int,H>::Enumerator
 	{
 		Enumerator(){}
-		Enumerator(Set& s) : MAP<T, int>::Enumerator(s) {}
+		Enumerator(Set& s) : MAP<T, int, H>::Enumerator(s) {}
 		T& operator*() { return (T&)~(*this); }
 		T* operator->() { return &(~(*this)); }
 	};
@@ -45,9 +45,10 @@ public:
 	}
 	SmartObject& operator=(const SmartObject& n)
 	{
+		if (n._p)
+			++n._p->rc;
 		unref();
 		_p = n._p;
-		++_p->rc;
 		return *this;
 	}
 	~SmartObject()
@@ -28,6 +28,18 @@ struct SocketOptionException : public Exception
 
 class Socket;
 
+/**
+A memory block to be sent with other blocks in a single call to Socket::write(const IoVec*, int).
+\ingroup Sockets
+*/
+struct IoVec
+{
+	const void* data;
+	int length;
+	IoVec() : data(0), length(0) {}
+	IoVec(const void* p, int n) : data(p), length(n) {}
+};
+
 class ASL_API Sockets
 {
 	Array<Socket> set, changed;
@@ -109,6 +121,10 @@ ASL_SMART_CLASS(Socket, SmartObject)
 	InetAddress::Type _family;
 	bool _error;
 	bool _blocking;
+	bool _noDelay;
+	bool _cork;
+	Array<byte> _rbuf;
+	int _rbegin, _rend;
 	virtual bool setOption(int level, int opt, const void* p, int n);
 	bool init(bool force = false);
 	Socket_();
@@ -128,14 +144,33 @@ ASL_SMART_CLASS(Socket, SmartObject)
 	InetAddress remoteAddress() const;
 	InetAddress localAddress() const;
 	virtual bool connect(const InetAddress& host);
+	bool startConnect(const InetAddress& host);
+	bool finishConnect();
 	virtual void close();
-	String readLine();
-	virtual int available();
-	virtual int read(void* data, int size);
+	// unbuffered primitives implemented by each socket type
+	virtual int availableRaw();
+	virtual int readRaw(void* data, int size);
+	virtual bool waitInputRaw(double timeout);
 	virtual int write(const void* data, int n);
+	virtual int write(const IoVec* parts, int n);
+	virtual Long sendFile(const String& path, Long offset, Long count);
+	virtual int tryWrite(const void* data, int n);
+	void shutdown();
+	void setNoDelay(bool on);
+	void setCork(bool on);
+	Long copyFile(const String& path, Long offset, Long count);
+	int fill();
+	void releaseBuffer();
+	bool isBuffered() const { return _type != PACKET; }
+	int buffered() const { return _rend - _rbegin; }
+	const byte* peek(int n);
+	const char* readLineView(int& length);
+	String readLine();
+	int available();
+	int read(void* data, int size);
 	Array<byte> read(int n = -1);
 	void skip(int n);
-	virtual bool waitInput(double timeout = 60);
+	bool waitInput(double timeout = 60);
 	bool error() const { return _error; }
 };
 
@@ -216,14 +251,55 @@ public:
 	bool connect(const InetAddress& host) { return _()->connect(host); }
 	bool connect(const char* host) { return connect(String(host)); }
 	/**
+	Starts connecting to the given address without waiting: the socket becomes writable when the connection is
+	established or fails, and then finishConnect() must be called. Returns false if the connection failed right away.
+	*/
+	bool startConnect(const InetAddress& host) { return _()->startConnect(host); }
+	/**
+	Completes a connection started with startConnect(), returning true if it succeeded
+	*/
+	bool finishConnect() { return _()->finishConnect(); }
+	/**
+	Writes as much of the data as the socket accepts without blocking; returns the number of bytes written (0 if it
+	could not take any) or -1 on error. On TLS sockets, after it returns 0 it must be called again with the same data,
+	as part of an encrypted record may be pending.
+	*/
+	int tryWrite(const void* data, int n) { return _()->tryWrite(data, n); }
+	/**
+	Shuts down the connection in both directions without closing the socket, so that threads waiting for input on it
+	return
+	*/
+	void shutdown() { _()->shutdown(); }
+	/**
 	Closes this socket.
 	*/
 	void close() { _()->close(); }
 	/**
-	Reads a line of text from the socket (keep in mind this is not buffered)
+	Reads a line of text from the socket (the final newline is removed). Data is read from the system in blocks and
+	kept in an internal buffer, so reading line by line does not need a system call per byte.
 	*/
 	String readLine() { return _()->readLine(); }
 	/**
+	Reads a line like readLine() but without copying it: returns a pointer to the line in the receive buffer (not
+	null-terminated) and writes its length to `length`, or returns null on error. The data is only valid until the
+	next read from this socket.
+	*/
+	const char* readLineView(int& length) { return _()->readLineView(length); }
+	/**
+	Returns a pointer to the next `n` bytes of input in the receive buffer without consuming them (waiting for them
+	if needed), or null if they cannot be read. The buffer grows to fit them. Use skip() to consume them afterwards.
+	*/
+	const byte* peek(int n) { return _()->peek(n); }
+	/**
+	Frees the receive buffer if it holds no data, so that idle connections take less memory; it is allocated
+	again on the next read.
+	*/
+	void releaseBuffer() { _()->releaseBuffer(); }
+	/**
+	Returns the number of bytes already received and held in the receive buffer
+	*/
+	int buffered() const { return _()->buffered(); }
+	/**
 	Returns the number of bytes available for reading without blocking
 	*/
 	int available() { return _()->available(); }
@@ -236,6 +312,27 @@ public:
 	*/
 	int write(const void* data, int n) { return _()->write(data, n); }
 	/**
+	Writes the `n` memory blocks described in `parts` as if they were one contiguous buffer, with a single system call
+	when possible (`writev()`), and returns the total number of bytes written.
+	*/
+	int write(const IoVec* parts, int n) { return _()->write(parts, n); }
+	/**
+	Enables or disables the Nagle algorithm (TCP_NODELAY). With it disabled small writes are sent immediately,
+	which is good when each message is written at once (e.g. with a vectored write).
+	*/
+	void setNoDelay(bool on) { _()->setNoDelay(on); }
+	/**
+	On Linux, holds back partial packets while on (TCP_CORK) so that consecutive writes (such as headers followed by
+	a file) go out in full packets; turning it off sends any pending data. Does nothing on other systems.
+	*/
+	void setCork(bool on) { _()->setCork(on); }
+	/**
+	Sends `count` bytes of the file at `path` starting at `offset` (or up to the end of the file if `count` is negative)
+	and returns the number of bytes sent, or -1 if the file cannot be read. On Linux plain sockets use `sendfile()`
+	so the data is not copied through user space; other sockets (like TLS) read and write it in blocks.
+	*/
+	Long sendFile(const String& path, Long offset = 0, Long count = -1) { return _()->sendFile(path, offset, count); }
+	/**
 	Reads n bytes and returns them as an array of bytes, or reads all available bytes if no argument is given.
 	*/
 	Array<byte> read(int n = -1) { return _()->read(n); }
@@ -330,6 +427,67 @@ public:
 	T read() { T x; *this >> x; return x; }
 };
 
+/**
+A set of preallocated buffers for many UDP packets, to receive or send them with a single system call using
+PacketSocket::readBatch() and PacketSocket::sendBatch() (`recvmmsg`/`sendmmsg` on Linux, a loop elsewhere).
+Sender addresses are kept in raw form and only converted to an InetAddress when asked for.
+
+```
+PacketBatch batch(64, 1500); // up to 64 packets of up to 1500 bytes
+socket.enableTimestamps();
+while (socket.readBatch(batch) > 0)
+{
+	for (int i = 0; i < batch.length(); i++)
+		process(batch.data(i), batch.size(i), batch.timestamp(i));
+}
+```
+\ingroup Sockets
+*/
+class ASL_API PacketBatch
+{
+public:
+	/**
+	Creates a batch of `count` packets of up to `maxSize` bytes
+	*/
+	PacketBatch(int count, int maxSize = 2048);
+	/** Returns the maximum number of packets */
+	int capacity() const { return _sizes.length(); }
+	/** Returns the maximum packet size */
+	int maxSize() const { return _maxSize; }
+	/** Returns the number of packets in the batch */
+	int length() const { return _n; }
+	/** Returns the contents of packet `i` */
+	byte* data(int i) { return _buffers.ptr() + i * _maxSize; }
+	const byte* data(int i) const { return _buffers.ptr() + i * _maxSize; }
+	/** Returns the size of packet `i` */
+	int size(int i) const { return _sizes[i]; }
+	/** Returns the address of the sender of received packet `i` */
+	InetAddress address(int i) const;
+	/**
+	Returns the time packet `i` was received as recorded by the kernel, in seconds since 1970, or 0 if not available
+	*/
+	double timestamp(int i) const { return _times[i]; }
+	/** Removes all packets */
+	void clear() { _n = 0; }
+	/**
+	Adds a packet to be sent to an address, returns false if the batch is full or the packet too large
+	*/
+	bool add(const InetAddress& to, const void* data, int n);
+protected:
+	friend struct PacketSocket_;
+	enum { ADDR_SIZE = 128, CONTROL_SIZE = 64 };
+	byte* headers(int n) { if (_headers.length() < n) _headers.resize(n); return _headers.ptr(); }
+	int _n;
+	int _maxSize;
+	Array<byte> _buffers;
+	Array<int> _sizes;
+	Array<byte> _addrs;     // sockaddr of each packet, ADDR_SIZE bytes each
+	Array<int> _addrLens;
+	Array<double> _times;
+	Array<byte> _control;   // ancillary data with timestamps, CONTROL_SIZE bytes each
+	Array<byte> _headers;   // system message headers, kept between calls
+};
+
 ASL_SMART_CLASS(PacketSocket, Socket)
 {
 	ASL_SMART_INNER_DEF(PacketSocket);
@@ -339,6 +497,10 @@ ASL_SMART_CLASS(PacketSocket, Socket)
 	String readLine();
 	void sendTo(const InetAddress& addr, const void* data, int n);
 	int readFrom(InetAddress& addr, void* data, int n);
+	int readBatch(PacketBatch& batch);
+	int sendBatch(PacketBatch& batch);
+	bool enableTimestamps();
+	bool _timestamps;
 };
 
 /**
@@ -384,6 +546,28 @@ public:
 	{
 		return _()->readFrom(addr, data, n);
 	}
+	/**
+	Receives as many packets as available into the batch, up to its capacity, waiting for the first one if the
+	socket is blocking. Returns the number of packets received, or -1 on error.
+	*/
+	int readBatch(PacketBatch& batch)
+	{
+		return _()->readBatch(batch);
+	}
+	/**
+	Sends the packets added to the batch, and returns how many were sent.
+	*/
+	int sendBatch(PacketBatch& batch)
+	{
+		return _()->sendBatch(batch);
+	}
+	/**
+	Asks the kernel to record the time each packet arrives, to be read with PacketBatch::timestamp() (only on Linux)
+	*/
+	bool enableTimestamps()
+	{
+		return _()->enableTimestamps();
+	}
 };
 
 #ifndef _WIN32
@@ -9,6 +9,8 @@
 namespace asl {
 	
 struct SockServerThread;
+struct SockReactor;
+struct SockWorkerPool;
 
 /**
 This is a reusable TCP socket server that listens to incoming connections and answers them concurrently (default) or sequentially.
@@ -38,18 +40,90 @@ To add a TLS serving end point, use the `bindTLS` function, and set the certific
 server.bindTLS(443);
 server.useCert(cert, key);
 ~~~
+
+By default each connection is served in its own thread. For servers with many mostly idle connections there is an
+event-driven mode (currently only on Linux, using `epoll`) in which a fixed number of I/O threads watch all
+connections and call `onInput()` whenever a client has incoming data. The default `onInput()` just calls `serve()`,
+so a subclass should implement it to process one message and return without blocking:
+
+~~~
+class EchoServer : public SocketServer
+{
+public:
+	int onInput(Socket client)
+	{
+		String line = client.readLine();
+		if (client.error())
+			return CLIENT_CLOSE;
+		client << line << "\n";
+		return CLIENT_KEEP;    // keep watching this client
+	}
+};
+
+EchoServer server;
+server.bind(9000);
+server.setEventDriven(2);  // two I/O threads for all connections
+server.start();
+~~~
+
+Starting a thread for each connection also means that a burst of clients can create any number of threads. With
+`setThreadPool()` connections are instead queued and served by a fixed number of worker threads. When the queue is
+full new clients are either rejected (calling `reject()`, which HttpServer uses to answer with status 503) or
+the server stops accepting until there is room:
+
+~~~
+server.setThreadPool(16, 200, SocketServer::OVERLOAD_REJECT);
+~~~
+
+Combined with `setEventDriven()`, the I/O threads only detect input and the workers run `onInput()`. Without it
+each worker is taken by a connection until it is closed, so a pool of N threads is exhausted by N idle clients. A
+subclass whose clients always send first (like HttpServer) can set `_clientSpeaksFirst` so that a pool without
+`setEventDriven()` gets one I/O thread to watch idle connections, where `epoll` is available.
+
+I/O and worker threads call the virtual functions of the server, so they must have finished before a subclass's
+members are destroyed. `stop()` waits for them, and a subclass using any of these modes should otherwise call
+`shutdown()` in its destructor:
+~~~
+~EchoServer() { shutdown(); }
+~~~
 \ingroup Sockets
 */
 
 class ASL_API SocketServer
 {
+	friend struct SockReactor;
+	friend struct SockWorkerPool;
 	SockServerThread* _thread;
+	Array<SockReactor*> _reactors;
+	int _nextReactor;
+	SockWorkerPool* _pool;
+	int _poolThreads;
+	int _poolQueue;
+	void dispatch(SockReactor* reactor, Socket& client);
+	void onReady(SockReactor* reactor, Socket& client);
+	void runJob(SockReactor* reactor, Socket& client);
+	bool enqueue(const Socket& client, SockReactor* reactor);
+	bool ownThread() const;
 protected:
 	Sockets _sockets;
 	bool _requestStop;
 	bool _sequential;
 	bool _running;
+	int _ioThreads;
+	int _overload;
+	bool _clientSpeaksFirst;
 public:
+	/** Values returned by onInput() to tell the event loop what to do next with a client */
+	enum InputStatus {
+		CLIENT_CLOSE,  //!< Close the connection
+		CLIENT_KEEP,   //!< Keep the connection and notify again when there is more input
+		CLIENT_DETACH  //!< Stop watching the connection but do not close it (someone else took it)
+	};
+	/** What to do with new clients when the thread pool queue is full */
+	enum OverloadPolicy {
+		OVERLOAD_REJECT, //!< Call `reject()` with the client and close it
+		OVERLOAD_BLOCK   //!< Wait until there is room in the queue (stop accepting meanwhile)
+	};
 	SocketServer();
 	~SocketServer();
 	/** Makes the server start listening. This function blocks by default. If the `nonblocking` argument is `true`
@@ -80,17 +154,52 @@ public:
 	virtual void serve(Socket client) { service(client); } // call old deprecated name
 	/** Old service function \deprecated Use serve() */
 	virtual void service(Socket client) {}
+	/**
+	In event-driven mode, this function is called in an I/O thread when the client has incoming data (or was
+	disconnected). It should process the available input without blocking for long and return CLIENT_KEEP to keep
+	the connection, CLIENT_CLOSE to close it or CLIENT_DETACH if the socket was handed over to some other thread.
+	The default implementation calls `serve()` and closes the connection.
+	*/
+	virtual int onInput(Socket client) { serve(client); return CLIENT_CLOSE; }
+	/**
+	Called when a client cannot be served because the thread pool queue is full and the overload policy is
+	OVERLOAD_REJECT. It can send some error message to the client, which will be closed afterwards.
+	*/
+	virtual void reject(Socket client) {}
 	void startLoop();
 	/**
-	Requests the server to stop receiving connections.
+	Stops the server receiving connections and waits until its I/O threads and thread pool workers have finished
+	(unless called from one of them).
 	*/
 	void stop();
 	/**
+	Stops the server and waits until its I/O threads and thread pool workers have finished; it is called by the
+	destructor, but subclasses should call it in their own destructors, as those threads may still be running
+	their virtual functions.
+	*/
+	void shutdown();
+	/**
 	Sets the mode of operation: sequential (connections will be handled in sequence) or concurrent (
 	connections will be handled in parallel by starting a new thread each time); this must be called before calling
 	`start()` to start the server.
 	*/
 	void setSequential(bool on) { _sequential = on; }
+	/**
+	Enables the event-driven mode, in which all connections are watched by `n` I/O threads that call `onInput()`
+	when a client has input, instead of starting a thread per connection. Use `n = 0` to go back to the default
+	mode. Must be called before `start()`. Without `epoll` support (non Linux systems) this has no effect.
+	*/
+	void setEventDriven(int n = 1) { _ioThreads = n; }
+	/** Returns true if the server is running in event-driven mode */
+	bool eventDriven() const { return _reactors.length() > 0; }
+	/**
+	Makes clients be served by a pool of `threads` worker threads instead of a new thread each, with up to
+	`queueSize` clients waiting for a free worker. When the queue is full, `policy` decides if new clients are
+	rejected or the server waits. Use `threads = 0` to go back to a thread per connection. Must be called before `start()`.
+	*/
+	void setThreadPool(int threads, int queueSize = 64, OverloadPolicy policy = OVERLOAD_REJECT);
+	/** Returns true if clients are served by a thread pool */
+	bool pooled() const { return _pool != NULL; }
 	bool running() const { return _running; }
 };
 }
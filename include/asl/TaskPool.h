@@ -0,0 +1,198 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_TASKPOOL_H
+#define ASL_TASKPOOL_H
+
+#include <asl/defs.h>
+#include <asl/time.h>
+#include <asl/atomic.h>
+#include <asl/Mutex.h>
+
+namespace asl {
+
+class TaskGroup;
+struct TaskScheduler;
+
+/**
+Base class of tasks run by a TaskPool. Reimplement `run()` with the work to do.
+\ingroup Threading
+*/
+struct Task
+{
+	Task() : _group(0) {}
+	virtual ~Task() {}
+	virtual void run() = 0;
+	TaskGroup* _group;
+};
+
+/**
+A TaskPool runs small tasks on a fixed set of worker threads using *work stealing*: each worker has its own queue
+of tasks, takes the most recently added task from it, and when it is empty takes the oldest task from another
+worker's queue. Tasks added from threads not in the pool go to a shared queue.
+
+There is a process-wide pool, `TaskPool::global()`, with one worker less than the number of processors, as the
+thread waiting for tasks also runs them. Tasks are usually started through a TaskGroup, or with `parallel_for()`:
+
+~~~
+TaskPool::global().parallel_for(0, images.length(), [&](int i) {
+	images[i].blur();
+});
+~~~
+
+`Thread::parallel_for()` and `Thread::parallel_invoke()` use this pool. Since waiting for a group runs other pending
+tasks instead of blocking, nested parallel loops do not create more threads than the pool has.
+\ingroup Threading
+*/
+class ASL_API TaskPool
+{
+public:
+	/**
+	Creates a pool with the given number of worker threads (by default, one less than the number of processors)
+	*/
+	TaskPool(int threads = 0);
+	/**
+	Stops the workers after their current tasks; tasks not yet started are discarded
+	*/
+	~TaskPool();
+	/**
+	Returns the process-wide pool
+	*/
+	static TaskPool& global();
+	/**
+	Returns the number of worker threads
+	*/
+	int threads() const;
+	/**
+	Adds a task that will be run by some worker and then deleted; it is not part of any group and cannot be waited for
+	*/
+	void spawn(Task* task);
+	/**
+	Adds a function or function object, such as a lambda, to be run by some worker
+	*/
+	template<class F>
+	void spawn(const F& f) { spawn(task(f)); }
+	/**
+	Runs one pending task in the calling thread, if there is any, and returns true if it did
+	*/
+	bool runPending();
+	/**
+	Returns true if called from one of the worker threads of this pool
+	*/
+	bool isWorker() const;
+	/**
+	Calls `f(i)` for `i` from `i0` up to but not including `i1`, in parallel, and returns when all calls finished.
+	The range is split in halves as workers become free, down to pieces of `grain` indices (by default, so
+	that there are about 8 pieces per thread).
+	*/
+	template<class F>
+	void parallel_for(int i0, int i1, const F& f, int grain = 0);
+
+	template<class F>
+	struct FunctionTask : public Task
+	{
+		F f;
+		FunctionTask(const F& f_) : f(f_) {}
+		void run() { f(); }
+	};
+	template<class F>
+	struct RangeTask : public Task
+	{
+		const F* f;
+		int i0, i1, grain;
+		RangeTask(const F& f_, int a, int b, int g) : f(&f_), i0(a), i1(b), grain(g) {}
+		void run() { runRange(*_group, i0, i1, *f, grain); }
+	};
+	template<class F>
+	static Task* task(const F& f) { return new FunctionTask<F>(f); }
+	template<class T>
+	static Task* task(T* t) { return t; }
+	static Task* task(void (*f)()) { return new FunctionTask<void (*)()>(f); }
+	template<class F>
+	static void runRange(TaskGroup& group, int i0, int i1, const F& f, int grain);
+	int grainFor(int n) const;
+protected:
+	friend class TaskGroup;
+	TaskScheduler* _s;
+private:
+	TaskPool(const TaskPool&);
+	void operator=(const TaskPool&);
+};
+
+/**
+A TaskGroup starts tasks in a TaskPool and waits for all of them. Tasks can add more tasks to the same group, so
+recursive algorithms can split their work:
+
+~~~
+TaskGroup group;
+group.spawn([&]() { sort(left); });
+group.spawn([&]() { sort(right); });
+group.sync();
+~~~
+
+While waiting in `sync()` the calling thread runs pending tasks of the pool. The destructor also waits.
+\ingroup Threading
+*/
+class ASL_API TaskGroup
+{
+public:
+	/**
+	Creates a group using the given pool, or the global one
+	*/
+	TaskGroup(TaskPool& pool = TaskPool::global()) : _pool(pool), _done(_mutex) {}
+	~TaskGroup() { sync(); }
+	/**
+	Adds a task to this group; it will be deleted after running
+	*/
+	void spawn(Task* task);
+	/**
+	Adds a function or function object, such as a lambda, to be run as part of this group
+	*/
+	template<class F>
+	void spawn(const F& f) { spawn(TaskPool::task(f)); }
+	/**
+	Waits until all tasks of this group have finished, running pending tasks meanwhile
+	*/
+	void sync();
+	/**
+	Returns the number of tasks of this group not yet finished
+	*/
+	int pending() const { return _pending; }
+protected:
+	friend struct TaskScheduler;
+	void finished();
+	TaskPool& _pool;
+	AtomicCount _pending;
+	Mutex _mutex;
+	Condition _done;
+private:
+	TaskGroup(const TaskGroup&);
+	void operator=(const TaskGroup&);
+};
+
+template<class F>
+void TaskPool::runRange(TaskGroup& group, int i0, int i1, const F& f, int grain)
+{
+	while (i1 - i0 > grain)
+	{
+		int m = i0 + (i1 - i0) / 2;
+		group.spawn((Task*)new RangeTask<F>(f, m, i1, grain));
+		i1 = m;
+	}
+	for (int i = i0; i < i1; i++)
+		f(i);
+}
+
+template<class F>
+void TaskPool::parallel_for(int i0, int i1, const F& f, int grain)
+{
+	if (i1 <= i0)
+		return;
+	TaskGroup group(*this);
+	runRange(group, i0, i1, f, grain > 0 ? grain : grainFor(i1 - i0));
+	group.sync();
+}
+
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include <asl/time.h>
 #include <asl/Array.h>
 #include "Mutex.h"
+#include "TaskPool.h"
 
 #ifdef _WIN32
 #include <process.h>
@@ -107,13 +108,6 @@ class Thread
 #endif
 	Handle _thread;
 private:
-	struct Context {
-		void* f;
-		Thread* t;
-		Handle h;
-		int i;
-	};
-
 	void run(Function f, void* arg)
 	{
 #ifdef _WIN32
@@ -153,13 +147,14 @@ private:
 	{
 		(*((Func*)f))();
 	}
-	template<class Func>
-	static void ASL_THREADFUNC_API beginf1(void* p)
+	template<class F>
+	struct ParallelFor : public Task
 	{
-		if(!p) return;
-		Context* s = (Context*)p;
-		(*((Func*)s->f))(s->i);
-	}
+		F f;
+		int i0, i1, grain;
+		ParallelFor(int a, int b, const F& f_, int g) : f(f_), i0(a), i1(b), grain(g) {}
+		void run() { TaskPool::global().parallel_for(i0, i1, f, grain); }
+	};
 #endif
 public:
 	Thread()
@@ -211,6 +206,15 @@ public:
 		void* ret;
 		pthread_join(_thread, &ret);
 		_thread = 0;
+#endif
+	}
+	/** Returns true if called from this thread */
+	bool isCurrent() const
+	{
+#ifdef _WIN32
+		return _thread != 0 && GetThreadId(_thread) == GetCurrentThreadId();
+#else
+		return _thread != 0 && pthread_equal(_thread, pthread_self());
 #endif
 	}
 	/**
@@ -245,7 +249,8 @@ public:
 	/**
 	Emulates an OpenMP *parallel for* by running function `f` several times in parallel. Function `f` must
 	receive an integer argument which will get the values from `i0` up to but not including `i1`.
-	If the argument `wait` is true, the call is blocking and will wait for all executions to end.
+	If the argument `wait` is true, the call is blocking and will wait for all executions to end; otherwise `f` is
+	copied and the loop runs in the background.
 	
 	This is equivalent to running:
 
@@ -254,26 +259,17 @@ public:
 		f(i);
 	~~~
 	
-	but with all iterations run in parallel threads.
+	but with the iterations run by the threads of `TaskPool::global()`, in pieces of `grain` consecutive indices
+	(by default chosen from the number of processors). Loops nested in `f` share the same threads.
 	Needs lambda support.
 	*/
 	template<class F>
-	static void parallel_for(int i0, int i1, const F& f, bool wait=true)
+	static void parallel_for(int i0, int i1, const F& f, bool wait=true, int grain=0)
 	{
-		Array<Thread> threads;
-		Array<Context> contexts(i1-i0);
-		contexts.clear();
-		for(int i=i0; i<i1; i++)
-		{
-			Thread t;
-			Context s = { &f, i, &t, 0};
-			contexts << s;
-			t.run((Function)Thread::beginf1<F>, (void*)&contexts.last());
-			threads << t;
-		}
 		if(wait)
-			foreach(Thread& t, threads)
-				t.join();
+			TaskPool::global().parallel_for(i0, i1, f, grain);
+		else
+			TaskPool::global().spawn((Task*)new ParallelFor<F>(i0, i1, f, grain));
 	}
 	/**
 	Runs the two functions/lambdas in parallel and returns when both are finished.
@@ -281,9 +277,10 @@ public:
 	template<class F1, class F2>
 	static void parallel_invoke(const F1& f1, const F2& f2)
 	{
-		Thread t2(f2);
+		TaskGroup group;
+		group.spawn(f2);
 		f1();
-		t2.join();
+		group.sync();
 	}
 	/**
 	Runs the 3 functions/lambdas in parallel and returns when all are finished.
@@ -291,12 +288,11 @@ public:
 	template<class F1, class F2, class F3>
 	static void parallel_invoke(const F1& f1, const F2& f2, const F3& f3)
 	{
-		Array<Thread> threads;
-		Thread t2(f2), t3(f3);
+		TaskGroup group;
+		group.spawn(f2);
+		group.spawn(f3);
 		f1();
-		threads << t2 << t3;
-		foreach(Thread& t, threads)
-			t.join();
+		group.sync();
 	}
 	/**
 	Runs the 4 functions/lambdas in parallel and returns when all are finished.
@@ -304,12 +300,12 @@ public:
 	template<class F1, class F2, class F3, class F4>
 	static void parallel_invoke(const F1& f1, const F2& f2, const F3& f3, const F4& f4)
 	{
-		Array<Thread> threads;
-		Thread t2(f2), t3(f3), t4(f4);
+		TaskGroup group;
+		group.spawn(f2);
+		group.spawn(f3);
+		group.spawn(f4);
 		f1();
-		threads << t2 << t3 << t4;
-		foreach(Thread& t, threads)
-			t.join();
+		group.sync();
 	}
 #endif
 };
@@ -26,10 +26,13 @@ ASL_SMART_CLASS(TlsSocket, Socket)
 	Socket_* accept();
 	bool connect(const InetAddress& host);
 	void close();
-	int available();
-	int read(void* data, int size);
+	int availableRaw();
+	int readRaw(void* data, int size);
 	int write(const void* data, int n);
-	bool waitInput(double timeout = 60);
+	int write(const IoVec* parts, int n);
+	Long sendFile(const String& path, Long offset, Long count) { return copyFile(path, offset, count); }
+	int tryWrite(const void* data, int n);
+	bool waitInputRaw(double timeout);
 	bool useCert(const String& cert);
 	bool useKey(const String& key);
 };
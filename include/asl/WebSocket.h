@@ -8,10 +8,14 @@
 #include <asl/String.h>
 #include <asl/SocketServer.h>
 #include <asl/Mutex.h>
+#include <asl/Pointer.h>
 
 namespace asl {
 
 class Var;
+struct WsOutbox;
+struct WsHub;
+struct WsDeflate;
 
 struct WebSocketMsg
 {
@@ -31,6 +35,30 @@ private:
 	Array<byte> _data;
 };
 
+/**
+Options of the permessage-deflate extension, which compresses messages if both ends support it. It is only
+available if ASL is compiled with `ASL_ZLIB` enabled. Each connection with compression enabled uses about
+`2^(windowBits+2) + 2^(memLevel+9)` bytes to compress and `2^windowBits + 7K` bytes to decompress, allocated
+when first needed.
+*/
+struct WebSocketCompression
+{
+	/** Enables compression if the peer accepts it */
+	bool enabled;
+	/** Keeps the compression context between messages; compresses similar messages much better */
+	bool contextTakeover;
+	/** Base-2 logarithm of the compression window size (9 to 15) */
+	int windowBits;
+	/** zlib memory level of the compressor (1 to 9) */
+	int memLevel;
+	/** Messages shorter than this number of bytes are sent uncompressed */
+	int threshold;
+	/** Maximum size of a received message (after decompression); the connection is closed if one would be larger */
+	int maxMessageSize;
+	WebSocketCompression(bool enable = true) : enabled(enable), contextTakeover(true), windowBits(15), memLevel(8),
+		threshold(128), maxMessageSize(64 * 1024 * 1024) {}
+};
+
 /**
 This class represents a WebSocket. A WebSocket can be used to connect to WebSocket server as a client
 and send and receive messages (binary or text). Or it can be an incoming connection in a WebSocketServer.
@@ -49,6 +77,8 @@ To connect to a TLS secure server, use the "wss:" protocol:
 ~~~
 ws.connect("wss://some-encrypted-websocketserver:443");
 ~~~
+
+Messages can be compressed with the permessage-deflate extension by calling `setCompression()` before connecting.
 */
 
 class ASL_API WebSocket
@@ -60,6 +90,9 @@ public:
 	*/
 	WebSocket();
 	WebSocket(const Socket& s, bool isclient = true);
+	WebSocket(const WebSocket& ws);
+	~WebSocket();
+	WebSocket& operator=(const WebSocket& ws);
 	/**
 	Connecto to a WebSocket server at the given host and port (the port can be in the `host` string separated with ':')
 	*/
@@ -89,6 +122,47 @@ public:
 	Sends a Var as a text message by encoding to JSON
 	*/
 	void send(const Var& v);
+	/** Base class of fragment producers for sendFragmented() */
+	struct Producer
+	{
+		virtual ~Producer() {}
+		virtual int operator()(byte* buffer, int size) = 0;
+	};
+	/**
+	Sends a message in fragments of up to `fragmentSize` bytes produced by a function called as `f(buffer, size)`,
+	which must write up to `size` bytes to `buffer` and return their number, or 0 at the end of the message. `f` can
+	be a function, a lambda or a pointer to a Producer subclass, which will be deleted. Only two fragments are held
+	in memory at a time:
+
+	~~~
+	File file("video.mp4", File::READ);
+	ws.sendFragmented([&](byte* p, int n) { return file.read(p, n); });
+	~~~
+
+	For a client managed by the hub of a WebSocketServer the message is queued whole, so that published messages
+	are not interleaved with its fragments.
+	*/
+	template<class F>
+	void sendFragmented(const F& f, FrameType type = FRAME_BINARY, int fragmentSize = 65536)
+	{
+		Producer* p = producer(f);
+		sendFragments(*p, type, fragmentSize);
+		delete p;
+	}
+	/**
+	Receives the next fragment of a message as soon as it arrives, replacing the contents of `data`, so that large
+	messages can be processed without holding them whole in memory. Sets `last` to true on the final fragment of a
+	message, and returns the message type (FRAME_TEXT or FRAME_BINARY), or FRAME_CLOSE if the connection was closed.
+	Control frames are processed internally.
+
+	~~~
+	Array<byte> data;
+	bool last = false;
+	while (!last && ws.receiveFragment(data, last) != WebSocket::FRAME_CLOSE)
+		file.write(data.ptr(), data.length());
+	~~~
+	*/
+	FrameType receiveFragment(Array<byte>& data, bool& last);
 	/**
 	Waits for incoming data for a maximum time (60 seconds by default)
 	*/
@@ -104,13 +178,49 @@ public:
 	Tests if this WebSocket is closed, possibly by the other end
 	*/
 	bool closed();
+	/**
+	XORs `n` bytes of `src` with the 4-byte frame masking `key` and writes them to `dst`, which can be the same as
+	`src`. Uses SSE2 or AVX2 instructions when available.
+	*/
+	static void applyMask(byte* dst, const byte* src, int n, const byte* key);
+	/**
+	Sets the compression options to offer to the server when connecting
+	*/
+	void setCompression(const WebSocketCompression& options) { _compression = options; }
+	/**
+	Returns true if messages in this connection are compressed
+	*/
+	bool compressed() const { return _deflate; }
 protected:
+	friend struct WsHub;
+	friend class WebSocketServer;
+	template<class F>
+	struct FunctionProducer : public Producer
+	{
+		F f;
+		FunctionProducer(const F& f_) : f(f_) {}
+		int operator()(byte* buffer, int size) { return f(buffer, size); }
+	};
+	template<class F>
+	static Producer* producer(const F& f) { return new FunctionProducer<F>(f); }
+	template<class P>
+	static Producer* producer(P* p) { return p; }
+	static Producer* producer(int (*f)(byte*, int)) { return new FunctionProducer<int (*)(byte*, int)>(f); }
+	void sendFragments(Producer& producer, FrameType type, int fragmentSize);
+	void sendFrame(const byte* p, int length, byte opcode);
+	int readFrame(Array<byte>& data);
+	void closeSocket();
 	Socket _socket;
 	Array<byte> _buffer;
 	bool _isClient;
 	bool _closed;
 	int _code;
 	Random _random;
+	WsOutbox* _outbox;   // send queue, if the socket is managed by the hub of a WebSocketServer
+	WebSocketCompression _compression;
+	Shared<WsDeflate> _deflate;  // compression state, if negotiated
+	byte _fragType;              // opcode of the message being received by fragments
+	bool _fragDeflated;
 };
 
 /**
@@ -140,6 +250,24 @@ wsserver.bind(9000);
 wsserver.start();
 ~~~
 
+A server can also distribute messages to groups of clients by topic. Clients are subscribed to topics with
+`subscribe()` and messages are sent to all subscribers of a topic with `publish()`. Each message is framed only once
+and queued to every subscriber, and a separate thread sends the queues without blocking on slow clients. When a
+client's queue reaches the limit set with `setSendQueue()` new messages for it are dropped, or the client is
+disconnected. Once subscribed, a client's own `send()` calls also go through its queue.
+
+~~~
+void serve(WebSocket& ws)
+{
+	subscribe(ws, "news");
+	while (!ws.closed()) {
+		...
+	}
+}
+...
+wsserver.publish("news", Var("title", "Hello")("id", 3));
+~~~
+
 Additionally, a WebSocket server can use the same port as an HttpServer. To do this, call the `link()`
 function in the HTTP server and only start that one.
 
@@ -152,9 +280,11 @@ httpserver.start();
 class ASL_API WebSocketServer: public SocketServer
 {
 	friend class HttpServer;
+	friend struct WsProcessThread;
 public:
 	WebSocketServer();
 	WebSocketServer(int port);
+	~WebSocketServer();
 	/**
 	Serves the incoming client websocket, implement this function in a subclass to define
 	the behavior of this server.
@@ -165,13 +295,68 @@ public:
 	*/
 	const Array<WebSocket*>& clients() const { return _clients; }
 	Mutex& mutex() { return _mutex; }
+	/** What to do with a client whose send queue is full */
+	enum SlowClientPolicy { SLOW_DROP, SLOW_DISCONNECT };
+	/** Statistics of published messages */
+	struct HubStats
+	{
+		Long published;     // messages published
+		Long queued;        // messages queued to subscribers
+		Long sent;          // messages completely sent
+		Long dropped;       // messages dropped because a queue was full
+		Long disconnected;  // clients disconnected because their queue was full
+		HubStats() : published(0), queued(0), sent(0), dropped(0), disconnected(0) {}
+	};
+	/**
+	Sets the maximum number of messages waiting to be sent to each subscribed client (1024 by default), and whether
+	further messages are dropped or the client is disconnected when its queue is full
+	*/
+	void setSendQueue(int maxMessages, SlowClientPolicy policy = SLOW_DROP);
+	/**
+	Subscribes a client to a topic
+	*/
+	void subscribe(WebSocket& ws, const String& topic);
+	/**
+	Unsubscribes a client from a topic
+	*/
+	void unsubscribe(WebSocket& ws, const String& topic);
+	/**
+	Sends a text message to all clients subscribed to a topic and returns the number of clients it was queued to
+	*/
+	int publish(const String& topic, const String& message);
+	int publish(const String& topic, const char* message) { return publish(topic, String(message)); }
+	/**
+	Sends a binary message to all clients subscribed to a topic and returns the number of clients it was queued to
+	*/
+	int publish(const String& topic, const Array<byte>& message);
+	/**
+	Sends a Var encoded as JSON to all clients subscribed to a topic
+	*/
+	int publish(const String& topic, const Var& message);
+	/**
+	Returns the number of clients subscribed to a topic
+	*/
+	int subscribers(const String& topic);
+	/**
+	Returns the counts of messages published, sent and dropped
+	*/
+	HubStats hubStats();
+	/**
+	Sets the compression options accepted from clients; compression is disabled by default
+	*/
+	void setCompression(const WebSocketCompression& options) { _compression = options; }
 protected:
 	Array<byte> readMessage();
 private:
 	void process(Socket& socket, const Dic<String>& headers);
 	void serve(Socket client);
+	WsHub* hub();
+	int publishFrame(const String& topic, const byte* p, int n, byte opcode);
 	Array<WebSocket*> _clients;
 	Mutex _mutex;
+	Mutex _hubMutex;
+	WsHub* _hub;
+	WebSocketCompression _compression;
 };
 }
 #endif
@@ -18,6 +18,12 @@
 
 inline int atomicInc(volatile int* x) { return ++*x; }
 inline int atomicDec(volatile int* x) { return --*x; }
+inline int atomicAdd(volatile int* x, int d) { return *x += d; }
+inline bool atomicCas(volatile int* x, int expected, int desired) { if (*x != expected) return false; *x = desired; return true; }
+inline void atomicFence() {}
+inline void atomicAcquireFence() {}
+inline int atomicLoad(const volatile int* x) { return *x; }
+inline void atomicStore(volatile int* x, int v) { *x = v; }
 
 #elif defined _WIN32
 
@@ -25,11 +31,35 @@ inline int atomicDec(volatile int* x) { return --*x; }
 
 inline int atomicInc(volatile int* x) { return InterlockedIncrement((long*)(x)); }
 inline int atomicDec(volatile int* x) { return InterlockedDecrement((long*)(x)); }
+inline int atomicAdd(volatile int* x, int d) { return InterlockedExchangeAdd((long*)(x), d) + d; }
+inline bool atomicCas(volatile int* x, int expected, int desired)
+{
+	return InterlockedCompareExchange((long*)(x), desired, expected) == expected;
+}
+inline void atomicFence() { MemoryBarrier(); }
+inline void atomicAcquireFence() { MemoryBarrier(); }
+inline int atomicLoad(const volatile int* x) { int v = *x; MemoryBarrier(); return v; }
+inline void atomicStore(volatile int* x, int v) { MemoryBarrier(); *x = v; }
 
 #elif __has_builtin(__sync_add_and_fetch) || (defined(__GNUC__) && ASL_C_VER >= 40102)
 
 inline int atomicInc(int volatile* x) { return __sync_add_and_fetch(x, 1); }
 inline int atomicDec(int volatile* x) { return __sync_sub_and_fetch(x, 1); }
+inline int atomicAdd(int volatile* x, int d) { return __sync_add_and_fetch(x, d); }
+inline bool atomicCas(int volatile* x, int expected, int desired)
+{
+	return __sync_bool_compare_and_swap(x, expected, desired);
+}
+inline void atomicFence() { __sync_synchronize(); }
+#ifdef __ATOMIC_ACQUIRE
+inline void atomicAcquireFence() { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+inline int atomicLoad(const int volatile* x) { return __atomic_load_n(x, __ATOMIC_ACQUIRE); }
+inline void atomicStore(int volatile* x, int v) { __atomic_store_n(x, v, __ATOMIC_RELEASE); }
+#else
+inline void atomicAcquireFence() { __sync_synchronize(); }
+inline int atomicLoad(const int volatile* x) { int v = *x; __sync_synchronize(); return v; }
+inline void atomicStore(int volatile* x, int v) { __sync_synchronize(); *x = v; }
+#endif
 
 // gcc >= 4.7 ?
 //inline int atomicInc(int volatile* x) { return __atomic_add_fetch(x, 1, __ATOMIC_RELAXED); }
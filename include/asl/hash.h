@@ -0,0 +1,229 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_HASH_H
+#define ASL_HASH_H
+
+#include <asl/Array.h>
+#include <asl/String.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#endif
+
+namespace asl {
+
+/**
+\defgroup Hashing Hashing
+Hash functions for hash containers. `hash64(x, seed)` returns a 64-bit hash of a value, and `hashBytes()` hashes a
+block of memory. They are based on the wyhash algorithm: keys are read 8 bytes at a time, and each pair of 64-bit words
+is combined with a full 64x64->128-bit multiply. Long keys are processed in three independent lanes of 16 bytes.
+
+Containers use them through a *hasher* parameter, a function object returning `hash64(key, seed)`. The default
+`Hasher` has a fixed seed, so results are repeatable, while `RandomHasher` picks a different random seed for each
+container, so that keys coming from untrusted sources can't be crafted to collide:
+
+~~~
+HashMap<String, Session, RandomHasher<String> > sessions;
+~~~
+
+To make a type usable as a key, define a global `hash64(const T&, ULong seed)` function (usually by combining the
+`hash64()` of its fields with `hashMix()`), or the older `int hash(const T&)`, which is then mixed into 64 bits.
+Without any, the raw bytes of the object are hashed, which is only correct for types without padding or pointers.
+@{
+*/
+
+// Multiplies two 64-bit numbers and returns the high and low halves of the 128-bit result xor'ed
+inline ULong hashMul(ULong a, ULong b)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)a * b;
+	return (ULong)(r >> 64) ^ (ULong)r;
+#elif defined(_MSC_VER) && defined(_M_X64)
+	ULong hi, lo = _umul128(a, b, &hi);
+	return hi ^ lo;
+#else
+	ULong ha = a >> 32, hb = b >> 32, la = (unsigned)a, lb = (unsigned)b;
+	ULong rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), c = t < rl;
+	ULong lo = t + (rm1 << 32);
+	c += lo < t;
+	return (rh + (rm0 >> 32) + (rm1 >> 32) + c) ^ lo;
+#endif
+}
+
+static const ULong HASH_K0 = 0x2d358dccaa6c78a5ull;
+static const ULong HASH_K1 = 0x8bb84b93962eacc9ull;
+static const ULong HASH_K2 = 0x4b33a62ed433d4a3ull;
+static const ULong HASH_K3 = 0x4d5a2da51de1aa47ull;
+
+/**
+Mixes a 64-bit value with a seed (or with another hash, to combine hashes) into a well distributed 64-bit hash
+*/
+inline ULong hashMix(ULong x, ULong seed = 0)
+{
+	return hashMul(x ^ HASH_K0, seed ^ HASH_K1);
+}
+
+inline ULong hashRead8(const byte* p)
+{
+	ULong x;
+	memcpy(&x, p, 8);
+	return x;
+}
+
+inline ULong hashRead4(const byte* p)
+{
+	unsigned x;
+	memcpy(&x, p, 4);
+	return x;
+}
+
+/**
+Returns a 64-bit hash of `n` bytes at `data`
+*/
+inline ULong hashBytes(const void* data, int n, ULong seed = 0)
+{
+	const byte* p = (const byte*)data;
+	ULong len = (ULong)n, a, b;
+	seed ^= hashMul(seed ^ HASH_K0, HASH_K1);
+	if (n <= 16)
+	{
+		if (n >= 4)
+		{
+			int k = (n >> 3) << 2;
+			a = (hashRead4(p) << 32) | hashRead4(p + k);
+			b = (hashRead4(p + n - 4) << 32) | hashRead4(p + n - 4 - k);
+		}
+		else if (n > 0)
+		{
+			a = ((ULong)p[0] << 16) | ((ULong)p[n >> 1] << 8) | p[n - 1];
+			b = 0;
+		}
+		else
+			a = b = 0;
+	}
+	else
+	{
+		if (n > 48)
+		{
+			ULong s1 = seed, s2 = seed;
+			do {
+				seed = hashMul(hashRead8(p) ^ HASH_K1, hashRead8(p + 8) ^ seed);
+				s1 = hashMul(hashRead8(p + 16) ^ HASH_K2, hashRead8(p + 24) ^ s1);
+				s2 = hashMul(hashRead8(p + 32) ^ HASH_K3, hashRead8(p + 40) ^ s2);
+				p += 48;
+				n -= 48;
+			} while (n > 48);
+			seed ^= s1 ^ s2;
+		}
+		while (n > 16)
+		{
+			seed = hashMul(hashRead8(p) ^ HASH_K1, hashRead8(p + 8) ^ seed);
+			p += 16;
+			n -= 16;
+		}
+		a = hashRead8(p + n - 16);
+		b = hashRead8(p + n - 8);
+	}
+	return hashMul(hashMul(a ^ HASH_K1, b ^ seed) ^ HASH_K0 ^ len, HASH_K1);
+}
+
+inline ULong hash64(int x, ULong seed = 0) { return hashMix((ULong)(unsigned)x, seed); }
+
+inline ULong hash64(unsigned x, ULong seed = 0) { return hashMix(x, seed); }
+
+inline ULong hash64(Long x, ULong seed = 0) { return hashMix((ULong)x, seed); }
+
+inline ULong hash64(ULong x, ULong seed = 0) { return hashMix(x, seed); }
+
+inline ULong hash64(double x, ULong seed = 0)
+{
+	ULong u = 0;
+	if (x != 0) // so that -0.0 and 0.0 hash the same
+		memcpy(&u, &x, sizeof(x));
+	return hashMix(u, seed);
+}
+
+inline ULong hash64(float x, ULong seed = 0) { return hash64((double)x, seed); }
+
+inline ULong hash64(const String& s, ULong seed = 0) { return hashBytes(*s, s.length(), seed); }
+
+inline ULong hash64(const Array<byte>& a, ULong seed = 0) { return hashBytes(a.ptr(), a.length(), seed); }
+
+template<class T>
+inline ULong hash64(T* p, ULong seed = 0)
+{
+	return hashMix((ULong)(size_t)p, seed);
+}
+
+/*
+32-bit hash functions, kept for compatibility: types with their own `hash()` function can still be hash map keys.
+*/
+
+inline int hash(int x)
+{
+	return (int)hash64(x);
+}
+
+inline int hash(const String& s)
+{
+	return (int)hash64(s);
+}
+
+inline int hash(const Array<byte>& s)
+{
+	return (int)hash64(s);
+}
+
+template<typename T>
+inline int hash(T* p)
+{
+	return (int)hash64(p);
+}
+
+template<typename T>
+inline int hash(const T& x)
+{
+	return (int)hashBytes(&x, sizeof(x));
+}
+
+/**
+Returns a 64-bit hash of `x` for types that only have a 32-bit `hash()` function
+*/
+template<class T>
+inline ULong hash64(const T& x, ULong seed = 0)
+{
+	return hashMix((ULong)(unsigned)hash(x), seed);
+}
+
+/**
+Returns a random seed for hash functions, different each time
+*/
+ASL_API ULong randomHashSeed();
+
+/**
+The default hasher for hash containers: it hashes keys with `hash64()` and a fixed seed
+*/
+template<class K>
+struct Hasher
+{
+	ULong seed;
+	Hasher(ULong s = 0) : seed(s) {}
+	ULong operator()(const K& key) const { return hash64(key, seed); }
+};
+
+/**
+A hasher for hash containers that uses a different random seed in each container
+*/
+template<class K>
+struct RandomHasher : public Hasher<K>
+{
+	RandomHasher() : Hasher<K>(randomHashSeed()) {}
+};
+
+/**@}*/
+
+}
+#endif
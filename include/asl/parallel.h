@@ -0,0 +1,264 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#ifndef ASL_PARALLEL_H
+#define ASL_PARALLEL_H
+
+#include <asl/Array.h>
+#include <asl/Thread.h>
+
+#ifdef ASL_EXP_THREADING
+
+namespace asl {
+
+/**
+\defgroup Parallel Parallel algorithms
+Algorithms over arrays that run in the threads of `TaskPool::global()`. They split the array in blocks (about 8
+per thread, and not smaller than a minimum), so for small arrays they simply run in the calling thread.
+
+~~~
+Array<double> x = ...;
+double total = parallel_reduce(x, 0.0, [](double a, double b) { return a + b; });
+Array<double> cumulative = parallel_scan(x, [](double a, double b) { return a + b; });
+Array<double> squares = parallel_map(x, [](double a) { return a * a; });
+Array<double> positive = parallel_filter(x, [](double a) { return a > 0; });
+parallel_sort(x);
+~~~
+
+The combining function of `parallel_reduce()` and `parallel_scan()` must be associative, but it does not need
+to be commutative, as results are combined in array order.
+Needs lambda support.
+@{
+*/
+
+/*
+Divides a range of `n` items in consecutive blocks to be processed by the task pool.
+*/
+struct ParallelBlocks
+{
+	enum { MIN_BLOCK = 2048 };
+	int n, size, count;
+	ParallelBlocks(int n_, int minSize = MIN_BLOCK) : n(n_)
+	{
+		size = max(TaskPool::global().grainFor(n), minSize);
+		count = (n + size - 1) / size;
+	}
+	int begin(int k) const { return k * size; }
+	int end(int k) const { return min((k + 1) * size, n); }
+	template<class F>
+	void run(const F& f) const
+	{
+		if (count == 1)
+			f(0);
+		else if (count > 1)
+			TaskPool::global().parallel_for(0, count, f, 1);
+	}
+};
+
+/*
+Parallel merge sort: leaves are sorted with quicksort, and each merge is split by binary search so that merging
+the two largest halves also runs in parallel. Sorted halves alternate between the array and a scratch buffer.
+*/
+template<class T, class Less>
+struct ParallelSorter
+{
+	const Less& less;
+	int grain;
+	ParallelSorter(const Less& l, int g) : less(l), grain(g) {}
+
+	void sort(T* a, T* t, int n, bool toScratch)
+	{
+		if (n <= grain)
+		{
+			quicksort(a, n, less);
+			if (toScratch)
+				for (int i = 0; i < n; i++)
+					t[i] = a[i];
+			return;
+		}
+		int h = n / 2;
+		TaskGroup group;
+		group.spawn([=]() { sort(a, t, h, !toScratch); });
+		sort(a + h, t + h, n - h, !toScratch);
+		group.sync();
+		T* src = toScratch ? a : t;
+		merge(src, h, src + h, n - h, toScratch ? t : a);
+	}
+
+	void merge(const T* x, int nx, const T* y, int ny, T* out)
+	{
+		if (nx < ny)
+		{
+			swap(x, y);
+			swap(nx, ny);
+		}
+		if (nx + ny <= grain)
+		{
+			const T* xe = x + nx, *ye = y + ny;
+			while (x < xe && y < ye)
+				*out++ = less(*y, *x) ? *y++ : *x++;
+			while (x < xe)
+				*out++ = *x++;
+			while (y < ye)
+				*out++ = *y++;
+			return;
+		}
+		int mx = nx / 2, lo = 0, hi = ny;
+		while (lo < hi)
+		{
+			int m = (lo + hi) / 2;
+			if (less(y[m], x[mx]))
+				lo = m + 1;
+			else
+				hi = m;
+		}
+		TaskGroup group;
+		group.spawn([=]() { merge(x, mx, y, lo, out); });
+		merge(x + mx, nx - mx, y + lo, ny - lo, out + mx + lo);
+		group.sync();
+	}
+};
+
+template<class T>
+struct ParallelLess
+{
+	bool operator()(const T& a, const T& b) const { return a < b; }
+};
+
+/**
+Combines all elements of `a` with the function `combine(x, y)`, starting with `init`, in parallel
+*/
+template<class T, class F>
+T parallel_reduce(const Array<T>& a, const T& init, const F& combine)
+{
+	ParallelBlocks blocks(a.length());
+	Array<T> partial(blocks.count);
+	blocks.run([&](int k) {
+		const T* p = a.ptr();
+		int i = blocks.begin(k), e = blocks.end(k);
+		T x = p[i];
+		while (++i < e)
+			x = combine(x, p[i]);
+		partial[k] = x;
+	});
+	T x = init;
+	for (int k = 0; k < partial.length(); k++)
+		x = combine(x, partial[k]);
+	return x;
+}
+
+/**
+Returns the inclusive prefix scan of `a`, in which element `i` is the combination of elements `0` to `i` of `a`
+*/
+template<class T, class F>
+Array<T> parallel_scan(const Array<T>& a, const F& combine)
+{
+	Array<T> s(a.length());
+	ParallelBlocks blocks(a.length());
+	blocks.run([&](int k) {
+		const T* p = a.ptr();
+		T* q = s.ptr();
+		int i = blocks.begin(k), e = blocks.end(k);
+		q[i] = p[i];
+		for (i++; i < e; i++)
+			q[i] = combine(q[i - 1], p[i]);
+	});
+	if (blocks.count < 2)
+		return s;
+	Array<T> offset(blocks.count);
+	offset[1] = s[blocks.end(0) - 1];
+	for (int k = 2; k < blocks.count; k++)
+		offset[k] = combine(offset[k - 1], s[blocks.end(k - 1) - 1]);
+	blocks.run([&](int k) {
+		if (k == 0)
+			return;
+		T* q = s.ptr();
+		for (int i = blocks.begin(k), e = blocks.end(k); i < e; i++)
+			q[i] = combine(offset[k], q[i]);
+	});
+	return s;
+}
+
+/**
+Returns an array with the results of applying function `f` to each element of `a`, computed in parallel; the
+elements of the result have the type returned by `f`
+*/
+template<class T, class F>
+Array<decltype((*(F*)0)(*(const T*)0))> parallel_map(const Array<T>& a, const F& f)
+{
+	typedef decltype((*(F*)0)(*(const T*)0)) R;
+	Array<R> b(a.length());
+	ParallelBlocks blocks(a.length());
+	blocks.run([&](int k) {
+		const T* p = a.ptr();
+		R* q = b.ptr();
+		for (int i = blocks.begin(k), e = blocks.end(k); i < e; i++)
+			q[i] = f(p[i]);
+	});
+	return b;
+}
+
+/**
+Returns an array with the elements of `a` for which `pred(x)` is true, in the same order, evaluated in parallel
+*/
+template<class T, class F>
+Array<T> parallel_filter(const Array<T>& a, const F& pred)
+{
+	ParallelBlocks blocks(a.length());
+	Array<byte> keep(a.length());
+	Array<int> counts(blocks.count);
+	blocks.run([&](int k) {
+		const T* p = a.ptr();
+		int m = 0;
+		for (int i = blocks.begin(k), e = blocks.end(k); i < e; i++)
+			m += (keep[i] = pred(p[i]) ? 1 : 0);
+		counts[k] = m;
+	});
+	int total = 0;
+	for (int k = 0; k < counts.length(); k++)
+	{
+		int m = counts[k];
+		counts[k] = total;
+		total += m;
+	}
+	Array<T> b(total);
+	blocks.run([&](int k) {
+		const T* p = a.ptr();
+		T* q = b.ptr() + counts[k];
+		for (int i = blocks.begin(k), e = blocks.end(k); i < e; i++)
+			if (keep[i])
+				*q++ = p[i];
+	});
+	return b;
+}
+
+/**
+Sorts the array in place with the function `less(a, b)`, in parallel
+*/
+template<class T, class Less>
+Array<T>& parallel_sort(Array<T>& a, const Less& less)
+{
+	ParallelBlocks blocks(a.length(), 8192);
+	if (blocks.count < 2)
+		return a.sort(less);
+	Array<T> scratch(a.length());
+	ParallelSorter<T, Less>(less, blocks.size).sort(a.ptr(), scratch.ptr(), a.length(), false);
+	return a;
+}
+
+/**
+Sorts the array in place using the elements' < operator, in parallel
+*/
+template<class T>
+Array<T>& parallel_sort(Array<T>& a)
+{
+	return parallel_sort(a, ParallelLess<T>());
+}
+
+/**@}*/
+
+}
+
+#endif
+
+#endif
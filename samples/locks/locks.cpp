@@ -0,0 +1,122 @@
+#include <asl/Thread.h>
+#include <asl/time.h>
+#include <stdio.h>
+
+using namespace asl;
+
+/*
+Measures the cost of the locks in Mutex.h under contention: several threads repeatedly take a lock to update or
+read a small shared object. Reported times are nanoseconds per operation, over all threads.
+*/
+
+struct Config
+{
+	int version;
+	double values[6];
+};
+
+static const int OPS = 400000;
+
+template<class F>
+double timeThreads(int threads, const F& f)
+{
+	double t0 = now();
+	Array<Thread> list;
+	for (int i = 0; i < threads; i++)
+		list << Thread(f);
+	foreach(Thread& t, list)
+		t.join();
+	return (now() - t0) * 1e9 / (threads * OPS);
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = argc > 1 ? myatoi(argv[1]) : max(Thread::numProcessors(), 4);
+	printf("%i threads, %i operations each\n\n", threads, OPS);
+
+	Mutex mutex;
+	SpinLock spin;
+	ReadWriteLock rw;
+	SeqLock<Config> seq;
+	Config config = { 1, { 0 } };
+	volatile double sink = 0;
+#ifndef _WIN32
+	pthread_mutex_t pmutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+	auto increment = [&](int kind) {
+		for (int i = 0; i < OPS; i++)
+		{
+			if (kind == 0)
+			{
+				Lock _(mutex);
+				config.version++;
+			}
+			else if (kind == 1)
+			{
+				ScopedLock<SpinLock> _(spin);
+				config.version++;
+			}
+#ifndef _WIN32
+			else
+			{
+				pthread_mutex_lock(&pmutex);
+				config.version++;
+				pthread_mutex_unlock(&pmutex);
+			}
+#endif
+		}
+	};
+	// read-mostly: 1 write every 100 operations
+	auto readMostly = [&](int kind) {
+		double s = 0;
+		for (int i = 0; i < OPS; i++)
+		{
+			bool write = i % 100 == 0;
+			if (kind == 0)
+			{
+				Lock _(mutex);
+				if (write)
+					config.version++;
+				s += config.values[i % 6];
+			}
+			else if (kind == 1)
+			{
+				if (write)
+				{
+					WriteLock _(rw);
+					config.version++;
+				}
+				else
+				{
+					ReadLock _(rw);
+					s += config.values[i % 6];
+				}
+			}
+			else
+			{
+				if (write)
+				{
+					Config c = seq.get();
+					c.version++;
+					seq.set(c);
+				}
+				else
+					s += seq.get().values[i % 6];
+			}
+		}
+		sink = sink + s;
+	};
+
+	printf("increment a counter:\n");
+	printf("  Mutex            %6.1f ns\n", timeThreads(threads, [&]() { increment(0); }));
+	printf("  SpinLock         %6.1f ns\n", timeThreads(threads, [&]() { increment(1); }));
+#ifndef _WIN32
+	printf("  pthread_mutex    %6.1f ns\n", timeThreads(threads, [&]() { increment(2); }));
+#endif
+	printf("\nread a value, 1%% writes:\n");
+	printf("  Mutex            %6.1f ns\n", timeThreads(threads, [&]() { readMostly(0); }));
+	printf("  ReadWriteLock    %6.1f ns\n", timeThreads(threads, [&]() { readMostly(1); }));
+	printf("  SeqLock          %6.1f ns\n", timeThreads(threads, [&]() { readMostly(2); }));
+	return 0;
+}
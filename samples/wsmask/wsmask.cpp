@@ -0,0 +1,81 @@
+#include <asl/WebSocket.h>
+#include <asl/time.h>
+#include <stdio.h>
+
+using namespace asl;
+
+/*
+Compares the speed of WebSocket frame masking as done by previous versions (copy the payload, then XOR 4 bytes at a
+time, and append received frames to the message) with WebSocket::applyMask(), which masks while copying when sending
+and unmasks in place when receiving.
+*/
+
+// previous implementation of sending: copy the payload and mask it in 4-byte words
+
+static void oldMask(Array<byte>& data, const byte* p, int length, unsigned mask)
+{
+	data = Array<byte>(p, length);
+	data.resize(data.length() + 4);
+	data.resize(data.length() - 4);
+	int n = data.length() / 4 + 1;
+	for (int i = 0; i < n; i++)
+		((unsigned*)data.ptr())[i] ^= mask;
+}
+
+// previous implementation of receiving: read into a new buffer, unmask and append to the message
+
+static void oldUnmask(Array<byte>& msg, const byte* p, int length, unsigned mask)
+{
+	Array<byte> buffer(length);
+	memcpy(buffer.ptr(), p, length);
+	buffer.resize(buffer.length() + 4);
+	buffer.resize(buffer.length() - 4);
+	int n = buffer.length() / 4 + 1;
+	for (int i = 0; i < n; i++)
+		((unsigned*)buffer.ptr())[i] ^= mask;
+	msg.append(buffer);
+}
+
+int main()
+{
+	const int sizes[] = { 64, 512, 4096, 65536, 1 << 20 };
+	byte key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+	unsigned mask;
+	memcpy(&mask, key, 4);
+	printf("%10s %14s %14s %14s %14s\n", "bytes", "old send", "new send", "old receive", "new receive");
+	for (int k = 0; k < 5; k++)
+	{
+		int n = sizes[k];
+		int iterations = (256 << 20) / n;
+		Array<byte> payload(n), data, msg;
+		for (int i = 0; i < n; i++)
+			payload[i] = (byte)i;
+		double mbytes = (double)n * iterations / (1 << 20);
+		double t1 = now();
+		for (int i = 0; i < iterations; i++)
+			oldMask(data, payload.ptr(), n, mask);
+		double t2 = now();
+		for (int i = 0; i < iterations; i++)
+		{
+			data.resize(n);
+			WebSocket::applyMask(data.ptr(), payload.ptr(), n, key);
+		}
+		double t3 = now();
+		for (int i = 0; i < iterations; i++)
+		{
+			msg.clear();
+			oldUnmask(msg, payload.ptr(), n, mask);
+		}
+		double t4 = now();
+		for (int i = 0; i < iterations; i++)
+		{
+			msg.resize(n);
+			memcpy(msg.ptr(), payload.ptr(), n); // stands for the socket read into the message
+			WebSocket::applyMask(msg.ptr(), msg.ptr(), n, key);
+		}
+		double t5 = now();
+		printf("%10i %9.0f MB/s %9.0f MB/s %9.0f MB/s %9.0f MB/s\n", n, mbytes / (t2 - t1), mbytes / (t3 - t2),
+			mbytes / (t4 - t3), mbytes / (t5 - t4));
+	}
+	return 0;
+}
@@ -0,0 +1,484 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#include <asl/AsyncHttp.h>
+#include <asl/Thread.h>
+#include <asl/TlsSocket.h>
+#ifdef _WIN32
+#include <WinSock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+namespace asl {
+
+enum { CALL_QUEUED, CALL_CONNECTING, CALL_SENDING, CALL_READING };
+enum { BODY_NONE, BODY_LENGTH, BODY_CHUNKED, BODY_UNTIL_CLOSE };
+
+struct AsyncHttp::CallState
+{
+	HttpRequest request;
+	HttpResponse response;
+	Callback* callback;
+	Array<InetAddress> addrs;
+	int addr;                  // address being tried
+	bool tls;
+	double deadline;
+	Socket socket;
+	String out;                // the request as sent
+	int sent;                  // bytes of `out` already sent
+	Array<byte> in;            // data received
+	int phase;
+	int head;                  // length of the response head, once received
+	int framing;
+	int length;                // body length, or remaining bytes of the current chunk (-1 before its size line)
+	int pos;                   // parsed position in `in` for chunked bodies
+	bool timedOut;
+	bool complete;
+	Mutex mutex;
+	Condition finished;
+	CallState() : callback(0), addr(0), tls(false), sent(0), phase(CALL_QUEUED), head(0), framing(BODY_NONE), length(0),
+		pos(0), timedOut(false), complete(false)
+	{
+		finished.use(mutex);
+	}
+	~CallState()
+	{
+		delete callback;
+	}
+};
+
+/*
+The event-loop thread of an AsyncHttp client: starts queued requests up to the concurrency limit and polls their
+sockets, advancing each through connection, sending and parsing of the response. A UDP socket bound to the
+loopback interface is used to wake it up when requests are added.
+*/
+struct AsyncHttpLoop : public Thread
+{
+	typedef Shared<AsyncHttp::CallState> CallPtr;
+	Mutex _mutex;
+	Condition _changed;
+	Array<CallPtr> _queue, _active;
+	int _maxConcurrent;
+	bool _stop;
+	PacketSocket _wake;
+	InetAddress _wakeAddr;
+
+	AsyncHttpLoop() : _maxConcurrent(64), _stop(false)
+	{
+		_changed.use(_mutex);
+		_wake.bind("127.0.0.1", 0);
+		_wakeAddr = _wake.localAddress();
+		start();
+	}
+	void wake()
+	{
+		_wake.sendTo(_wakeAddr, "w", 1);
+	}
+	void add(const CallPtr& call)
+	{
+		{
+			Lock _(_mutex);
+			_queue << call;
+		}
+		wake();
+	}
+	void stop()
+	{
+		_stop = true;
+		wake();
+		join();
+	}
+	void run();
+	bool connect(AsyncHttp::CallState& c);
+	bool onReady(AsyncHttp::CallState& c, bool& ok);
+	bool parse(AsyncHttp::CallState& c, bool& ok);
+	void finish(AsyncHttp::CallState& c, bool ok);
+};
+
+/*
+Starts connecting to the next address of a request, returns false if there are no more
+*/
+bool AsyncHttpLoop::connect(AsyncHttp::CallState& c)
+{
+	while (c.addr < c.addrs.length())
+	{
+		const InetAddress& addr = c.addrs[c.addr++];
+		c.phase = CALL_CONNECTING;
+		if (c.tls)
+		{
+#ifdef ASL_TLS
+			c.socket = TlsSocket();
+			if (!c.socket.connect(addr))
+				continue;
+			c.socket.setNoDelay(true);
+			c.phase = CALL_SENDING; // sent when the socket is writable, as with plain connections
+			c.sent = 0;
+			return true;
+#else
+			return false;
+#endif
+		}
+		c.socket = Socket();
+		if (c.socket.startConnect(addr))
+			return true;
+	}
+	return false;
+}
+
+/*
+Handles a socket event of a request; returns true when the request has finished, setting `ok` if it succeeded
+*/
+bool AsyncHttpLoop::onReady(AsyncHttp::CallState& c, bool& ok)
+{
+	ok = false;
+	if (c.phase == CALL_CONNECTING)
+	{
+		if (!c.socket.finishConnect())
+			return !connect(c);
+		c.socket.setNoDelay(true);
+		c.phase = CALL_SENDING;
+		c.sent = 0;
+	}
+	if (c.phase == CALL_SENDING) // send what the socket takes now and wait to be writable again for the rest
+	{
+		int m = c.socket.tryWrite(*c.out + c.sent, c.out.length() - c.sent);
+		if (m < 0)
+			return true;
+		c.sent += m;
+		if (c.sent == c.out.length())
+			c.phase = CALL_READING;
+		return false;
+	}
+	int n = c.socket.available();
+	if (n <= 0) // closed by the server
+	{
+		if (c.head > 0 && c.framing == BODY_UNTIL_CLOSE)
+		{
+			c.response._body = Array<byte>(c.in.ptr() + c.head, c.in.length() - c.head);
+			ok = true;
+		}
+		return true;
+	}
+	do {
+		int m = c.in.length();
+		c.in.resize(m + n);
+		if (c.socket.read(c.in.ptr() + m, n) != n)
+			return true;
+	} while ((n = c.socket.available()) > 0);
+	return parse(c, ok);
+}
+
+/*
+Parses the data received so far; returns true when the response is complete or malformed
+*/
+bool AsyncHttpLoop::parse(AsyncHttp::CallState& c, bool& ok)
+{
+	HttpResponse& response = c.response;
+	const char* p = (const char*)c.in.ptr();
+	int n = c.in.length();
+	if (c.head == 0)
+	{
+		int end = HttpMessage::headEnd(p, n, 0);
+		if (!end)
+			return n > Http::maxHeadSize();
+		response._head = String(p, end);
+		const char* eol = (const char*)memchr(p, '\n', end);
+		int k = int(eol - p);
+		Array<String> parts = String(p, (k > 0 && p[k - 1] == '\r') ? k - 1 : k).split();
+		if (parts.length() < 2 || !response.parseHeaders(k + 1))
+			return true;
+		response.setProto(parts[0]);
+		response.setCode(parts[1]);
+		int code = response.code();
+		if (code < 200 && code != 101) // an interim response (like 100 Continue): skip it and parse the next one
+		{
+			c.in = Array<byte>(c.in.ptr() + end, n - end);
+			response = HttpResponse();
+			response.use(c.socket);
+			return parse(c, ok);
+		}
+		c.head = c.pos = end;
+		if (c.request.method() == "HEAD" || code == 204 || code == 304 || code < 200)
+			c.framing = BODY_NONE;
+		else if (response.header("Transfer-Encoding") == "chunked")
+		{
+			c.framing = BODY_CHUNKED;
+			c.length = -1;
+		}
+		else if (response.hasHeader("Content-Length"))
+		{
+			c.framing = BODY_LENGTH;
+			c.length = (int)response.header("Content-Length");
+		}
+		else
+			c.framing = BODY_UNTIL_CLOSE;
+	}
+	switch (c.framing)
+	{
+	case BODY_NONE:
+		ok = true;
+		return true;
+	case BODY_LENGTH:
+		if (n - c.head < c.length)
+			return false;
+		response._body = Array<byte>(c.in.ptr() + c.head, c.length);
+		ok = true;
+		return true;
+	case BODY_CHUNKED:
+		while (1)
+		{
+			if (c.length < 0) // expecting a chunk size line
+			{
+				const char* eol = (const char*)memchr(p + c.pos, '\n', n - c.pos);
+				if (!eol)
+					return false;
+				c.length = String(p + c.pos, int(eol - p) - c.pos).trimmed().hexToInt();
+				c.pos = int(eol - p) + 1;
+				if (c.length == 0) // trailers are ignored, the connection is closed anyway
+				{
+					ok = true;
+					return true;
+				}
+			}
+			int m = min(c.length, n - c.pos);
+			response._body.append((const byte*)p + c.pos, m);
+			c.pos += m;
+			c.length -= m;
+			if (c.length > 0 || n - c.pos < 2) // chunk data or its CRLF still to come
+				return false;
+			c.pos += 2;
+			c.length = -1;
+		}
+	}
+	return false;
+}
+
+void AsyncHttpLoop::finish(AsyncHttp::CallState& c, bool ok)
+{
+	c.socket.close();
+	if (!ok)
+		c.response.setCode(0);
+	if (c.callback)
+		(*c.callback)(c.response);
+	Lock _(c.mutex);
+	c.complete = true;
+	c.finished.signal();
+}
+
+void AsyncHttpLoop::run()
+{
+	Array<pollfd> fds;
+	while (!_stop)
+	{
+		bool changed = false;
+		Array<CallPtr> starting;
+		{
+			Lock _(_mutex);
+			while (_queue.length() > 0 && _active.length() < _maxConcurrent)
+			{
+				starting << _queue[0];
+				_active << _queue[0];
+				_queue.remove(0);
+			}
+		}
+		foreach(CallPtr& call, starting)
+		{
+			if (!connect(*call))
+			{
+				{
+					Lock _(_mutex);
+					for (int i = 0; i < _active.length(); i++)
+						if (&*_active[i] == &*call) {
+							_active.remove(i);
+							break;
+						}
+				}
+				finish(*call, false);
+				changed = true;
+			}
+		}
+
+		double t = now(), timeout = 1.0;
+		fds.resize(_active.length() + 1);
+		fds[0].fd = _wake.handle();
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		for (int i = 0; i < _active.length(); i++)
+		{
+			AsyncHttp::CallState& c = *_active[i];
+			pollfd& fd = fds[i + 1];
+			fd.fd = c.socket.handle();
+			fd.events = (c.phase == CALL_READING) ? POLLIN : POLLOUT;
+			fd.revents = 0;
+			timeout = min(timeout, c.deadline - t);
+		}
+		poll(fds.ptr(), fds.length(), (int)(max(timeout, 0.0) * 1000) + 1);
+
+		if (fds[0].revents)
+		{
+			char buffer[64];
+			InetAddress sender;
+			while (_wake.available() > 0)
+				_wake.readFrom(sender, buffer, sizeof(buffer));
+		}
+		t = now();
+		for (int i = _active.length() - 1; i >= 0; i--)
+		{
+			CallPtr call = _active[i];
+			AsyncHttp::CallState& c = *call;
+			bool ok = false, done = false;
+			if (fds[i + 1].revents)
+				done = onReady(c, ok);
+			if (!done && t >= c.deadline)
+				done = c.timedOut = true;
+			if (done)
+			{
+				{
+					Lock _(_mutex);
+					_active.remove(i);
+				}
+				finish(c, ok);
+				changed = true;
+			}
+		}
+		if (changed)
+		{
+			Lock _(_mutex);
+			_changed.signal();
+		}
+	}
+
+	Array<CallPtr> calls;
+	{
+		Lock _(_mutex);
+		calls.append(_queue);
+		calls.append(_active);
+		_queue.clear();
+		_active.clear();
+		_changed.signal();
+	}
+	foreach(CallPtr& call, calls)
+		finish(*call, false);
+}
+
+AsyncHttp::Call::Call() {}
+
+AsyncHttp::Call::Call(const Call& c) : _state(c._state) {}
+
+AsyncHttp::Call::~Call() {}
+
+void AsyncHttp::Call::operator=(const Call& c)
+{
+	_state = c._state;
+}
+
+HttpResponse& AsyncHttp::Call::wait()
+{
+	CallState& c = *_state;
+	Lock _(c.mutex);
+	while (!c.complete)
+		c.finished.wait(0.5);
+	return c.response;
+}
+
+bool AsyncHttp::Call::wait(double timeout)
+{
+	CallState& c = *_state;
+	double t = now() + timeout;
+	Lock _(c.mutex);
+	while (!c.complete)
+	{
+		double dt = t - now();
+		if (dt <= 0)
+			return false;
+		c.finished.wait(min(dt, 0.5));
+	}
+	return true;
+}
+
+bool AsyncHttp::Call::done() const
+{
+	CallState& c = *_state;
+	Lock _(c.mutex);
+	return c.complete;
+}
+
+bool AsyncHttp::Call::timedOut() const
+{
+	return done() && _state->timedOut;
+}
+
+HttpResponse& AsyncHttp::Call::response()
+{
+	return _state->response;
+}
+
+AsyncHttp::AsyncHttp()
+{
+	_timeout = 30;
+	_loop = new AsyncHttpLoop();
+}
+
+AsyncHttp::~AsyncHttp()
+{
+	_loop->stop();
+	delete _loop;
+}
+
+void AsyncHttp::setMaxConcurrent(int n)
+{
+	{
+		Lock _(_loop->_mutex);
+		_loop->_maxConcurrent = max(n, 1);
+	}
+	_loop->wake();
+}
+
+AsyncHttp::Call AsyncHttp::send(const HttpRequest& request, double timeout, Callback* callback)
+{
+	Call call;
+	call._state = new CallState;
+	CallState& c = *call._state;
+	c.callback = callback;
+	c.deadline = now() + (timeout < 0 ? _timeout : timeout);
+	c.request = request;
+	c.request.use(c.socket);
+	c.response.use(c.socket);
+
+	HttpRequest& req = c.request;
+	Url url = parseUrl(req.url());
+	c.tls = url.protocol == "https";
+	if (url.port == 0)
+		url.port = c.tls ? 443 : 80;
+	c.addrs = InetAddress::lookup(url.host);
+	for (int i = 0; i < c.addrs.length(); i++)
+		c.addrs[i].setPort(url.port);
+
+	if (req.body().length() != 0)
+		req.setHeader("Content-Length", req.body().length());
+	if (!req.hasHeader("Connection"))
+		req.setHeader("Connection", "close");
+	req._command = String() << req.method() << ' ' << url.path << " HTTP/1.1\r\nHost: " << url.host << ':' << url.port;
+	c.out = req.headerBlock();
+	c.out.append((const char*)req.body().ptr(), req.body().length());
+
+	_loop->add(call._state);
+	return call;
+}
+
+void AsyncHttp::wait()
+{
+	Lock _(_loop->_mutex);
+	while (_loop->_queue.length() + _loop->_active.length() > 0)
+		_loop->_changed.wait(0.5);
+}
+
+int AsyncHttp::pending() const
+{
+	Lock _(_loop->_mutex);
+	return _loop->_queue.length() + _loop->_active.length();
+}
+
+}
@@ -5,6 +5,7 @@
 #include <asl/Http.h>
 #include <asl/JSON.h>
 #include <asl/TlsSocket.h>
+#include <asl/Mutex.h>
 #include <ctype.h>
 
 namespace asl {
@@ -86,16 +87,19 @@ Url parseUrl(const String& url)
 HttpMessage::HttpMessage() : _progress(NULL), _fileBody(false), _chunked(false)
 {
 	_headersSent = false;
+	_nhrefs = 0;
 }
 
 HttpMessage::HttpMessage(const Dic<>& headers) : _headers(headers), _progress(NULL), _fileBody(false), _chunked(false)
 {
 	_headersSent = false;
+	_nhrefs = 0;
 }
 
 HttpMessage::HttpMessage(Socket& s) : _socket(&s), _progress(NULL), _fileBody(false), _chunked(false)
 {
 	_headersSent = false;
+	_nhrefs = 0;
 }
 
 String HttpMessage::text() const
@@ -134,6 +138,8 @@ void HttpMessage::put(const File& body)
 
 void HttpMessage::setHeader(const String& header, const String& value)
 {
+	if (_nhrefs > 0)
+		materialize();
 	String name;// = capitalize(header);
 	bool capitalize = true;
 	for (int i = 0; i < header.length(); i++)
@@ -146,38 +152,156 @@ void HttpMessage::setHeader(const String& header, const String& value)
 
 String HttpMessage::header(const String& name) const
 {
+	int k = findHeader(name);
+	if (k >= 0)
+		return String(*_head + _hrefs[k].value, _hrefs[k].valueLen);
 	return _headers.has(name) ? _headers[name] : "";
 }
 
 bool HttpMessage::hasHeader(const String& name) const
 {
-	return _headers.has(name);
+	return findHeader(name) >= 0 || _headers.has(name);
 }
 
-void HttpMessage::readHeaders()
+/*
+Finds a received header not yet in the Dic, ignoring case; the last one wins as when they are added to the Dic
+*/
+int HttpMessage::findHeader(const String& name) const
 {
-	String headerName, headerValue, line;
+	const char* h = *_head;
+	for (int k = _nhrefs - 1; k >= 0; k--)
+	{
+		const HeaderRef& r = _hrefs[k];
+		if (r.nameLen != name.length())
+			continue;
+		int i = 0;
+		while (i < r.nameLen && tolower(h[r.name + i]) == tolower(name[i]))
+			i++;
+		if (i == r.nameLen)
+			return k;
+	}
+	return -1;
+}
+
+/*
+Moves the header references to the headers Dic
+*/
+void HttpMessage::materialize()
+{
+	int n = _nhrefs;
+	_nhrefs = 0;
+	for (int k = 0; k < n; k++)
+		setHeader(String(*_head + _hrefs[k].name, _hrefs[k].nameLen), String(*_head + _hrefs[k].value, _hrefs[k].valueLen));
+}
+
+/*
+Reads the message head (the start line and the headers up to an empty line) from the socket buffer into `_head`
+in one piece and parses the headers in place. Returns the length of the start line or -1 on error or if the head is
+longer than `maxSize`.
+*/
+int HttpMessage::readHead(int maxSize)
+{
+	Socket& socket = *_socket;
+	if (socket.buffered() == 0 && socket.available() <= 0 && !socket.waitInput())
+		return -1;
+	const char* p;
+	while ((p = (const char*)socket.peek(1)) != NULL && (*p == '\r' || *p == '\n')) // empty lines before a message
+		socket.skip(1);
+	int scanned = 0, end = 0, want = max(socket.buffered(), 1);
+	while (!end)
+	{
+		if (want > maxSize || !(p = (const char*)socket.peek(want)))
+			return -1;
+		int n = socket.buffered();
+		end = headEnd(p, n, scanned);
+		scanned = max(n - 2, 0);
+		want = n + 1; // wait for more data
+	}
+	if (end > maxSize)
+		return -1;
+	_head = String(p, end);
+	socket.skip(end);
+	const char* eol = (const char*)memchr(*_head, '\n', end);
+	int n = int(eol - *_head);
+	if (!parseHeaders(n + 1))
+		return -1;
+	return (n > 0 && _head[n - 1] == '\r') ? n - 1 : n;
+}
+
+/*
+Returns the length of the message head at `p` (up to and including the empty line ending it) if the `n` bytes
+contain it all, or 0, looking for line ends from offset `from`
+*/
+int HttpMessage::headEnd(const char* p, int n, int from)
+{
+	for (const char* q = p + from; (q = (const char*)memchr(q, '\n', p + n - q)) != NULL; q++)
+	{
+		int i = int(q - p);
+		if (i + 1 < n && p[i + 1] == '\n')
+			return i + 2;
+		else if (i + 2 < n && p[i + 1] == '\r' && p[i + 2] == '\n')
+			return i + 3;
+	}
+	return 0;
+}
 
-	while (line = _socket->readLine(), line != "\r")
+/*
+Parses the header lines in `_head` starting at offset `i`, recording them as offsets (or adding them to the Dic
+if there are too many or lines are folded)
+*/
+bool HttpMessage::parseHeaders(int i)
+{
+	const char* h = *_head;
+	int n = _head.length(), last = -1, lastLen = 0;
+	while (i < n)
 	{
-		if (isspace(line[0])) // multiline
+		const char* eol = (const char*)memchr(h + i, '\n', n - i);
+		int next = eol ? int(eol - h) + 1 : n;
+		int end = (eol && eol > h + i && eol[-1] == '\r') ? int(eol - h) - 1 : next - (eol ? 1 : 0);
+		if (end == i)
+			break;
+		if (h[i] == ' ' || h[i] == '\t') // obsolete line folding
 		{
-			setHeader(headerName, headerValue + line.trimmed());
-			continue;
+			if (last < 0)
+				return false;
+			String name(h + last, lastLen);
+			setHeader(name, header(name) + String(h + i, end - i).trimmed());
 		}
-		line.trim();
-		int i = line.indexOf(':');
-		if (i<0) {
-			_socket->close();
-			return;
+		else
+		{
+			const char* colon = (const char*)memchr(h + i, ':', end - i);
+			if (!colon) {
+				_socket->close();
+				return false;
+			}
+			int c = int(colon - h), ne = c, v = c + 1, ve = end;
+			while (ne > i && h[ne - 1] == ' ')
+				ne--;
+			while (v < ve && (h[v] == ' ' || h[v] == '\t'))
+				v++;
+			while (ve > v && (h[ve - 1] == ' ' || h[ve - 1] == '\t'))
+				ve--;
+			if (ve > 0xffff) // beyond the offsets a HeaderRef can hold
+				setHeader(String(h + i, ne - i), String(h + v, ve - v));
+			else
+			{
+				if (_nhrefs == MAX_HEADER_REFS)
+					materialize();
+				HeaderRef& r = _hrefs[_nhrefs++];
+				r.name = (unsigned short)i;
+				r.nameLen = (unsigned short)(ne - i);
+				r.value = (unsigned short)v;
+				r.valueLen = (unsigned short)(ve - v);
+			}
+			last = i;
+			lastLen = ne - i;
 		}
-		headerName = line.substring(0, i);
-		headerValue = (i < line.length() - 1) ? line.substring(i + 2) : "";
-		setHeader(headerName, headerValue);
+		i = next;
 	}
+	return true;
 }
 
-void HttpMessage::readBody()
+bool HttpMessage::readBody()
 {
 	int size = hasHeader("Content-Length") ? (int)header("Content-Length") : 0;
 
@@ -195,19 +319,21 @@ void HttpMessage::readBody()
 
 	if (hasHeader("Content-Length")) {
 		if (header("Content-Length") == "0")
-			return;
+			return true;
 	}
 	else if(!chunked)
-		return;
+		return false;
 
 	while (!end)
 	{
 		int av = _socket->available();
 		if (av < 0 || !_socket->waitInput()) {
-			break;
+			return false;
 		}
 		byte buffer[16384];
 		int maxToRead = _socket->available(), bytesRead = 0;
+		if (!chunked)
+			maxToRead = min(maxToRead, size); // do not read into a following (pipelined) message
 		if (chunked)
 		{
 			String chunkSize = _socket->readLine();
@@ -218,7 +344,7 @@ void HttpMessage::readBody()
 		while (maxToRead > 0) {
 			bytesRead = _socket->read(buffer, min(maxToRead, (int)sizeof(buffer)));
 			if (bytesRead <= 0) {
-				return;
+				return false;
 			}
 			currentsize += bytesRead;
 			//_progress(currentsize, totalsize);
@@ -227,7 +353,7 @@ void HttpMessage::readBody()
 			if (size) {
 				size -= bytesRead;
 				if (size <= 0) {
-					return;
+					return true;
 				}
 			}
 		}
@@ -237,9 +363,10 @@ void HttpMessage::readBody()
 		if (chunked)
 		{
 			if (_socket->read(buffer, 2) < 2) // skip crlf
-				break;
+				return false;
 		}
 	}
+	return true;
 }
 
 HttpRequest::~HttpRequest()
@@ -247,35 +374,137 @@ HttpRequest::~HttpRequest()
 	//_socket->close();
 }
 
+/*
+Idle client connections kept open for reuse, by protocol, host and port, most recently used last.
+*/
+struct HttpConnectionPool
+{
+	struct Idle
+	{
+		Socket socket;
+		double since;
+	};
+	Mutex mutex;
+	Map<String, Array<Idle> > idle;
+	int maxIdle;
+	double timeout;
+	Http::PoolStats stats;
+
+	HttpConnectionPool() : maxIdle(0), timeout(30) {}
+
+	// returns an open idle connection to the given host, discarding expired or closed ones
+	bool take(const String& key, Socket& socket)
+	{
+		double now = Date::now().time();
+		Lock _(mutex);
+		Array<Idle>* list = idle.find(key);
+		while (list && list->length() > 0)
+		{
+			Idle conn = list->last();
+			list->remove(list->length() - 1);
+			stats.idle--;
+			if (now - conn.since > timeout) {
+				conn.socket.close();
+			}
+			else if (conn.socket.waitInput(0)) { // unexpected data or closed by the server
+				conn.socket.close();
+				stats.retries++;
+			}
+			else {
+				socket = conn.socket;
+				stats.reused++;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void put(const String& key, const Socket& socket)
+	{
+		Lock _(mutex);
+		Array<Idle>& list = idle[key];
+		if (list.length() >= maxIdle) {
+			list[0].socket.close();
+			list.remove(0);
+			stats.idle--;
+		}
+		Idle conn;
+		conn.socket = socket;
+		conn.socket.releaseBuffer();
+		conn.since = Date::now().time();
+		list << conn;
+		stats.idle++;
+	}
+
+	void clear()
+	{
+		Lock _(mutex);
+		foreach(Array<Idle>& list, idle)
+		{
+			foreach(Idle& conn, list)
+				conn.socket.close();
+		}
+		idle.clear();
+		stats.idle = 0;
+	}
+};
+
+static HttpConnectionPool& connectionPool()
+{
+	static HttpConnectionPool pool;
+	return pool;
+}
+
+void Http::setKeepAlive(int maxIdle, double timeout)
+{
+	HttpConnectionPool& pool = connectionPool();
+	{
+		Lock _(pool.mutex);
+		pool.maxIdle = maxIdle;
+		pool.timeout = timeout;
+	}
+	if (maxIdle <= 0)
+		pool.clear();
+}
+
+Http::PoolStats Http::poolStats()
+{
+	HttpConnectionPool& pool = connectionPool();
+	Lock _(pool.mutex);
+	return pool.stats;
+}
+
+void Http::closeIdle()
+{
+	connectionPool().clear();
+}
+
+static int maxResponseHead = 256 * 1024;
+
+void Http::setMaxHeadSize(int bytes)
+{
+	maxResponseHead = bytes;
+}
+
+int Http::maxHeadSize()
+{
+	return maxResponseHead;
+}
+
 HttpResponse Http::request(HttpRequest& request)
 {
 	Socket socket((Socket::Ptr)NULL);
 	HttpResponse response;
 
 	Url url = parseUrl(request.url());
-	if (url.protocol == "https")
-	{
-#ifdef ASL_TLS
-		socket = TlsSocket();
-		if (url.port == 0) url.port = 443;
-#else
+	bool tls = url.protocol == "https";
+#ifndef ASL_TLS
+	if (tls)
 		return response;
 #endif
-	}
-	else {
-		socket = Socket();
-		if (url.port == 0) url.port = 80;
-	}
+	if (url.port == 0)
+		url.port = tls ? 443 : 80;
 
-	response.use(socket);
-	request.use(socket);
-
-	if (!socket.connect(url.host, url.port)) {
-		//printf("Cannot connect to %s : %i\n", *url.host, url.port);
-		socket.close();
-		return response;
-	}
-	
 	if (request.body().length() != 0) {
 		request.setHeader("Content-Length", request.body().length());
 	}
@@ -283,28 +512,77 @@ HttpResponse Http::request(HttpRequest& request)
 	String title;
 	title << request.method() << ' ' << url.path << " HTTP/1.1\r\nHost: " << url.host << ':' << url.port;
 	request._command = title;
-	request.sendHeaders();
 
-	if (request.body().length() != 0)
-		request.write();
-	
-	String line = socket.readLine();
-	if (!line) {
+	HttpConnectionPool& pool = connectionPool();
+	String key;
+	key << url.protocol << "://" << url.host << ':' << url.port;
+	bool keepAlive = pool.maxIdle > 0 && request.header("Connection") != "close";
+	bool idempotent = request.method() != "POST" && request.method() != "PATCH";
+	int n = 0;
+
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		bool reused = keepAlive && attempt == 0 && pool.take(key, socket);
+		if (!reused)
+		{
+#ifdef ASL_TLS
+			if (tls)
+				socket = TlsSocket();
+			else
+#endif
+			socket = Socket();
+			if (!socket.connect(url.host, url.port)) {
+				//printf("Cannot connect to %s : %i\n", *url.host, url.port);
+				socket.close();
+				return response;
+			}
+			Lock _(pool.mutex);
+			pool.stats.connections++;
+		}
+
+		response = HttpResponse();
+		response.use(socket);
+		request.use(socket);
+		request._headersSent = false;
+		socket.setNoDelay(true);
+
+		if (request.body().length() != 0)
+			request.write(); // headers and body together
+		else
+			request.sendHeaders();
+
+		n = response.readHead(maxResponseHead);
+		if (n > 0)
+			break;
 		socket.close();
-		return response;
+		if (!reused || !idempotent) // a new connection failed or the request may have been processed
+			return response;
+		Lock _(pool.mutex);
+		pool.stats.retries++; // the pooled connection had been closed by the server
 	}
-	Array<String> parts = line.split();
-	if (parts.length() < 2) {
-		socket.close();
+	if (n <= 0)
 		return response;
-	}
-
-	response.setProto(parts[0]);
-	response.setCode(parts[1]);
 
-	response.readHeaders();
-
-	int code = response.code();
+	int code;
+	while (1)
+	{
+		Array<String> parts = String(*response._head, n).split();
+		if (parts.length() < 2) {
+			socket.close();
+			return response;
+		}
+		response.setProto(parts[0]);
+		response.setCode(parts[1]);
+		code = response.code();
+		if (code >= 200 || code == 101)
+			break;
+		response = HttpResponse(); // skip an interim response (like 100 Continue) and read the final one
+		response.use(socket);
+		if ((n = response.readHead(maxResponseHead)) <= 0) {
+			socket.close();
+			return response;
+		}
+	}
 
 	if (code == 301 || code == 302 || code == 307 || code == 308) // 303 ?
 	{
@@ -322,64 +600,107 @@ HttpResponse Http::request(HttpRequest& request)
 		}
 	}
 
-	response.readBody();
+	bool noBody = request.method() == "HEAD" || code == 204 || code == 304 || code < 200;
+	bool complete = noBody || response.readBody();
 
-	socket.close();
+	if (keepAlive && complete && code >= 200 && response.proto() == "HTTP/1.1" && response.header("Connection") != "close")
+		pool.put(key, socket);
+	else
+		socket.close();
 	return response;
 }
 
 
-void HttpRequest::read()
+void HttpRequest::read(int maxHead)
 {
-	_addr = _socket->remoteAddress();
-	_command = _socket->readLine();
-	if (_socket->error() || ! _command)
+	_pending = PENDING_ADDR;
+	int n = readHead(maxHead);
+	if (n < 0)
 		return;
-	int i = _command.indexOf(' ');
-	if(i==-1)
+	const char* h = *_head;
+	const char* sp1 = (const char*)memchr(h, ' ', n);
+	if (!sp1)
 		return;
-	int j = _command.indexOf(' ', i+1);
-	if(j==-1)
+	const char* sp2 = (const char*)memchr(sp1 + 1, ' ', h + n - sp1 - 1);
+	if (!sp2)
 		return;
-	_method = _command.substring(0,i);
-	_res = _command.substring(i+1, j);
+	_method = String(h, int(sp1 - h));
+	_target = int(sp1 - h) + 1;
+	_targetLen = int(sp2 - sp1) - 1;
+	const char* t = h + _target;
+	int q = -1, f = -1;
+	for (int i = 0; i < _targetLen; i++)
+	{
+		if (t[i] == '?' && q < 0)
+			q = i;
+		else if (t[i] == '#') {
+			f = i;
+			break;
+		}
+	}
+	_pathLen = (q >= 0) ? q : (f >= 0) ? f : _targetLen;
+	_queryLen = (q >= 0) ? ((f >= 0) ? f : _targetLen) - q - 1 : 0;
+	if (f >= 0)
+		_fragment = String(t + f + 1, _targetLen - f - 1);
+	_pending |= PENDING_RES | PENDING_PATH | PENDING_QUERY | PENDING_PARTS;
 
-	readHeaders();
 	readBody();
-	/*
-	if(_body.length() > 0) // dump
-	{
-		File("bb.txt").put(_body);
+}
+
+const String& HttpRequest::resource() const
+{
+	if (_pending & PENDING_RES) {
+		_res = String(*_head + _target, _targetLen);
+		_pending &= ~PENDING_RES;
 	}
-	*/
-	int pathend = _res.length();
-	int h = _res.indexOf('#');
-	if(h > 0)
-	{
-		pathend = h;
-		_fragment = _res.substring(h+1);
+	return _res;
+}
+
+const String& HttpRequest::path() const
+{
+	if (_pending & PENDING_PATH) {
+		_path = String(*_head + _target, _pathLen);
+		_pending &= ~PENDING_PATH;
 	}
-	int q = _res.indexOf('?');
-	if(q > 0)
-	{
-		_querystring = _res.substring(q+1, h>0? h : pathend);
-		pathend = q;
+	return _path;
+}
+
+void HttpRequest::pathView(const char*& p, int& n) const
+{
+	if (_pending & PENDING_PATH) {
+		p = *_head + _target;
+		n = _pathLen;
 	}
-	_path = _res.substring(0, pathend);
-	_parts = _path.split('/');
-	if(_parts.length() > 0) {
-		if(_parts.last() == "")
-			_parts.remove(_parts.length()-1);
-		if(_parts.length()>0 && _parts[0] == "")
-			_parts.remove(0);
+	else {
+		p = *_path;
+		n = _path.length();
 	}
 }
 
+const String& HttpRequest::querystring() const
+{
+	if (_pending & PENDING_QUERY) {
+		if (_queryLen > 0)
+			_querystring = String(*_head + _target + _pathLen + 1, _queryLen);
+		_pending &= ~PENDING_QUERY;
+	}
+	return _querystring;
+}
+
+const InetAddress& HttpRequest::sender()
+{
+	if (_pending & PENDING_ADDR) {
+		_addr = _socket->remoteAddress();
+		_pending &= ~PENDING_ADDR;
+	}
+	return _addr;
+}
+
 const Dic<>& HttpRequest::query()
 {
-	if(_querystring.length() != 0 && _query.length() == 0)
+	if(querystring().length() != 0 && _query.length() == 0)
 	{
-		Dic<> q = split(_querystring.replaceme('+', ' '), '&', '=');
+		Dic<> q = split(String(_querystring).replaceme('+', ' '), '&', '=');
 		foreach2(String& k, const String& v, q)
 			_query[decodeUrl(k)] = decodeUrl(v);
 	}
@@ -393,18 +714,32 @@ const String& HttpRequest::query(const String& key)
 
 const Array<String>& HttpRequest::parts() const
 {
+	if (_pending & PENDING_PARTS)
+	{
+		_parts = path().split('/');
+		if(_parts.length() > 0) {
+			if(_parts.last() == "")
+				_parts.remove(_parts.length()-1);
+			if(_parts.length()>0 && _parts[0] == "")
+				_parts.remove(0);
+		}
+		_pending &= ~PENDING_PARTS;
+	}
 	return _parts;
 }
 
 bool HttpRequest::is(const String& pat)
 {
+	const char* path;
+	int n;
+	pathView(path, n);
 	int i = pat.indexOf('*');
 	if(i<0) {
 		_argument = "";
-		return _path == pat;
+		return n == pat.length() && memcmp(path, *pat, n) == 0;
 	}
-	else if(/*_path.length() >= i &&*/ _path.startsWith(pat.substring(0, i))) {
-		_argument = _path.substring(i);
+	else if(n >= i && memcmp(path, *pat, i) == 0) {
+		_argument = String(path + i, n - i);
 		return true;
 	}
 	else {
@@ -413,6 +748,30 @@ bool HttpRequest::is(const String& pat)
 	}
 }
 
+const char* HttpRequest::param(const String& name, int& length) const
+{
+	for (int i = 0; i < _nparams; i++)
+	{
+		if (*_params[i].name == name)
+		{
+			const char* path;
+			int n;
+			pathView(path, n);
+			length = _params[i].length;
+			return path + _params[i].start;
+		}
+	}
+	length = 0;
+	return NULL;
+}
+
+String HttpRequest::param(const String& name) const
+{
+	int n;
+	const char* value = param(name, n);
+	return value ? String(value, n) : String();
+}
+
 HttpResponse::HttpResponse()
 {
 	_proto = "HTTP/1.0";
@@ -440,7 +799,10 @@ bool HttpResponse::is(HttpResponse::StatusType code) const
 }
 
 
-void HttpMessage::sendHeaders()
+/*
+Returns the command line and headers as sent, and marks them as sent
+*/
+String HttpMessage::headerBlock()
 {
 	String s;
 	s << _command << "\r\n";
@@ -449,67 +811,99 @@ void HttpMessage::sendHeaders()
 		s << name << ": " << value << "\r\n";
 	}
 	s << "\r\n";
-	*_socket << s;
 	_headersSent = true;
 	_chunked = !_headers.has("Content-Length");
+	return s;
 }
 
-void HttpMessage::write()
+void HttpMessage::sendHeaders()
+{
+	*_socket << headerBlock();
+}
+
+/*
+Writes a piece of the body, together with the headers if not sent yet and the chunk framing if chunked, in a
+single vectored write. Returns the number of body bytes written.
+*/
+int HttpMessage::writeBody(const void* data, int n)
 {
+	IoVec parts[4];
+	int k = 0, extra = 0;
+	String head, chunk;
 	if (!_headersSent)
-		sendHeaders();
+	{
+		head = headerBlock();
+		parts[k++] = IoVec(*head, head.length());
+	}
 	if (_chunked)
-		*_socket << String("%x\r\n", _body.length());
-	*_socket << _body;
+	{
+		chunk = String(0, "%x\r\n", n);
+		parts[k++] = IoVec(*chunk, chunk.length());
+	}
+	extra = head.length() + chunk.length();
+	if (n > 0)
+		parts[k++] = IoVec(data, n);
 	if (_chunked)
-		*_socket << "\r\n";
+		parts[k++] = IoVec("\r\n", 2);
+	int m = _socket->write(parts, k);
+	return (m < 0) ? m : clamp(m - extra, 0, n);
+}
+
+void HttpMessage::write()
+{
+	writeBody(_body.ptr(), _body.length());
 }
 
 void HttpMessage::write(const String& text)
 {
-	if(!_headersSent)
-		sendHeaders();
-	if (_chunked)
-		*_socket << String("%x\r\n", text.length());
-	*_socket << text;
-	if (_chunked)
-		*_socket << "\r\n";
+	writeBody(*text, text.length());
 }
 
 int HttpMessage::write(const char* buffer, int n)
 {
-	if(!_headersSent)
-		sendHeaders();
-	if (_chunked)
-		*_socket << String("%x\r\n", n);
-	int m = _socket->write(buffer, n);
-	if (_chunked)
-		*_socket << "\r\n";
-	return m;
+	return writeBody(buffer, n);
 }
 
-void HttpMessage::writeFile(const String& path)
+void HttpMessage::writeFile(const String& path, Long offset, Long count)
 {
 	File file(path, File::READ);
 	if (!file)
 		return;
+	if (count < 0)
+		count = file.size() - offset;
+	if (!_headersSent && hasHeader("Content-Length"))
+	{
+		file.close();
+		_socket->setCork(true); // headers and file data in full packets
+		sendHeaders();
+		_socket->sendFile(path, offset, count);
+		_socket->setCork(false);
+		return;
+	}
 	if (!_headersSent)
 		sendHeaders();
-	int n = 1;
-	while(n > 0)
+	if (!_chunked)
+	{
+		file.close();
+		_socket->sendFile(path, offset, count);
+		return;
+	}
+	if (offset > 0)
+		file.seek(offset);
+	while(count > 0)
 	{
 		char buf[16384];
-		n = file.read(buf, sizeof(buf));
-		if (n>0)
-			if (write(buf, n) < 0)
-				break;
+		int n = file.read(buf, (int)min(count, (Long)sizeof(buf)));
+		if (n <= 0 || write(buf, n) < 0)
+			break;
+		count -= n;
 	};
 }
 
-void HttpMessage::putFile(const String& path)
+void HttpMessage::putFile(const String& path, Long offset, Long count)
 {
-	setHeader("Content-Length", File(path).size());
-	writeFile(path);
+	setHeader("Content-Length", (count < 0) ? File(path).size() - offset : count);
+	writeFile(path, offset, count);
 }
 
 }
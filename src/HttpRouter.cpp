@@ -0,0 +1,226 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#include <asl/HttpRouter.h>
+
+namespace asl {
+
+struct HttpRouter::Match
+{
+	const String& method;
+	HttpRequest& request;
+	const char* base;
+	const char* suffix;
+	Route* route;
+	bool pathFound;
+	Array<String> allow;
+	Match(const String& meth, HttpRequest& req, const char* path) :
+		method(meth), request(req), base(path), suffix(0), route(0), pathFound(false) {}
+	// records the methods of a node matching the path, for the Allow header of a 405 response
+	void allowed(const Node* node)
+	{
+		pathFound = true;
+		foreach(const Route& r, node->routes)
+		{
+			if (!allow.contains(r.method))
+				allow << r.method;
+		}
+	}
+};
+
+// compares a segment name with a piece of a path, as strcmp()
+
+static int compareSegment(const String& a, const char* s, int n)
+{
+	int c = memcmp(*a, s, min(a.length(), n));
+	return (c != 0) ? c : a.length() - n;
+}
+
+HttpRouter::Node::~Node()
+{
+	foreach(Node* node, literals)
+		delete node;
+	delete param;
+	delete wildcard;
+	foreach(Route& route, routes)
+		delete route.handler;
+}
+
+HttpRouter::Node* HttpRouter::Node::literal(const char* s, int n) const
+{
+	int i = 0, j = literals.length() - 1;
+	while (i <= j)
+	{
+		int k = (i + j) / 2;
+		int c = compareSegment(literals[k]->segment, s, n);
+		if (c == 0)
+			return literals[k];
+		if (c < 0)
+			i = k + 1;
+		else
+			j = k - 1;
+	}
+	return NULL;
+}
+
+HttpRouter::Route* HttpRouter::Node::route(const String& method)
+{
+	for (int i = 0; i < routes.length(); i++)
+	{
+		if (routes[i].method == method || routes[i].method == "*")
+			return &routes[i];
+	}
+	return NULL;
+}
+
+HttpRouter::HttpRouter()
+{
+	_root = new Node;
+}
+
+HttpRouter::~HttpRouter()
+{
+	delete _root;
+}
+
+bool HttpRouter::add(const String& method, const String& pattern, Handler* handler)
+{
+	Node* node = _root;
+	const char* s = *pattern;
+	const char* e = s + pattern.length();
+	if (*s == '/')
+		s++;
+	while (s)
+	{
+		const char* slash = (const char*)memchr(s, '/', e - s);
+		const char* end = slash ? slash : e;
+		int n = int(end - s);
+		if (n == 1 && *s == '*')
+		{
+			if (!node->wildcard)
+				node->wildcard = new Node;
+			node = node->wildcard;
+			break;
+		}
+		else if (n > 1 && *s == ':')
+		{
+			if (!node->param) {
+				node->param = new Node;
+				node->param->segment = String(s + 1, n - 1);
+			}
+			else if (compareSegment(node->param->segment, s + 1, n - 1) != 0)
+			{
+				delete handler;
+				return false;
+			}
+			node = node->param;
+		}
+		else
+		{
+			Node* child = node->literal(s, n);
+			if (!child)
+			{
+				child = new Node;
+				child->segment = String(s, n);
+				int i = 0;
+				while (i < node->literals.length() && compareSegment(node->literals[i]->segment, s, n) < 0)
+					i++;
+				node->literals.insert(i, child);
+			}
+			node = child;
+		}
+		s = slash ? slash + 1 : NULL;
+	}
+	foreach(Route& r, node->routes)
+	{
+		if (r.method == method)
+		{
+			delete handler;
+			return false;
+		}
+	}
+	Route route;
+	route.method = method;
+	route.handler = handler;
+	node->routes << route;
+	return true;
+}
+
+/*
+Matches the path from `s` (the start of a segment, or null if the path is consumed) to `e` against the subtree at
+`node`, trying literal segments first, then parameters, then wildcards.
+*/
+HttpRouter::Node* HttpRouter::match(Node* node, const char* s, const char* e, Match& m)
+{
+	if (!s)
+	{
+		if (node->routes.length() == 0)
+			return NULL;
+		if ((m.route = node->route(m.method)) != NULL)
+			return node;
+		m.allowed(node);
+		return NULL;
+	}
+	const char* slash = (const char*)memchr(s, '/', e - s);
+	const char* end = slash ? slash : e;
+	const char* next = slash ? slash + 1 : NULL;
+	Node* found;
+	if (Node* child = node->literal(s, int(end - s)))
+	{
+		if ((found = match(child, next, e, m)))
+			return found;
+	}
+	if (node->param && end > s)
+	{
+		HttpRequest& request = m.request;
+		int k = request._nparams;
+		if (k < HttpRequest::MAX_PATH_PARAMS)
+		{
+			HttpRequest::PathParam& param = request._params[k];
+			param.name = &node->param->segment;
+			param.start = int(s - m.base);
+			param.length = int(end - s);
+			request._nparams++;
+		}
+		if ((found = match(node->param, next, e, m)))
+			return found;
+		request._nparams = k;
+	}
+	if (node->wildcard && node->wildcard->routes.length() > 0)
+	{
+		if ((m.route = node->wildcard->route(m.method)) != NULL)
+		{
+			m.suffix = s;
+			return node->wildcard;
+		}
+		m.allowed(node->wildcard);
+	}
+	return NULL;
+}
+
+bool HttpRouter::dispatch(HttpRequest& request, HttpResponse& response)
+{
+	const char* path;
+	int n;
+	request.pathView(path, n);
+	request._nparams = 0;
+	if (n == 0 || path[0] != '/')
+		return false;
+	Match m(request.method(), request, path);
+	if (!match(_root, path + 1, path + n, m))
+	{
+		request._nparams = 0;
+		if (m.pathFound)
+		{
+			response.setCode(405);
+			response.setHeader("Allow", m.allow.join(", "));
+		}
+		return false;
+	}
+	if (m.suffix)
+		request._argument = String(m.suffix, int(path + n - m.suffix));
+	(*m.route->handler)(request, response);
+	return true;
+}
+
+}
@@ -8,6 +8,7 @@
 #include <asl/SocketServer.h>
 #include <asl/HttpServer.h>
 #include <asl/WebSocket.h>
+#include <asl/Thread.h>
 
 namespace asl {
 
@@ -16,12 +17,15 @@ bool verbose = false;
 HttpServer::HttpServer(int port)
 {
 	_requestStop = false;
+	_clientSpeaksFirst = true; // a pool gets an I/O thread for idle keep-alive connections
 	_proto = "HTTP/1.1";
 	_methods = "GET, POST, OPTIONS, PUT, DELETE, PATCH, HEAD";
 	if (port >= 0)
 		bind(port);
 	_wsserver = NULL;
+	_fileCache = NULL;
 	_cors = false;
+	_maxHead = 65536;
 	_mimetypes = split(
 		"css:text/css,"
 		"gif:image/gif,"
@@ -41,6 +45,27 @@ void HttpServer::addMimeType(const String& ext, const String& type)
 	_mimetypes[ext] = type;
 }
 
+/*
+Runs a WebSocket connection taken over from an event-driven HTTP server in its own thread.
+*/
+struct WsProcessThread : public Thread
+{
+	WebSocketServer* _server;
+	Socket _client;
+	Dic<> _headers;
+
+	WsProcessThread(WebSocketServer* svr, const Socket& cli, const Dic<>& headers):
+		_server(svr), _client(cli), _headers(headers)
+	{
+		start();
+	}
+	void run()
+	{
+		_server->process(_client, _headers);
+		delete this;
+	}
+};
+
 void HttpServer::serve(Socket client)
 {
 	while(client.waitInput())
@@ -48,53 +73,162 @@ void HttpServer::serve(Socket client)
 		if(client.disconnected())
 			break;
 
-		HttpRequest request(client);
-		if (client.error())
+		if (serveRequest(client) != CLIENT_KEEP)
 			break;
+	}
+}
+
+void HttpServer::reject(Socket client)
+{
+	client << String(_proto + " 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+}
+
+// the largest request body that an event-driven server without a pool receives in its I/O thread
+static const int MAX_BUFFERED_BODY = 65536;
 
-		if (request.header("Upgrade") == "websocket" && _wsserver)
+/*
+Serves a connection taken over from an I/O thread (in an event-driven server without a pool) in its own thread,
+for a request whose body may take long to receive, and then its next requests.
+*/
+struct HttpConnectionThread : public Thread
+{
+	HttpServer* _server;
+	Socket _client;
+
+	HttpConnectionThread(HttpServer* svr, const Socket& cli): _server(svr), _client(cli)
+	{
+		start();
+	}
+	void run()
+	{
+		if (_server->serveRequest(_client) == SocketServer::CLIENT_KEEP)
+			_server->serve(_client);
+		_client.close();
+		delete this;
+	}
+};
+
+/*
+Reads what the client has sent so far into its receive buffer without blocking and checks if it holds a full request
+head and its body. Requests with a chunked or large body are not received here but in a connection thread.
+*/
+int HttpServer::requestState(Socket& client)
+{
+	int n = client.available();
+	if (n > client.buffered() && !client.peek(min(n, _maxHead + MAX_BUFFERED_BODY)))
+		return REQUEST_BAD;
+	n = client.buffered();
+	if (n == 0)
+		return REQUEST_PARTIAL;
+	const char* p = (const char*)client.peek(n);
+	while (n > 0 && (*p == '\r' || *p == '\n')) // empty lines before a request
+	{
+		p++;
+		n--;
+	}
+	int end = HttpMessage::headEnd(p, n, 0);
+	if (!end)
+		return n >= _maxHead ? REQUEST_BAD : REQUEST_PARTIAL;
+	if (end > _maxHead)
+		return REQUEST_BAD;
+	HttpMessage head;
+	head.use(client);
+	head._head = String(p, end);
+	const char* eol = (const char*)memchr(p, '\n', end);
+	if (!head.parseHeaders(int(eol - p) + 1))
+		return REQUEST_BAD;
+	if (head.hasHeader("Transfer-Encoding"))
+		return REQUEST_LARGE;
+	int length = head.hasHeader("Content-Length") ? (int)head.header("Content-Length") : 0;
+	if (length < 0)
+		return REQUEST_BAD;
+	if (length > MAX_BUFFERED_BODY)
+		return REQUEST_LARGE;
+	return end + length <= n ? REQUEST_READY : REQUEST_PARTIAL;
+}
+
+/*
+In event-driven mode without a thread pool this runs in an I/O thread, so requests are only served once they have
+been fully received; a slow client just gets called again when more data arrives. Requests with a large or chunked
+body are handed to a thread of their own, so that reading them never blocks the I/O thread.
+*/
+int HttpServer::onInput(Socket client)
+{
+	if (client.disconnected())
+		return CLIENT_CLOSE;
+	if (!pooled())
+	{
+		switch (requestState(client))
 		{
-			if(verbose) printf("handing over to ws\n");
-			_wsserver->process(client, request.headers());
-			return;
+		case REQUEST_PARTIAL:
+			return client.error() ? CLIENT_CLOSE : CLIENT_KEEP;
+		case REQUEST_BAD:
+			return CLIENT_CLOSE;
+		case REQUEST_LARGE:
+			new HttpConnectionThread(this, client);
+			return CLIENT_DETACH;
 		}
-		HttpResponse response(request, _proto);
-		response.put("");
-		if (_cors && request.hasHeader("Origin"))
+	}
+	return serveRequest(client);
+}
+
+int HttpServer::serveRequest(Socket& client)
+{
+	HttpRequest request(client, _maxHead);
+	if (client.error() || request.method() == "") // failed, or the head was malformed or too large
+		return CLIENT_CLOSE;
+	client.setNoDelay(true); // responses are written with one call each
+
+	if (request.header("Upgrade") == "websocket" && _wsserver)
+	{
+		if(verbose) printf("handing over to ws\n");
+		if (eventDriven() || pooled()) // do not keep an I/O or pool thread busy
 		{
-			response.setHeader("Access-Control-Allow-Origin", "*");
+			new WsProcessThread(_wsserver, client, request.headers());
+			return CLIENT_DETACH;
 		}
-		if (!handleOptions(request, response))
-		{
+		_wsserver->process(client, request.headers());
+		return CLIENT_CLOSE;
+	}
+	HttpResponse response(request, _proto);
+	response.put("");
+	if (_cors && request.hasHeader("Origin"))
+	{
+		response.setHeader("Access-Control-Allow-Origin", "*");
+	}
+	if (!handleOptions(request, response))
+	{
+		if (_router.empty() || (!_router.dispatch(request, response) && response.code() != 405))
 			serve(request, response);
-			if (response.code() == 405)
-				response.setHeader("Allow", _methods);
+		if (response.code() == 405 && !response.hasHeader("Allow"))
+			response.setHeader("Allow", _methods);
 
-			if (response.containsFile())
+		if (response.containsFile())
+		{
+			File file((String)response.body());
+			if (!file.exists())
 			{
-				File file((String)response.body());
-				if (!file.exists())
-				{
-					response.setCode(404);
-					response.setHeader("Content-Type", "text/html");
-					response.put("<h1>Error</h1><p>File <b>" + file.name() + "</b> not found</p>");
-					continue;
-				}
-
-				String mime = _mimetypes.get(file.extension(), "text/plain");
-				response.setHeader("Date", Date::now().toString(Date::HTTP));
-				response.setHeader("Content-Type", mime);
-				if (!response.hasHeader("Cache-Control"))
-					response.setHeader("Cache-Control", "max-age=60, public");
-				response.putFile(file.path());
-			}
-			else
+				response.setCode(404);
+				response.setHeader("Content-Type", "text/html");
+				response.put("<h1>Error</h1><p>File <b>" + file.name() + "</b> not found</p>");
 				response.write();
+				return CLIENT_KEEP;
+			}
+
+			String mime = _mimetypes.get(file.extension(), "text/plain");
+			response.setHeader("Date", Date::now().toString(Date::HTTP));
+			response.setHeader("Content-Type", mime);
+			if (!response.hasHeader("Cache-Control"))
+				response.setHeader("Cache-Control", "max-age=60, public");
+			response.putFile(file.path());
 		}
-		
-		if(_proto=="HTTP/1.0" || request.header("Connection") == "close")
-			break;
+		else
+			response.write();
 	}
+
+	if(_proto=="HTTP/1.0" || request.header("Connection") == "close")
+		return CLIENT_CLOSE;
+	return CLIENT_KEEP;
 }
 
 void HttpServer::setRoot(const String& root)
@@ -102,6 +236,225 @@ void HttpServer::setRoot(const String& root)
 	_webroot = root;
 }
 
+/*
+An in-memory cache of static files for serveFile(). Each entry holds the file content, which a hit shares as the
+response body, and the values of its response headers, so a hit is sent with one vectored write of the header
+block and the content, and no file access. Entries are linked in order of use, most recent first, to evict the
+least recently used ones.
+*/
+struct HttpFileCache
+{
+	struct Entry
+	{
+		String path;
+		Array<byte> data, gzip;    // content, as is and precompressed
+		String type, etag, gzipEtag, lastModified;
+		Date modified;
+		Long size, gzipSize;       // gzipSize is -1 if there is no .gz file
+		double gzipTime;           // modification time of the .gz file
+		double checked;            // last time the files were checked for changes
+		Entry *prev, *next;
+		Long bytes() const { return data.length() + gzip.length(); }
+	};
+	struct Hit
+	{
+		Array<byte> data;
+		bool found, gzip, vary;
+		String type, etag, lastModified;
+		Date modified;
+	};
+	HttpServer* _server;
+	Mutex _mutex;
+	Map<String, Entry*> _entries;
+	Entry *_first, *_last;
+	Long _maxBytes, _maxFileSize;
+	HttpServer::FileCacheStats _stats;
+
+	HttpFileCache(HttpServer* server, Long maxBytes, Long maxFileSize) :
+		_server(server), _first(0), _last(0), _maxBytes(maxBytes), _maxFileSize(min(maxFileSize, maxBytes))
+	{}
+	~HttpFileCache()
+	{
+		_entries.destroy();
+	}
+	void unlink(Entry* e)
+	{
+		(e->prev ? e->prev->next : _first) = e->next;
+		(e->next ? e->next->prev : _last) = e->prev;
+	}
+	void pushFront(Entry* e)
+	{
+		e->prev = NULL;
+		e->next = _first;
+		(_first ? _first->prev : _last) = e;
+		_first = e;
+	}
+	void remove(Entry* e)
+	{
+		unlink(e);
+		_entries.remove(e->path);
+		_stats.bytes -= e->bytes();
+		_stats.files--;
+		delete e;
+	}
+	// adds an entry, which is deleted right away if it does not fit in the cache
+	void insert(Entry* e)
+	{
+		Entry** old = _entries.find(e->path);
+		if (old)
+			remove(*old);
+		_entries[e->path] = e;
+		pushFront(e);
+		_stats.bytes += e->bytes();
+		_stats.files++;
+		while (_stats.bytes > _maxBytes && _last != e)
+		{
+			remove(_last);
+			_stats.evictions++;
+		}
+		if (_stats.bytes > _maxBytes) // does not fit even alone
+			remove(e);
+	}
+	void select(Entry* e, bool gzip, Hit& hit)
+	{
+		hit.found = true;
+		hit.vary = e->gzip.length() > 0;
+		hit.gzip = gzip && hit.vary;
+		hit.data = hit.gzip ? e->gzip : e->data;
+		hit.type = e->type;
+		hit.etag = hit.gzip ? e->gzipEtag : e->etag;
+		hit.lastModified = e->lastModified;
+		hit.modified = e->modified;
+	}
+	// checks that the file and its .gz variant are as when the entry was loaded
+	static bool isCurrent(const Entry* e)
+	{
+		File file(e->path), gzfile(e->path + ".gz");
+		bool gz = gzfile.exists();
+		return file.exists() && file.size() == e->size && file.lastModified().time() == e->modified.time() &&
+			(gz ? gzfile.size() == e->gzipSize && gzfile.lastModified().time() == e->gzipTime : e->gzipSize < 0);
+	}
+	Entry* load(const String& path, double now);
+	bool serve(const String& path, HttpRequest& request, HttpResponse& response);
+};
+
+HttpServer::~HttpServer()
+{
+	shutdown();
+	delete _fileCache;
+}
+
+/*
+Reads a file and its precompressed variant and formats their header values, or returns null if the file does not
+exist or is too large.
+*/
+HttpFileCache::Entry* HttpFileCache::load(const String& path, double now)
+{
+	File file(path);
+	if (!file.exists() || file.isDirectory() || file.size() > _maxFileSize)
+		return NULL;
+	Long size = file.size();
+	Array<byte> content = file.content();
+	if (content.length() != size)
+		return NULL;
+	Entry* e = new Entry;
+	e->path = path;
+	e->size = size;
+	e->modified = file.lastModified();
+	e->checked = now;
+	e->etag = String(0, "\"%llx-%llx\"", (unsigned long long)size, (unsigned long long)e->modified.time());
+	e->gzipEtag = String(0, "\"%llx-%llx-gz\"", (unsigned long long)size, (unsigned long long)e->modified.time());
+	e->type = _server->_mimetypes.get(file.extension(), "text/plain");
+	e->lastModified = e->modified.toString(Date::HTTP);
+	File gzfile(path + ".gz");
+	e->gzipSize = gzfile.exists() ? gzfile.size() : -1;
+	e->gzipTime = e->gzipSize >= 0 ? gzfile.lastModified().time() : 0;
+	if (e->gzipSize >= 0 && e->gzipSize <= _maxFileSize && e->modified <= gzfile.lastModified())
+	{
+		e->gzip = gzfile.content();
+		if (e->gzip.length() != e->gzipSize)
+			e->gzip.clear();
+	}
+	e->data = content;
+	return e;
+}
+
+/*
+Responds to a request for a file from the cache, loading it if needed, or returns false if it cannot be cached.
+*/
+bool HttpFileCache::serve(const String& path, HttpRequest& request, HttpResponse& response)
+{
+	double now = Date::now().time();
+	bool gzip = request.header("Accept-Encoding").contains("gzip");
+	Hit hit;
+	hit.found = false;
+	{
+		Lock _(_mutex);
+		Entry** p = _entries.find(path);
+		Entry* e = p ? *p : NULL;
+		if (e && now - e->checked >= 1.0)
+		{
+			if (isCurrent(e))
+				e->checked = now;
+			else
+			{
+				remove(e);
+				e = NULL;
+			}
+		}
+		if (e)
+		{
+			unlink(e);
+			pushFront(e);
+			select(e, gzip, hit);
+			_stats.hits++;
+		}
+		else
+			_stats.misses++;
+	}
+	if (!hit.found)
+	{
+		Entry* e = load(path, now);
+		if (!e)
+			return false;
+		select(e, gzip, hit);
+		Lock _(_mutex);
+		insert(e);
+	}
+	String match = request.header("If-None-Match");
+	if (match ? match == hit.etag || match == "*" :
+		request.hasHeader("If-Modified-Since") && hit.modified <= Date(request.header("If-Modified-Since")) + 1.0)
+	{
+		response.setCode(304);
+		return true;
+	}
+	response.setHeader("Content-Type", hit.type);
+	response.setHeader("Last-Modified", hit.lastModified);
+	response.setHeader("ETag", hit.etag);
+	if (hit.vary)
+		response.setHeader("Vary", "Accept-Encoding");
+	if (hit.gzip)
+		response.setHeader("Content-Encoding", "gzip");
+	if (!response.hasHeader("Cache-Control"))
+		response.setHeader("Cache-Control", "max-age=60, public");
+	response.put(hit.data);
+	return true;
+}
+
+void HttpServer::setFileCache(Long maxBytes, Long maxFileSize)
+{
+	delete _fileCache;
+	_fileCache = (maxBytes > 0) ? new HttpFileCache(this, maxBytes, maxFileSize) : NULL;
+}
+
+HttpServer::FileCacheStats HttpServer::fileCacheStats() const
+{
+	if (!_fileCache)
+		return FileCacheStats();
+	Lock _(_fileCache->_mutex);
+	return _fileCache->_stats;
+}
+
 void HttpServer::serveFile(HttpRequest& request, HttpResponse& response)
 {
 	if (request.method() == "GET")
@@ -112,6 +465,8 @@ void HttpServer::serveFile(HttpRequest& request, HttpResponse& response)
 			path += "index.html";
 
 		String localpath = _webroot + path;
+		if (_fileCache && _fileCache->serve(localpath, request, response))
+			return;
 		File file(localpath);
 		if (file.isDirectory())
 		{
@@ -15,13 +15,23 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
 #endif
 
 #include <stdio.h>
 #include <string.h>
 #include <asl/Socket.h>
+#include <asl/File.h>
 
 #ifndef ASL_NOEXCEPT
 #define NET_ERROR(o) throw SocketException()
@@ -49,6 +59,37 @@ Sockets& Sockets::operator<<(Socket& s)
 
 int Sockets::waitInput(double t)
 {
+	changed.clear();
+	for (int i = 0; i < set.length(); i++) // data already buffered is input too
+	{
+		if (set[i].buffered() > 0)
+			changed << set[i];
+	}
+	if (changed.length() > 0)
+		return changed.length();
+#ifndef _WIN32
+	// poll() has no FD_SETSIZE limit on descriptor numbers
+	Array<pollfd> fds(set.length());
+	for (int i = 0; i < set.length(); i++)
+	{
+		if (set[i].handle() < 0)
+			return -1;
+		fds[i].fd = set[i].handle();
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	int r = poll(fds.ptr(), fds.length(), (int)(t * 1000));
+	if (r < 0)
+		return -1;
+	changed.clear();
+	for (int j = 0; j < set.length(); j++) {
+		if (set[j].handle() < 0)
+			return -1;
+		if (fds[j].revents != 0)
+			changed << set[j];
+	}
+	return changed.length();
+#else
 	fd_set rset;
 	struct timeval to;
 	to.tv_sec = (int)floor(t);
@@ -73,6 +114,7 @@ int Sockets::waitInput(double t)
 			changed << set[j];
 	}
 	return changed.length();
+#endif
 }
 
 bool Sockets::hasInput(Socket& s)
@@ -391,6 +433,8 @@ Socket_::Socket_()
 	_type = TCP;
 	_blocking = true;
 	_endian = NATIVEENDIAN;
+	_rbegin = _rend = 0;
+	_noDelay = _cork = false;
 }
 
 Socket_::Socket_(bool)
@@ -401,6 +445,8 @@ Socket_::Socket_(bool)
 	_type = TCP;
 	_blocking = false;
 	_endian = NATIVEENDIAN;
+	_rbegin = _rend = 0;
+	_noDelay = _cork = false;
 }
 
 Socket_::Socket_(int fd)
@@ -411,6 +457,8 @@ Socket_::Socket_(int fd)
 	_type = TCP;
 	_blocking = true;
 	_endian = NATIVEENDIAN;
+	_rbegin = _rend = 0;
+	_noDelay = _cork = false;
 }
 
 Socket_::~Socket_()
@@ -432,6 +480,7 @@ bool Socket_::init(bool force)
 void Socket_::close()
 {
 	verbose_print("socket close %i\n", _handle);
+	_rbegin = _rend = 0;
 	if(_handle >= 0)
 #ifndef _WIN32
 	::close(_handle);
@@ -496,6 +545,38 @@ bool Socket_::connect(const InetAddress& addr)
 	return ::connect(_handle, (sockaddr*)addr.ptr(), addr.length()) == 0;
 }
 
+bool Socket_::startConnect(const InetAddress& addr)
+{
+	if (addr.length() == 0)
+		return false;
+	bool force = _family != addr.type();
+	_family = addr.type();
+	init(force);
+#ifdef _WIN32
+	u_long nonblocking = 1;
+	ioctlsocket(_handle, FIONBIO, &nonblocking);
+	return ::connect(_handle, (sockaddr*)addr.ptr(), addr.length()) == 0 || WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	fcntl(_handle, F_SETFL, fcntl(_handle, F_GETFL, 0) | O_NONBLOCK);
+	return ::connect(_handle, (sockaddr*)addr.ptr(), addr.length()) == 0 || errno == EINPROGRESS;
+#endif
+}
+
+bool Socket_::finishConnect()
+{
+	int error = 0;
+	socklen_t n = sizeof(error);
+	if (getsockopt(_handle, SOL_SOCKET, SO_ERROR, (char*)&error, &n) != 0)
+		error = -1;
+#ifdef _WIN32
+	u_long nonblocking = 0;
+	ioctlsocket(_handle, FIONBIO, &nonblocking);
+#else
+	fcntl(_handle, F_SETFL, fcntl(_handle, F_GETFL, 0) & ~O_NONBLOCK);
+#endif
+	return error == 0;
+}
+
 InetAddress Socket_::remoteAddress() const
 {
 	InetAddress a(_family);
@@ -528,7 +609,7 @@ void Socket::enableBroadcast(bool on)
 	setOption(SOL_SOCKET, SO_BROADCAST, on ? 1ul : 0);
 }
 
-int Socket_::available()
+int Socket_::availableRaw()
 {
 	if (_error || _handle < 0)
 		return -1;
@@ -544,21 +625,141 @@ int Socket_::available()
 		return -1;
 }
 
+int Socket_::readRaw(void* data, int size)
+{
+#ifdef _WIN32
+	return recv(_handle, (char*)data, size, 0);
+#else
+	return (int)::read(_handle, data, size);
+#endif
+}
+
+int Socket_::available()
+{
+	int n = availableRaw();
+	return (n < 0) ? (buffered() > 0 ? buffered() : n) : n + buffered();
+}
+
+// the receive buffer starts small and grows while reads fill it, or when peek() needs more
+static const int RBUF_MIN = 2048, RBUF_MAX = 16384;
+
+/*
+Reads once from the system into the free end of the receive buffer, moving pending data to the front first if
+needed. Returns the number of bytes read.
+*/
+int Socket_::fill()
+{
+	if (_rbuf.length() == 0)
+		_rbuf.resize(RBUF_MIN);
+	if (_rbegin == _rend)
+		_rbegin = _rend = 0;
+	else if (_rend == _rbuf.length() && _rbegin > 0)
+	{
+		memmove(_rbuf.ptr(), _rbuf.ptr() + _rbegin, _rend - _rbegin);
+		_rend -= _rbegin;
+		_rbegin = 0;
+	}
+	if (_rend == _rbuf.length())
+		return 0;
+	int space = _rbuf.length() - _rend;
+	int n = readRaw(_rbuf.ptr() + _rend, space);
+	if (n > 0)
+	{
+		_rend += n;
+		if (n == space && _rbuf.length() < RBUF_MAX) // there may be more to read
+			_rbuf.resize(_rbuf.length() * 2);
+	}
+	return n;
+}
+
+void Socket_::releaseBuffer()
+{
+	if (_rbegin == _rend)
+	{
+		_rbuf = Array<byte>();
+		_rbegin = _rend = 0;
+	}
+}
+
+const byte* Socket_::peek(int n)
+{
+	if (n > _rbuf.length())
+	{
+		int size = RBUF_MIN;
+		while (size < n)
+			size *= 2;
+		_rbuf.resize(size);
+	}
+	while (buffered() < n)
+	{
+		if (_rbegin > 0 && _rbegin + n > _rbuf.length())
+		{
+			memmove(_rbuf.ptr(), _rbuf.ptr() + _rbegin, _rend - _rbegin);
+			_rend -= _rbegin;
+			_rbegin = 0;
+		}
+		if (fill() <= 0)
+		{
+			_error = true;
+			return NULL;
+		}
+	}
+	return _rbuf.ptr() + _rbegin;
+}
+
+const char* Socket_::readLineView(int& length)
+{
+	int scanned = 0;
+	while (1)
+	{
+		const byte* p = _rbuf.ptr() + _rbegin;
+		const byte* nl = (const byte*)memchr(p + scanned, '\n', buffered() - scanned);
+		if (nl)
+		{
+			length = int(nl - p);
+			_rbegin += length + 1;
+			return (const char*)p;
+		}
+		scanned = buffered();
+		if (scanned > 8000 || !peek(scanned + 1))
+		{
+			_error = true;
+			length = 0;
+			return NULL;
+		}
+	}
+}
+
 String Socket_::readLine()
 {
-	char c;
 	String s;
-	if (available()>0 || waitInput()) {
+	if (!isBuffered())
+	{
+		char c;
+		if (available() > 0 || waitInput()) {
+			while (readRaw(&c, 1) == 1 && c != '\n')
+				s += c;
+		}
+		return s;
+	}
+	if (buffered() > 0 || available() > 0 || waitInput()) {
 		while (1) {
-			int n = read(&c, 1);
-			if (n <= 0 || c == '\n' || _error)
+			if (buffered() == 0 && fill() <= 0) {
+				_error = true;
 				break;
-			if (s.length() > 8000) {
+			}
+			const byte* p = _rbuf.ptr() + _rbegin;
+			const byte* nl = (const byte*)memchr(p, '\n', buffered());
+			int n = nl ? int(nl - p) : buffered();
+			if (s.length() + n > 8000) {
 				_error = true;
 				s = "";
 				break;
 			}
-			s += c;
+			s.append((const char*)p, n);
+			_rbegin += nl ? n + 1 : n;
+			if (nl)
+				break;
 		}
 	}
 	return s;
@@ -566,31 +767,38 @@ String Socket_::readLine()
 
 int Socket_::read(void* data, int size)
 {
-	if(_blocking) {
 	int s = 0;
+	if (isBuffered() && buffered() > 0)
+	{
+		s = min(size, buffered());
+		memcpy(data, _rbuf.ptr() + _rbegin, s);
+		_rbegin += s;
+		if (s == size || !_blocking)
+			return s;
+	}
+	if(_blocking) {
 	do {
-#ifdef _WIN32
-		int n = recv(_handle, (char*)data, size, 0);
-#else
-		int n = ::read(_handle, (char*)data, size);
-#endif
+		int n;
+		if (isBuffered() && size - s < 1024) // small reads go through the buffer
+		{
+			if ((n = fill()) > 0) {
+				n = min(n, size - s);
+				memcpy((char*)data + s, _rbuf.ptr() + _rbegin, n);
+				_rbegin += n;
+			}
+		}
+		else
+			n = readRaw((char*)data + s, size - s);
 		if (n <= 0) {
 			_error = true;
 			break;
 		}
-		data = (char*)data + n;
 		s += n;
-		size -= n;
 	} while (s < size);
 	return s;
 	}
-	else {
-#ifdef _WIN32
-		return recv(_handle, (char*)data, size, 0);
-#else
-		return ::read(_handle, data, size);
-#endif
-	}
+	else
+		return readRaw(data, size);
 }
 
 int Socket_::write(const void* data, int n)
@@ -607,6 +815,155 @@ int Socket_::write(const void* data, int n)
 #endif
 }
 
+int Socket_::tryWrite(const void* data, int n)
+{
+#ifdef _WIN32
+	u_long nonblocking = 1;
+	ioctlsocket(_handle, FIONBIO, &nonblocking);
+	int m = ::send(_handle, (const char*)data, n, 0);
+	bool wouldBlock = m < 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+	nonblocking = 0;
+	ioctlsocket(_handle, FIONBIO, &nonblocking);
+#else
+	int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	int m = (int)::send(_handle, data, n, flags);
+	bool wouldBlock = m < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+#endif
+	return wouldBlock ? 0 : m;
+}
+
+void Socket_::shutdown()
+{
+	if (_handle >= 0)
+#ifdef _WIN32
+		::shutdown(_handle, SD_BOTH);
+#else
+		::shutdown(_handle, SHUT_RDWR);
+#endif
+}
+
+int Socket_::write(const IoVec* parts, int n)
+{
+	int total = 0;
+#ifndef _WIN32
+	int i = 0, offset = 0; // first part not fully written and bytes of it already written
+	while (i < n)
+	{
+		iovec v[64];
+		int k = 0;
+		for (int j = i; j < n && k < 64; j++, k++)
+		{
+			v[k].iov_base = (char*)parts[j].data + (j == i ? offset : 0);
+			v[k].iov_len = parts[j].length - (j == i ? offset : 0);
+		}
+		int m = (int)::writev(_handle, v, k);
+		if (m < 0 && errno == EINTR)
+			continue;
+		if (m <= 0)
+			return total > 0 ? total : m;
+		total += m;
+		while (i < n && m >= parts[i].length - offset)
+		{
+			m -= parts[i].length - offset;
+			offset = 0;
+			i++;
+		}
+		offset += m;
+	}
+#else
+	for (int i = 0; i < n; i++)
+	{
+		int m = write(parts[i].data, parts[i].length);
+		if (m > 0)
+			total += m;
+		if (m != parts[i].length)
+			return total > 0 ? total : m;
+	}
+#endif
+	return total;
+}
+
+void Socket_::setNoDelay(bool on)
+{
+	if (_noDelay != on && _type == TCP && setOption(IPPROTO_TCP, TCP_NODELAY, on ? 1 : 0))
+		_noDelay = on;
+}
+
+void Socket_::setCork(bool on)
+{
+#ifdef TCP_CORK
+	if (_cork != on && _type == TCP && setOption(IPPROTO_TCP, TCP_CORK, on ? 1 : 0))
+		_cork = on;
+#endif
+}
+
+/*
+Sends a file region by reading it in blocks and writing them to the socket.
+*/
+Long Socket_::copyFile(const String& path, Long offset, Long count)
+{
+	File file(path, File::READ);
+	if (!file)
+		return -1;
+	if (count < 0)
+		count = file.size() - offset;
+	if (offset > 0)
+		file.seek(offset);
+	Long sent = 0;
+	char buffer[16384];
+	while (sent < count)
+	{
+		int n = file.read(buffer, (int)min(count - sent, (Long)sizeof(buffer)));
+		if (n <= 0)
+			break;
+		int m = write(buffer, n);
+		if (m > 0)
+			sent += m;
+		if (m != n)
+			break;
+	}
+	return sent;
+}
+
+Long Socket_::sendFile(const String& path, Long offset, Long count)
+{
+#ifdef __linux__
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (count < 0)
+	{
+		struct stat st;
+		count = (fstat(fd, &st) == 0) ? st.st_size - offset : 0;
+	}
+	off_t off = (off_t)offset;
+	Long sent = 0;
+	while (sent < count)
+	{
+		ssize_t n = ::sendfile(_handle, fd, &off, (size_t)min(count - sent, (Long)0x40000000));
+		if (n <= 0)
+		{
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && sent == 0 && (errno == EINVAL || errno == ENOSYS)) // not supported by this socket or file
+			{
+				::close(fd);
+				return copyFile(path, offset, count);
+			}
+			break;
+		}
+		sent += n;
+	}
+	::close(fd);
+	return sent;
+#else
+	return copyFile(path, offset, count);
+#endif
+}
+
 Array<byte> Socket_::read(int n)
 {
 	Array<byte> a((n < 0)? available() : n);
@@ -616,8 +973,14 @@ Array<byte> Socket_::read(int n)
 
 void Socket_::skip(int n)
 {
-	Array<byte> a(n);
-	read(a.ptr(), a.length());
+	int m = min(n, buffered());
+	_rbegin += m;
+	n -= m;
+	if (n > 0)
+	{
+		Array<byte> a(n);
+		read(a.ptr(), a.length());
+	}
 }
 
 bool Socket_::disconnected()
@@ -626,10 +989,17 @@ bool Socket_::disconnected()
 }
 
 bool Socket_::waitInput(double t)
+{
+	if (buffered() > 0)
+		return true;
+	return waitInputRaw(t);
+}
+
+bool Socket_::waitInputRaw(double t)
 {
 	if (_handle < 0)
 		return false;
-	int a = available();
+	int a = availableRaw();
 	if (a > 0)
 		return true;
 	if (a < 0)
@@ -637,6 +1007,14 @@ bool Socket_::waitInput(double t)
 		_error = true;
 		return true;
 	}
+#ifndef _WIN32
+	pollfd fd;
+	fd.fd = handle();
+	fd.events = POLLIN;
+	fd.revents = 0;
+	if (poll(&fd, 1, (int)(t * 1000)) >= 0)
+		return fd.revents != 0;
+#else
 	fd_set rset;
 	struct timeval to;
 	to.tv_sec = (int)floor(t);
@@ -645,6 +1023,7 @@ bool Socket_::waitInput(double t)
 	FD_SET(handle(), &rset);
 	if(select(handle()+1, &rset, 0, 0, &to) >= 0)
 		return FD_ISSET(handle(), &rset)!=0;
+#endif
 	_error = true;
 	return true;
 }
@@ -654,6 +1033,7 @@ bool Socket_::waitInput(double t)
 PacketSocket_::PacketSocket_() : Socket_(false)
 {
 	_type = PACKET;
+	_timestamps = false;
 	_family = InetAddress::IPv4;
 #ifdef _WIN32
 	if(!g_wsaStarted) startWSA();
@@ -663,6 +1043,7 @@ PacketSocket_::PacketSocket_() : Socket_(false)
 PacketSocket_::PacketSocket_(int fd) : Socket_(fd)
 {
 	_type = PACKET;
+	_timestamps = false;
 }
 
 PacketSocket_::~PacketSocket_()
@@ -698,6 +1079,176 @@ void PacketSocket_::sendTo(const InetAddress& to, const void* data, int n)
 	sendto(_handle, (const char*)data, n, 0, (sockaddr*)to.ptr(), to.length());
 }
 
+bool PacketSocket_::enableTimestamps()
+{
+	if (_handle < 0)
+		init();
+#ifdef SO_TIMESTAMPNS
+	_timestamps = setOption(SOL_SOCKET, SO_TIMESTAMPNS, 1);
+#endif
+	return _timestamps;
+}
+
+#ifdef __linux__
+
+int PacketSocket_::readBatch(PacketBatch& b)
+{
+	if (_handle < 0)
+		init();
+	int count = b.capacity();
+	mmsghdr* msgs = (mmsghdr*)b.headers(count * (sizeof(mmsghdr) + sizeof(iovec)));
+	iovec* iovs = (iovec*)(msgs + count);
+	memset(msgs, 0, count * sizeof(mmsghdr));
+	for (int i = 0; i < count; i++)
+	{
+		iovs[i].iov_base = b.data(i);
+		iovs[i].iov_len = b._maxSize;
+		msghdr& h = msgs[i].msg_hdr;
+		h.msg_name = b._addrs.ptr() + i * PacketBatch::ADDR_SIZE;
+		h.msg_namelen = PacketBatch::ADDR_SIZE;
+		h.msg_iov = &iovs[i];
+		h.msg_iovlen = 1;
+		if (_timestamps)
+		{
+			h.msg_control = b._control.ptr() + i * PacketBatch::CONTROL_SIZE;
+			h.msg_controllen = PacketBatch::CONTROL_SIZE;
+		}
+	}
+	int n = recvmmsg(_handle, msgs, count, MSG_WAITFORONE, NULL);
+	b._n = max(n, 0);
+	for (int i = 0; i < b._n; i++)
+	{
+		msghdr& h = msgs[i].msg_hdr;
+		b._sizes[i] = msgs[i].msg_len;
+		b._addrLens[i] = h.msg_namelen;
+		b._times[i] = 0;
+		for (cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c))
+		{
+#ifdef SCM_TIMESTAMPNS
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS)
+			{
+				timespec t;
+				memcpy(&t, CMSG_DATA(c), sizeof(t));
+				b._times[i] = t.tv_sec + 1e-9 * t.tv_nsec;
+			}
+#endif
+		}
+	}
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		return -1;
+	return b._n;
+}
+
+int PacketSocket_::sendBatch(PacketBatch& b)
+{
+	if (_handle < 0)
+		init();
+	int count = b._n;
+	mmsghdr* msgs = (mmsghdr*)b.headers(count * (sizeof(mmsghdr) + sizeof(iovec)));
+	iovec* iovs = (iovec*)(msgs + count);
+	memset(msgs, 0, count * sizeof(mmsghdr));
+	for (int i = 0; i < count; i++)
+	{
+		iovs[i].iov_base = b.data(i);
+		iovs[i].iov_len = b._sizes[i];
+		msghdr& h = msgs[i].msg_hdr;
+		h.msg_name = b._addrs.ptr() + i * PacketBatch::ADDR_SIZE;
+		h.msg_namelen = b._addrLens[i];
+		h.msg_iov = &iovs[i];
+		h.msg_iovlen = 1;
+	}
+	int sent = 0;
+	while (sent < count)
+	{
+		int n = sendmmsg(_handle, msgs + sent, count - sent, 0);
+		if (n <= 0)
+			break;
+		sent += n;
+	}
+	return sent;
+}
+
+#else
+
+int PacketSocket_::readBatch(PacketBatch& b)
+{
+	if (_handle < 0)
+		init();
+	b._n = 0;
+	while (b._n < b.capacity())
+	{
+		if (b._n > 0 && available() <= 0)
+			break;
+		int i = b._n;
+		socklen_t len = PacketBatch::ADDR_SIZE;
+		int n = recvfrom(_handle, (char*)b.data(i), b._maxSize, 0, (sockaddr*)(b._addrs.ptr() + i * PacketBatch::ADDR_SIZE), &len);
+		if (n < 0)
+		{
+			if (b._n > 0)
+				break;
+#ifdef _WIN32
+			return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+#else
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+#endif
+		}
+		b._sizes[i] = n;
+		b._addrLens[i] = len;
+		b._times[i] = 0;
+		b._n++;
+	}
+	return b._n;
+}
+
+int PacketSocket_::sendBatch(PacketBatch& b)
+{
+	if (_handle < 0)
+		init();
+	int sent = 0;
+	for (; sent < b._n; sent++)
+	{
+		if (sendto(_handle, (const char*)b.data(sent), b._sizes[sent], 0,
+			(sockaddr*)(b._addrs.ptr() + sent * PacketBatch::ADDR_SIZE), b._addrLens[sent]) < 0)
+			break;
+	}
+	return sent;
+}
+
+#endif
+
+PacketBatch::PacketBatch(int count, int maxSize) :
+	_n(0),
+	_maxSize(maxSize),
+	_buffers(count * maxSize),
+	_sizes(count),
+	_addrs(count * ADDR_SIZE),
+	_addrLens(count),
+	_times(count),
+	_control(count * CONTROL_SIZE)
+{
+}
+
+InetAddress PacketBatch::address(int i) const
+{
+	const sockaddr* sa = (const sockaddr*)(_addrs.ptr() + i * ADDR_SIZE);
+	InetAddress a(sa->sa_family == AF_INET6 ? InetAddress::IPv6 : InetAddress::IPv4);
+	memcpy(a.ptr(), sa, min((int)a.length(), _addrLens[i]));
+	return a;
+}
+
+bool PacketBatch::add(const InetAddress& to, const void* data, int n)
+{
+	if (_n >= capacity() || n > _maxSize || (int)to.length() > ADDR_SIZE)
+		return false;
+	memcpy(this->data(_n), data, n);
+	_sizes[_n] = n;
+	memcpy(_addrs.ptr() + _n * ADDR_SIZE, to.ptr(), to.length());
+	_addrLens[_n] = to.length();
+	_times[_n] = 0;
+	_n++;
+	return true;
+}
+
 #ifndef _WIN32
 
 // LocalSocket (UNIX)
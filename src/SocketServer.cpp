@@ -1,10 +1,17 @@
 #include <asl/SocketServer.h>
 #include <asl/Thread.h>
+#include <asl/HashMap.h>
 #ifdef ASL_TLS
 #include <asl/TlsSocket.h>
 #endif
 #include <stdio.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#define ASL_EPOLL
+#endif
+
 namespace asl {
 
 struct SockClientThread : public Thread
@@ -39,20 +46,300 @@ struct SockServerThread : public Thread
 	}
 };
 
+/*
+A fixed set of worker threads taking clients from a bounded queue. A job is either a new connection (reactor is
+NULL) to be served with `serve()` or a client with input from an event-driven reactor.
+*/
+struct SockWorkerPool
+{
+	struct Job
+	{
+		Socket client;
+		SockReactor* reactor;
+		Job() : client((Socket::Ptr)NULL), reactor(NULL) {}
+	};
+	struct Worker : public Thread
+	{
+		SockWorkerPool* _pool;
+		Worker(SockWorkerPool* pool) : _pool(pool) {}
+		void run() { _pool->work(); }
+	};
+
+	SocketServer* _server;
+	Array<Worker*> _workers;
+	Array<Job> _queue;
+	int _head, _count;
+	bool _stop;
+	Mutex _mutex;
+	Condition _notEmpty, _notFull;
+
+	SockWorkerPool(SocketServer* svr, int threads, int queueSize) :
+		_server(svr), _queue(max(queueSize, 1)), _head(0), _count(0), _stop(false)
+	{
+		_notEmpty.use(_mutex);
+		_notFull.use(_mutex);
+		for (int i = 0; i < threads; i++)
+		{
+			_workers << new Worker(this);
+			_workers.last()->start();
+		}
+	}
+	~SockWorkerPool()
+	{
+		_mutex.lock();
+		_stop = true;
+		_notEmpty.signal();
+		_notFull.signal();
+		_mutex.unlock();
+		foreach(Worker* worker, _workers)
+		{
+			worker->join();
+			delete worker;
+		}
+	}
+	/*
+	Queues a client, waiting for room if `wait` is true; returns false if the queue is full (or the pool stopping)
+	*/
+	bool post(const Socket& client, SockReactor* reactor, bool wait)
+	{
+		Lock _(_mutex);
+		while (_count == _queue.length())
+		{
+			if (!wait || _stop || _server->_requestStop)
+				return false;
+			_notFull.wait(0.5);
+		}
+		if (_stop)
+			return false;
+		Job& job = _queue[(_head + _count) % _queue.length()];
+		job.client = client;
+		job.reactor = reactor;
+		_count++;
+		_notEmpty.signal();
+		return true;
+	}
+	void work()
+	{
+		_mutex.lock();
+		while (!_stop)
+		{
+			if (_count == 0)
+			{
+				_notEmpty.wait(0.5);
+				continue;
+			}
+			Job job = _queue[_head];
+			_queue[_head] = Job();
+			_head = (_head + 1) % _queue.length();
+			_count--;
+			_notFull.signal();
+			_mutex.unlock();
+			_server->runJob(job.reactor, job.client);
+			_mutex.lock();
+		}
+		_mutex.unlock();
+	}
+};
+
+#ifdef ASL_EPOLL
+
+/*
+An I/O thread of the event-driven mode: watches a set of client connections with epoll. Clients are registered
+with EPOLLONESHOT so a client is never dispatched twice at the same time and must be re-armed after each event.
+*/
+struct SockReactor : public Thread
+{
+	SocketServer* _server;
+	int _epoll;
+	HashMap<int, Socket> _clients;
+	Mutex _mutex;
+
+	SockReactor(SocketServer* svr) : _server(svr)
+	{
+		_epoll = epoll_create1(EPOLL_CLOEXEC);
+	}
+	~SockReactor()
+	{
+		if (_epoll >= 0)
+			::close(_epoll);
+	}
+	bool watch(Socket& client, int op)
+	{
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		ev.data.fd = client.handle();
+		return epoll_ctl(_epoll, op, client.handle(), &ev) == 0;
+	}
+	void add(Socket& client)
+	{
+		{
+			Lock _(_mutex);
+			_clients[client.handle()] = client;
+		}
+		if (!watch(client, EPOLL_CTL_ADD))
+			remove(client, true);
+	}
+	void rearm(Socket& client)
+	{
+		if (!watch(client, EPOLL_CTL_MOD))
+			remove(client, true);
+	}
+	void remove(Socket& client, bool close)
+	{
+		int fd = client.handle();
+		if (fd < 0)
+			return;
+		epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, NULL);
+		{
+			Lock _(_mutex);
+			_clients.remove(fd);
+		}
+		if (close)
+			client.close();
+	}
+	void run()
+	{
+		const int MAX_EVENTS = 64;
+		epoll_event events[MAX_EVENTS];
+		while (!_server->_requestStop)
+		{
+			int n = epoll_wait(_epoll, events, MAX_EVENTS, 500);
+			for (int i = 0; i < n; i++)
+			{
+				Socket client((Socket::Ptr)NULL);
+				{
+					Lock _(_mutex);
+					Socket* c = _clients.find(events[i].data.fd);
+					if (c)
+						client = *c;
+				}
+				if (client)
+					_server->onReady(this, client);
+			}
+		}
+		Lock _(_mutex);
+		foreach(Socket& client, _clients)
+			client.close();
+		_clients.clear();
+	}
+};
+
+#else
+
+struct SockReactor : public Thread
+{
+	void add(Socket&) {}
+};
+
+#endif
+
 SocketServer::SocketServer()
 {
 	_thread = NULL;
 	_requestStop = false;
 	_sequential = false;
 	_running = false;
+	_ioThreads = 0;
+	_nextReactor = 0;
+	_pool = NULL;
+	_poolThreads = 0;
+	_poolQueue = 0;
+	_overload = OVERLOAD_REJECT;
+	_clientSpeaksFirst = false;
 }
 
 SocketServer::~SocketServer()
 {
+	shutdown();
+}
+
+/*
+The I/O threads are joined before the pool is deleted, as they may be posting clients to it
+*/
+void SocketServer::shutdown()
+{
+	_requestStop = true;
 	if(_thread) {
 		_thread->kill();
 		delete _thread;
+		_thread = NULL;
+	}
+	foreach(SockReactor* reactor, _reactors)
+	{
+		reactor->join();
+		delete reactor;
+	}
+	_reactors.clear();
+	delete _pool;
+	_pool = NULL;
+}
+
+bool SocketServer::ownThread() const
+{
+	if (_thread && _thread->isCurrent())
+		return true;
+	for (int i = 0; i < _reactors.length(); i++)
+		if (_reactors[i]->isCurrent())
+			return true;
+	if (_pool)
+		for (int i = 0; i < _pool->_workers.length(); i++)
+			if (_pool->_workers[i]->isCurrent())
+				return true;
+	return false;
+}
+
+void SocketServer::setThreadPool(int threads, int queueSize, OverloadPolicy policy)
+{
+	_poolThreads = threads;
+	_poolQueue = queueSize;
+	_overload = policy;
+}
+
+bool SocketServer::enqueue(const Socket& client, SockReactor* reactor)
+{
+	if (_pool->post(client, reactor, _overload == OVERLOAD_BLOCK))
+		return true;
+	if (!_requestStop)
+		reject(client);
+	return false;
+}
+
+void SocketServer::runJob(SockReactor* reactor, Socket& client)
+{
+	if (reactor)
+		dispatch(reactor, client);
+	else
+		serve(client);
+}
+
+void SocketServer::onReady(SockReactor* reactor, Socket& client)
+{
+#ifdef ASL_EPOLL
+	if (!_pool)
+		dispatch(reactor, client);
+	else if (!enqueue(client, reactor))
+		reactor->remove(client, true);
+#endif
+}
+
+void SocketServer::dispatch(SockReactor* reactor, Socket& client)
+{
+#ifdef ASL_EPOLL
+	int status, left;
+	// epoll does not know about data already in the receive buffer (e.g. pipelined requests), but stop if
+	// onInput() left it there waiting for more
+	do {
+		left = client.buffered();
+		status = onInput(client);
+	} while (status == CLIENT_KEEP && !client.error() && client.buffered() > 0 && client.buffered() != left);
+	if (status == CLIENT_KEEP && !client.error())
+	{
+		client.releaseBuffer(); // an idle connection keeps no buffer
+		reactor->rearm(client);
 	}
+	else
+		reactor->remove(client, status != CLIENT_DETACH);
+#endif
 }
 
 bool SocketServer::bind(const String& ip, int port)
@@ -99,6 +386,20 @@ void SocketServer::startLoop()
 {
 	int n;
 	_running = true;
+	if (_poolThreads > 0 && !_pool)
+		_pool = new SockWorkerPool(this, _poolThreads, _poolQueue);
+#ifdef ASL_EPOLL
+	// workers blocked waiting for the next message of idle clients would soon all be taken
+	int ioThreads = (_ioThreads == 0 && _pool && _clientSpeaksFirst) ? 1 : _ioThreads;
+	if (ioThreads > 0 && _reactors.length() == 0)
+	{
+		for (int i = 0; i < ioThreads; i++)
+		{
+			_reactors << new SockReactor(this);
+			_reactors.last()->start();
+		}
+	}
+#endif
 	do
 	{
 		if ((n = _sockets.waitInput(10)) > 0)
@@ -106,7 +407,16 @@ void SocketServer::startLoop()
 			for (int i = 0; i < n; i++)
 			{
 				Socket client = _sockets.activeAt(i).accept();
-				if (_sequential) {
+				if (client.handle() < 0)
+					continue;
+				if (_reactors.length() > 0) {
+					_reactors[_nextReactor++ % _reactors.length()]->add(client);
+				}
+				else if (_pool) {
+					if (!enqueue(client, NULL))
+						client.close();
+				}
+				else if (_sequential) {
 					serve(client);
 					client.close();
 				}
@@ -134,10 +444,16 @@ void SocketServer::start(bool nonblocking)
 		startLoop();
 }
 
+/*
+From one of the server's threads (e.g. a `serve()` that stops the server) it cannot wait for them, so the rest is
+left to the destructor
+*/
 void SocketServer::stop()
 {
 	_requestStop = true;
 	_sockets.close();
+	if (!ownThread())
+		shutdown();
 }
 
 #ifdef ASL_TLS
@@ -0,0 +1,257 @@
+// Copyright(c) 1999-2018 ASL author
+// Licensed under the MIT License (http://opensource.org/licenses/MIT)
+
+#include <asl/TaskPool.h>
+#include <asl/Thread.h>
+
+#ifdef _MSC_VER
+#define ASL_THREAD_LOCAL __declspec(thread)
+#else
+#define ASL_THREAD_LOCAL __thread
+#endif
+
+namespace asl {
+
+/*
+A double-ended queue of tasks, as a ring buffer whose size is a power of 2. The owner adds and takes tasks at the
+tail, and other threads steal from the head.
+*/
+struct TaskQueue
+{
+	Mutex mutex;
+	Array<Task*> items;
+	volatile int head, tail;
+	TaskQueue() : items(64), head(0), tail(0) {}
+	bool empty() const { return head == tail; }
+	void push(Task* t)
+	{
+		Lock _(mutex);
+		int n = items.length();
+		if (tail - head == n)
+		{
+			Array<Task*> a(2 * n);
+			for (int i = 0; i < n; i++)
+				a[i] = items[(head + i) & (n - 1)];
+			items = a;
+			head = 0;
+			tail = n;
+			n *= 2;
+		}
+		items[tail & (n - 1)] = t;
+		tail = tail + 1;
+	}
+	Task* pop()
+	{
+		if (empty())
+			return 0;
+		Lock _(mutex);
+		if (empty())
+			return 0;
+		tail = tail - 1;
+		return items[tail & (items.length() - 1)];
+	}
+	Task* steal()
+	{
+		if (empty())
+			return 0;
+		Lock _(mutex);
+		if (empty())
+			return 0;
+		Task* t = items[head & (items.length() - 1)];
+		head = head + 1;
+		return t;
+	}
+};
+
+struct TaskWorker : public Thread
+{
+	TaskScheduler* scheduler;
+	int index;
+	TaskWorker(TaskScheduler* s, int i) : scheduler(s), index(i) {}
+	void run();
+};
+
+static ASL_THREAD_LOCAL TaskScheduler* currentScheduler = 0;
+static ASL_THREAD_LOCAL int currentWorker = -1;
+
+/*
+The state of a TaskPool: one queue per worker plus a shared queue (the last one) for tasks added from other
+threads. Idle workers sleep on a semaphore that is posted when tasks are added and some worker is idle.
+*/
+struct TaskScheduler
+{
+	Array<TaskQueue*> queues;
+	Array<TaskWorker*> workers;
+	AtomicCount queued;
+	AtomicCount idle;
+	Semaphore wakeup;
+	volatile bool stop;
+
+	TaskScheduler(int n) : stop(false)
+	{
+		for (int i = 0; i <= n; i++)
+			queues << new TaskQueue();
+		for (int i = 0; i < n; i++)
+			workers << new TaskWorker(this, i);
+		for (int i = 0; i < n; i++)
+			workers[i]->start();
+	}
+	~TaskScheduler()
+	{
+		stop = true;
+		wakeup.post(workers.length());
+		for (int i = 0; i < workers.length(); i++)
+		{
+			workers[i]->join();
+			delete workers[i];
+		}
+		for (int i = 0; i < queues.length(); i++)
+		{
+			while (Task* t = queues[i]->pop())
+			{
+				TaskGroup* g = t->_group;
+				delete t;
+				if (g)
+					g->finished();
+			}
+			delete queues[i];
+		}
+	}
+	int self() const { return currentScheduler == this ? currentWorker : -1; }
+
+	void push(Task* t)
+	{
+		int i = self();
+		queues[i >= 0 ? i : workers.length()]->push(t);
+		++queued;
+		if (idle > 0)
+			wakeup.post();
+	}
+
+	Task* next(int i)
+	{
+		int n = workers.length();
+		Task* t = i >= 0 ? queues[i]->pop() : 0;
+		if (!t)
+			t = queues[n]->steal();
+		for (int j = 1; !t && j <= n; j++)
+			t = queues[(i + j + n) % n]->steal();
+		if (t)
+			--queued;
+		return t;
+	}
+
+	static void execute(Task* t)
+	{
+		TaskGroup* g = t->_group;
+		t->run();
+		delete t;
+		if (g)
+			g->finished();
+	}
+
+	void work(int i)
+	{
+		currentScheduler = this;
+		currentWorker = i;
+		while (!stop)
+		{
+			if (Task* t = next(i))
+			{
+				execute(t);
+				continue;
+			}
+			for (int k = 0; k < 32 && queued == 0 && !stop; k++)
+				yieldThread();
+			if (queued > 0)
+				continue;
+			++idle;
+			if (queued == 0 && !stop)
+				wakeup.wait();
+			--idle;
+		}
+	}
+};
+
+void TaskWorker::run()
+{
+	scheduler->work(index);
+}
+
+TaskPool::TaskPool(int threads)
+{
+	if (threads <= 0)
+		threads = max(Thread::numProcessors() - 1, 1);
+	_s = new TaskScheduler(threads);
+}
+
+TaskPool::~TaskPool()
+{
+	delete _s;
+}
+
+TaskPool& TaskPool::global()
+{
+	// never destroyed, so that workers are not joined while the process exits
+	static TaskPool* pool = new TaskPool();
+	return *pool;
+}
+
+int TaskPool::threads() const
+{
+	return _s->workers.length();
+}
+
+int TaskPool::grainFor(int n) const
+{
+	return max(n / (8 * (threads() + 1)), 1);
+}
+
+void TaskPool::spawn(Task* task)
+{
+	task->_group = 0;
+	_s->push(task);
+}
+
+bool TaskPool::runPending()
+{
+	Task* t = _s->next(_s->self());
+	if (!t)
+		return false;
+	TaskScheduler::execute(t);
+	return true;
+}
+
+bool TaskPool::isWorker() const
+{
+	return _s->self() >= 0;
+}
+
+void TaskGroup::spawn(Task* task)
+{
+	task->_group = this;
+	++_pending;
+	_pool._s->push(task);
+}
+
+void TaskGroup::finished()
+{
+	Lock _(_mutex);
+	if (--_pending == 0)
+		_done.signal();
+}
+
+void TaskGroup::sync()
+{
+	while (_pending > 0)
+	{
+		if (_pool.runPending())
+			continue;
+		Lock _(_mutex);
+		if (_pending > 0)
+			_done.wait(0.001);
+	}
+	Lock _(_mutex); // let the last finished() return before this group can be destroyed
+}
+
+}
@@ -13,6 +13,7 @@
 #include <WinSock2.h>
 #else
 #include <stdlib.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -22,6 +23,7 @@
 #include <sys/wait.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
 #endif
 
 #include <stdio.h>
@@ -48,8 +50,45 @@ struct TlsCore
 	mbedtls_x509_crt srvcert;
 	mbedtls_pk_context pkey;
 	bool bound;
+	bool noWait;             // sending must not block (in tryWrite)
 };
 
+/*
+I/O callbacks for mbedTLS on the TlsCore's socket; sending returns MBEDTLS_ERR_SSL_WANT_WRITE instead of blocking
+while `noWait` is set
+*/
+static int tlsSend(void* ctx, const unsigned char* buf, size_t len)
+{
+	TlsCore* core = (TlsCore*)ctx;
+	if (!core->noWait)
+		return mbedtls_net_send(&core->net, buf, len);
+#ifdef _WIN32
+	mbedtls_net_set_nonblock(&core->net);
+	int n = mbedtls_net_send(&core->net, buf, len);
+	mbedtls_net_set_block(&core->net);
+	return n;
+#else
+#ifdef MSG_NOSIGNAL
+	int n = (int)::send(core->net.fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+	int n = (int)::send(core->net.fd, buf, len, MSG_DONTWAIT);
+#endif
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return MBEDTLS_ERR_SSL_WANT_WRITE;
+	return n < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : n;
+#endif
+}
+
+static int tlsRecv(void* ctx, unsigned char* buf, size_t len)
+{
+	return mbedtls_net_recv(&((TlsCore*)ctx)->net, buf, len);
+}
+
+static int tlsRecvTimeout(void* ctx, unsigned char* buf, size_t len, uint32_t timeout)
+{
+	return mbedtls_net_recv_timeout(&((TlsCore*)ctx)->net, buf, len, timeout);
+}
+
 mbedtls_ssl_config config;
 bool inited = false;
 
@@ -66,6 +105,7 @@ TlsSocket_::TlsSocket_()
 	_error = false;
 	_core = new TlsCore;
 	_core->bound = false;
+	_core->noWait = false;
 	mbedtls_net_init(&_core->net);
 	mbedtls_ssl_init(&_core->ssl);
 	mbedtls_ssl_config_init(&_core->conf);
@@ -73,7 +113,7 @@ TlsSocket_::TlsSocket_()
 	mbedtls_ctr_drbg_init(&_core->ctr_drbg);
 	mbedtls_entropy_init(&_core->entropy);
 	mbedtls_ssl_conf_rng(&_core->conf, mbedtls_ctr_drbg_random, &_core->ctr_drbg);
-	mbedtls_ssl_set_bio(&_core->ssl, &_core->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+	mbedtls_ssl_set_bio(&_core->ssl, _core, tlsSend, tlsRecv, NULL);
 
 	int ret;
 	if((ret = mbedtls_ctr_drbg_seed(&_core->ctr_drbg, mbedtls_entropy_func, &_core->entropy, NULL, 0)) != 0)
@@ -115,6 +155,7 @@ void TlsSocket_::close()
 	if (_handle >= 0)
 		mbedtls_ssl_close_notify(&_core->ssl);
 	_handle = -1;
+	_rbegin = _rend = 0;
 }
 
 int TlsSocket_::handle() const
@@ -201,7 +242,7 @@ Socket_* TlsSocket_::accept()
 		return cli;
 	}
 
-	mbedtls_ssl_set_bio(&cli->_core->ssl, &cli->_core->net, mbedtls_net_send, mbedtls_net_recv, mbedtls_net_recv_timeout);
+	mbedtls_ssl_set_bio(&cli->_core->ssl, cli->_core, tlsSend, tlsRecv, tlsRecvTimeout);
 
 	do ret = mbedtls_ssl_handshake(&cli->_core->ssl);
 	while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
@@ -278,37 +319,19 @@ bool TlsSocket_::setOption(int level, int opt, const void* val, int n)
 	return setsockopt(handle(), level, opt, (const SOCKOPT*)val, n)>=0;
 }
 
-int TlsSocket_::available()
+int TlsSocket_::availableRaw()
 {
 	mbedtls_ssl_read(&_core->ssl, NULL, 0);
 	return (int) mbedtls_ssl_get_bytes_avail( &_core->ssl );
 }
 
-int TlsSocket_::read(void* data, int size)
+int TlsSocket_::readRaw(void* data, int size)
 {
-	if(_blocking) {
-	int s = size, n;
-	while ((n = mbedtls_ssl_read(&_core->ssl, (unsigned char*)data, size)) < size)
-	{
-		if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE)
-			continue;
-		if (n < 0) {_error = true; break;}
-		else if(n==0)
-			return s - size;
-		size -= n;
-		data = (char*)data + n;
-	}
-	return s;
-	}
-	else {
-		int n = 1, m = 0;
-		do {
-			n = mbedtls_ssl_read(&_core->ssl, (unsigned char*)data, size); 
-			if (n > 0) m += n;
-		}
-		while (n > 0 || n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE);
-		return m;
-	}
+	int n;
+	do {
+		n = mbedtls_ssl_read(&_core->ssl, (unsigned char*)data, size);
+	} while (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE);
+	return n;
 }
 
 int TlsSocket_::write(const void* data, int n)
@@ -318,7 +341,7 @@ int TlsSocket_::write(const void* data, int n)
 	{
 		int m;
 		do {
-			m = mbedtls_ssl_write(&_core->ssl, (unsigned char*)data, n - written);
+			m = mbedtls_ssl_write(&_core->ssl, (const unsigned char*)data + written, n - written);
 			if (m == MBEDTLS_ERR_SSL_WANT_READ || m == MBEDTLS_ERR_SSL_WANT_WRITE) continue;
 			if (m <= 0)
 				return written;
@@ -329,11 +352,44 @@ int TlsSocket_::write(const void* data, int n)
 	return written;
 }
 
-bool TlsSocket_::waitInput(double t)
+/*
+Writes what can be sent without blocking and returns the number of bytes written, or -1 on error. If it returns 0,
+part of a record may be pending, so it must be called again with the same data.
+*/
+int TlsSocket_::tryWrite(const void* data, int n)
 {
-	if (available() != 0)
+	_core->noWait = true;
+	int m = mbedtls_ssl_write(&_core->ssl, (const unsigned char*)data, n);
+	_core->noWait = false;
+	if (m == MBEDTLS_ERR_SSL_WANT_WRITE || m == MBEDTLS_ERR_SSL_WANT_READ)
+		return 0;
+	return m < 0 ? -1 : m;
+}
+
+/*
+Joins the parts in one buffer so they are sent as few TLS records as possible.
+*/
+int TlsSocket_::write(const IoVec* parts, int n)
+{
+	Array<byte> data;
+	for (int i = 0; i < n; i++)
+		data.append((const byte*)parts[i].data, parts[i].length);
+	return write(data.ptr(), data.length());
+}
+
+bool TlsSocket_::waitInputRaw(double t)
+{
+	if (availableRaw() != 0)
 		return true;
 	//else return false;
+#ifndef _WIN32
+	pollfd fd;
+	fd.fd = handle();
+	fd.events = POLLIN;
+	fd.revents = 0;
+	poll(&fd, 1, (int)(t * 1000));
+	return fd.revents != 0;
+#else
 	fd_set rset;
 	struct timeval to;
 	to.tv_sec = (int)floor(t);
@@ -342,6 +398,7 @@ bool TlsSocket_::waitInput(double t)
 	FD_SET(handle(), &rset);
 	select(handle() + 1, &rset, 0, 0, &to);
 	return FD_ISSET(handle(), &rset) != 0;
+#endif
 }
 
 bool TlsSocket_::useCert(const String& cert)
@@ -9,7 +9,27 @@
 #ifdef ASL_TLS
 #include <asl/TlsSocket.h>
 #endif
+#include <asl/Thread.h>
+#include <asl/Queue.h>
+#include <asl/Pointer.h>
 #include <ctype.h>
+#ifdef ASL_ZLIB
+#include <zlib.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ASL_WS_SSE2
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ASL_WS_AVX2
+#endif
+#ifdef _WIN32
+#include <WinSock2.h>
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
 
 namespace asl {
 	
@@ -40,55 +60,697 @@ WebSocketMsg& WebSocketMsg::fix()
 	return *this;
 }
 
-WebSocketServer::WebSocketServer()
+#ifdef ASL_ZLIB
+
+/*
+The compressor and decompressor of a connection with the permessage-deflate extension (RFC 7692). zlib streams are
+created on first use. Without context takeover they are reset after each message.
+*/
+struct WsDeflate
+{
+	Mutex mutex;         // keeps compressed messages in the order they were compressed
+	z_stream zout, zin;
+	bool outReady, inReady;
+	int outBits, inBits, memLevel;
+	bool outReset, inReset;
+
+	WsDeflate(int outbits, int inbits, int mem, bool outreset, bool inreset) :
+		outReady(false), inReady(false), outBits(outbits), inBits(inbits), memLevel(mem), outReset(outreset),
+		inReset(inreset)
+	{
+		memset(&zout, 0, sizeof(zout));
+		memset(&zin, 0, sizeof(zin));
+	}
+	~WsDeflate()
+	{
+		if (outReady)
+			deflateEnd(&zout);
+		if (inReady)
+			inflateEnd(&zin);
+	}
+	// makes every following message independent of the previous ones
+	void forgetContext()
+	{
+		Lock _(mutex);
+		outReset = true;
+		if (outReady)
+			deflateReset(&zout);
+	}
+	bool compress(const byte* p, int n, Array<byte>& z, bool final = true);
+	bool decompress(const byte* p, int n, Array<byte>& data, int maxSize, bool final = true);
+};
+
+/*
+Compresses a message or a fragment of one; the last fragment goes without the final 00 00 FF FF of the flush block
+*/
+bool WsDeflate::compress(const byte* p, int n, Array<byte>& z, bool final)
+{
+	if (!outReady)
+	{
+		if (deflateInit2(&zout, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -outBits, memLevel, Z_DEFAULT_STRATEGY) != Z_OK)
+			return false;
+		outReady = true;
+	}
+	z.resize((int)deflateBound(&zout, n) + 16);
+	zout.next_in = (Bytef*)p;
+	zout.avail_in = n;
+	int done = 0;
+	do {
+		if (done == z.length())
+			z.resize(2 * z.length());
+		zout.next_out = z.ptr() + done;
+		zout.avail_out = z.length() - done;
+		if (deflate(&zout, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+			return false;
+		done = z.length() - zout.avail_out;
+	} while (zout.avail_out == 0);
+	if (!final)
+	{
+		z.resize(done);
+		return true;
+	}
+	z.resize(done - 4);
+	if (outReset)
+		deflateReset(&zout);
+	return true;
+}
+
+/*
+Decompresses a message or a fragment of one, failing if it is invalid or larger than maxSize
+*/
+bool WsDeflate::decompress(const byte* p, int n, Array<byte>& data, int maxSize, bool final)
+{
+	static const byte tail[4] = { 0, 0, 0xff, 0xff };
+	if (!inReady)
+	{
+		if (inflateInit2(&zin, -inBits) != Z_OK)
+			return false;
+		inReady = true;
+	}
+	data.resize(min(max(4 * n, 256), maxSize + 1));
+	int done = 0;
+	for (int part = 0; part < (final ? 2 : 1); part++)
+	{
+		zin.next_in = (Bytef*)(part == 0 ? p : tail);
+		zin.avail_in = part == 0 ? n : 4;
+		while (zin.avail_in > 0)
+		{
+			if (done == data.length())
+			{
+				if (done > maxSize)
+					return false;
+				data.resize(min(2 * data.length(), maxSize + 1));
+			}
+			zin.next_out = data.ptr() + done;
+			zin.avail_out = data.length() - done;
+			int r = inflate(&zin, Z_SYNC_FLUSH);
+			done = data.length() - zin.avail_out;
+			if (r == Z_STREAM_END)
+			{
+				inflateReset(&zin);
+				break;
+			}
+			if (r != Z_OK && !(r == Z_BUF_ERROR && zin.avail_out > 0))
+				return false;
+			if (r == Z_BUF_ERROR)
+				break;
+		}
+	}
+	if (done > maxSize)
+		return false;
+	data.resize(done);
+	if (final && inReset)
+		inflateReset(&zin);
+	return true;
+}
+
+/*
+Parameters of a permessage-deflate offer or response
+*/
+struct WsDeflateParams
+{
+	bool serverNoTakeover, clientNoTakeover;
+	int serverBits, clientBits;   // 0 if not given, -1 for client_max_window_bits without value
+	WsDeflateParams() : serverNoTakeover(false), clientNoTakeover(false), serverBits(0), clientBits(0) {}
+};
+
+/*
+Parses an extension "permessage-deflate; param; param=value", returning false if it is another extension or has
+unknown or invalid parameters
+*/
+static bool parseDeflate(const String& extension, WsDeflateParams& p)
+{
+	Array<String> params = extension.split(';');
+	if (params.length() == 0 || params[0].trimmed() != "permessage-deflate")
+		return false;
+	for (int i = 1; i < params.length(); i++)
+	{
+		Array<String> nv = params[i].split('=');
+		String name = nv[0].trimmed();
+		int value = -1;
+		if (nv.length() > 1)
+		{
+			String v = nv[1].trimmed().replace("\"", "");
+			value = v;
+			if (value < 8 || value > 15)
+				return false;
+		}
+		if (name == "server_no_context_takeover" && value < 0)
+			p.serverNoTakeover = true;
+		else if (name == "client_no_context_takeover" && value < 0)
+			p.clientNoTakeover = true;
+		else if (name == "server_max_window_bits" && value > 0)
+			p.serverBits = value;
+		else if (name == "client_max_window_bits")
+			p.clientBits = value;
+		else
+			return false;
+	}
+	return true;
+}
+
+/*
+Chooses the first acceptable permessage-deflate offer of a client and returns the response, or an empty string
+*/
+static String acceptDeflate(const String& offers, const WebSocketCompression& options, WsDeflateParams& p)
+{
+	int bits = clamp(options.windowBits, 9, 15);
+	Array<String> list = offers.split(',');
+	foreach(String& offer, list)
+	{
+		p = WsDeflateParams();
+		if (!parseDeflate(offer, p) || p.serverBits == 8) // zlib cannot compress with a 256 byte window
+			continue;
+		p.serverNoTakeover |= !options.contextTakeover;
+		p.clientNoTakeover |= !options.contextTakeover;
+		String response = "permessage-deflate";
+		if (p.serverNoTakeover)
+			response << "; server_no_context_takeover";
+		if (p.clientNoTakeover)
+			response << "; client_no_context_takeover";
+		if (p.serverBits)
+			response << "; server_max_window_bits=" << (p.serverBits = min(p.serverBits, bits));
+		else
+			p.serverBits = bits;
+		if (p.clientBits != 0 && bits < 15)
+			response << "; client_max_window_bits=" << (p.clientBits = p.clientBits < 0 ? bits : min(p.clientBits, bits));
+		else
+			p.clientBits = 15;
+		return response;
+	}
+	return "";
+}
+
+#else
+
+struct WsDeflate
+{
+};
+
+#endif
+
+/*
+Messages waiting to be sent to a client by the hub of a WebSocketServer. Frames are shared by all the clients they
+are queued to.
+*/
+struct WsOutbox
+{
+	WsHub* hub;
+	Socket socket;
+	Queue< Array<byte> > frames;
+	int offset;              // bytes of the first frame already sent
+	Array<String> topics;
+	bool closed;
+	int zbits;               // compression window of the client, 0 if not compressed
+	Mutex writing;           // held by the hub thread while it writes to the socket
+	WsOutbox(WsHub* h, const Socket& s) : hub(h), socket(s), offset(0), closed(false), zbits(0) {}
+};
+
+/*
+Keeps the topic subscriptions of a WebSocketServer and sends the clients' queued frames from its own thread,
+writing to each socket only what it accepts without blocking. A UDP socket on the loopback interface wakes it up
+when a queue gets its first frame.
+*/
+struct WsHub : public Thread
+{
+	typedef Shared<WsOutbox> OutboxPtr;
+	Mutex _mutex;
+	Map<String, Array<WsOutbox*> > _topics;
+	Array<OutboxPtr> _outboxes;
+	int _maxQueue;
+	int _policy;
+	bool _stop;
+	PacketSocket _wake;
+	InetAddress _wakeAddr;
+	WebSocketServer::HubStats _stats;
+	WsDeflate* _zip;         // compresses published messages without context, so frames suit any compressed client
+	int _zipClients;
+	int _zipBits;
+
+	WsHub() : _maxQueue(1024), _policy(WebSocketServer::SLOW_DROP), _stop(false), _zip(NULL), _zipClients(0), _zipBits(0)
+	{
+		_wake.bind("127.0.0.1", 0);
+		_wakeAddr = _wake.localAddress();
+		start();
+	}
+	~WsHub()
+	{
+		_stop = true;
+		wake();
+		join();
+		delete _zip;
+	}
+	void wake()
+	{
+		_wake.sendTo(_wakeAddr, "w", 1);
+	}
+	WsOutbox* attach(WebSocket& ws)
+	{
+		if (!ws._outbox)
+		{
+			ws._outbox = new WsOutbox(this, ws._socket);
+			_outboxes << OutboxPtr(ws._outbox);
+#ifdef ASL_ZLIB
+			if (ws._deflate) // from now on messages are compressed without context, like the published ones
+			{
+				ws._deflate->forgetContext();
+				ws._outbox->zbits = ws._deflate->outBits;
+				_zipClients++;
+			}
+#endif
+		}
+		return ws._outbox;
+	}
+	void subscribe(WebSocket& ws, const String& topic)
+	{
+		Lock _(_mutex);
+		WsOutbox* o = attach(ws);
+		if (o->topics.contains(topic))
+			return;
+		o->topics << topic;
+		_topics[topic] << o;
+	}
+	void unsubscribe(WsOutbox* o, const String& topic)
+	{
+		Array<WsOutbox*>* list = _topics.find(topic);
+		if (list) {
+			list->removeOne(o);
+			if (list->length() == 0)
+				_topics.remove(topic);
+		}
+		o->topics.removeOne(topic);
+	}
+	// removes a client, then sends what was left in its queue (like a last message) from the calling thread
+	void detach(WebSocket& ws)
+	{
+		WsOutbox* o = ws._outbox;
+		if (!o)
+			return;
+		Array< Array<byte> > left;
+		int offset;
+		OutboxPtr keep;
+		{
+			Lock w(o->writing); // waits for a write in progress in the hub thread
+			Lock _(_mutex);
+			while (o->topics.length() > 0)
+				unsubscribe(o, o->topics[0]);
+			if (!o->closed) // not disconnected for being slow or after an error
+			{
+				while (o->frames.length() > 0)
+					left << o->frames.get();
+			}
+			o->closed = true;
+			offset = o->offset;
+			if (o->zbits)
+				_zipClients--;
+			ws._outbox = NULL;
+			for (int i = 0; i < _outboxes.length(); i++)
+				if (&*_outboxes[i] == o) {
+					keep = _outboxes[i];
+					_outboxes.remove(i);
+					break;
+				}
+		}
+		int sent = 0;
+		while (sent < left.length() && sendAll(ws._socket, left[sent], offset))
+		{
+			offset = 0;
+			sent++;
+		}
+		Lock _(_mutex);
+		_stats.sent += sent;
+	}
+	// writes a frame from `offset` waiting up to a few seconds for the client to read, returns false on failure
+	static bool sendAll(Socket& socket, const Array<byte>& frame, int offset)
+	{
+		while (offset < frame.length())
+		{
+			int n = socket.tryWrite(frame.ptr() + offset, frame.length() - offset);
+			if (n < 0)
+				return false;
+			if (n == 0)
+			{
+				pollfd fd;
+				fd.fd = socket.handle();
+				fd.events = POLLOUT;
+				fd.revents = 0;
+				if (poll(&fd, 1, 5000) <= 0)
+					return false;
+			}
+			offset += n;
+		}
+		return true;
+	}
+	// queues a frame (with the mutex locked), returns true if the queue was empty
+	bool enqueue(WsOutbox& o, const Array<byte>& frame)
+	{
+		if (o.closed)
+			return false;
+		if (o.frames.length() >= _maxQueue)
+		{
+			if (_policy == WebSocketServer::SLOW_DISCONNECT)
+			{
+				o.closed = true;
+				o.socket.shutdown();
+				_stats.disconnected++;
+			}
+			_stats.dropped++;
+			return false;
+		}
+		o.frames << frame;
+		_stats.queued++;
+		return o.frames.length() == 1;
+	}
+	void send(WsOutbox& o, const Array<byte>& frame)
+	{
+		bool first;
+		{
+			Lock _(_mutex);
+			first = enqueue(o, frame);
+		}
+		if (first)
+			wake();
+	}
+	// queues the compressed frame, if given, to compressed clients and the normal one to the rest
+	int publish(const String& topic, const Array<byte>& frame, const Array<byte>& zframe)
+	{
+		int n = 0;
+		bool first = false;
+		{
+			Lock _(_mutex);
+			_stats.published++;
+			Array<WsOutbox*>* list = _topics.find(topic);
+			if (!list)
+				return 0;
+			foreach(WsOutbox* o, *list)
+			{
+				int queued = o->frames.length();
+				bool z = zframe.length() > 0 && o->zbits >= _zipBits;
+				if (enqueue(*o, z ? zframe : frame))
+					first = true;
+				if (o->frames.length() > queued)
+					n++;
+			}
+		}
+		if (first)
+			wake();
+		return n;
+	}
+	Array<byte> compress(const byte* p, int n, byte opcode, const WebSocketCompression& options);
+	void flush(WsOutbox& o);
+	void run();
+};
+
+/*
+Sends queued frames of a client until its socket would block. The writes do not block and are done outside the hub
+mutex, so other clients and publishers are not delayed, but with the outbox's `writing` mutex locked, so that a
+client detached (and then closed) by its own thread is never written to.
+*/
+void WsHub::flush(WsOutbox& o)
+{
+	Lock w(o.writing);
+	while (1)
+	{
+		Array<byte> frame;
+		int offset;
+		{
+			Lock _(_mutex);
+			if (o.closed || o.frames.length() == 0)
+				return;
+			frame = o.frames.first();
+			offset = o.offset;
+		}
+		int n = o.socket.tryWrite(frame.ptr() + offset, frame.length() - offset);
+		Lock _(_mutex);
+		if (n < 0)
+		{
+			o.closed = true;
+			o.frames.clear();
+			return;
+		}
+		o.offset += n;
+		if (o.offset < frame.length())
+			return;
+		o.frames.get();
+		o.offset = 0;
+		_stats.sent++;
+	}
+}
+
+void WsHub::run()
+{
+	Array<pollfd> fds;
+	Array<OutboxPtr> pending;
+	while (!_stop)
+	{
+		pending.clear();
+		{
+			Lock _(_mutex);
+			foreach(OutboxPtr& o, _outboxes)
+				if (!o->closed && o->frames.length() > 0)
+					pending << o;
+		}
+		fds.resize(pending.length() + 1);
+		fds[0].fd = _wake.handle();
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		for (int i = 0; i < pending.length(); i++)
+		{
+			fds[i + 1].fd = pending[i]->socket.handle();
+			fds[i + 1].events = POLLOUT;
+			fds[i + 1].revents = 0;
+		}
+		poll(fds.ptr(), fds.length(), 1000);
+		if (fds[0].revents)
+		{
+			char buffer[64];
+			InetAddress sender;
+			while (_wake.available() > 0)
+				_wake.readFrom(sender, buffer, sizeof(buffer));
+		}
+		for (int i = 0; i < pending.length(); i++)
+			if (fds[i + 1].revents)
+				flush(*pending[i]);
+	}
+}
+
+#ifdef ASL_WS_AVX2
+/*
+Masks 32 bytes at a time with AVX2 and returns the number of bytes done, compiled for AVX2 but only called if the
+CPU supports it
+*/
+__attribute__((target("avx2")))
+static int maskAvx2(byte* dst, const byte* src, int n, unsigned k)
+{
+	__m256i key = _mm256_set1_epi32((int)k);
+	int i = 0;
+	for (; i + 32 <= n; i += 32)
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i)), key));
+	return i;
+}
+
+static bool hasAvx2()
+{
+	static bool has = __builtin_cpu_supports("avx2") != 0;
+	return has;
+}
+#endif
+
+void WebSocket::applyMask(byte* dst, const byte* src, int n, const byte* key)
+{
+	unsigned k;
+	memcpy(&k, key, 4); // the key in memory order, so that it lines up with the bytes in any word size
+	int i = 0;
+#ifdef ASL_WS_AVX2
+	if (n >= 64 && hasAvx2())
+		i = maskAvx2(dst, src, n, k);
+#endif
+#ifdef ASL_WS_SSE2
+	__m128i key4 = _mm_set1_epi32((int)k);
+	for (; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), key4));
+#endif
+	ULong k8 = k | ((ULong)k << 32);
+	for (; i + 8 <= n; i += 8)
+	{
+		ULong w;
+		memcpy(&w, src + i, 8);
+		w ^= k8;
+		memcpy(dst + i, &w, 8);
+	}
+	for (; i < n; i++)
+		dst[i] = src[i] ^ key[i & 3];
+}
+
+/*
+Builds the header of a frame; `head` is its first byte, with the FIN and RSV1 flags and the opcode
+*/
+static void frameHeader(StreamBuffer& buf, byte head, Long len, bool masked)
+{
+	buf << head;
+	byte m = masked ? 0x80 : 0;
+	if (len < 126)
+		buf << byte(m | (byte)len);
+	else if (len < (1 << 16))
+		buf << byte(m | (byte)126) << (unsigned short)len;
+	else
+		buf << byte(m | (byte)127) << len;
+}
+
+static Array<byte> serverFrame(const byte* p, int n, byte head)
+{
+	StreamBuffer frame(StreamBuffer::BIGENDIAN);
+	frameHeader(frame, head, n, false);
+	frame.append(p, n);
+	return frame;
+}
+
+/*
+Makes a compressed frame for the hub's compressed clients, or returns an empty array if there are none
+*/
+#ifdef ASL_ZLIB
+Array<byte> WsHub::compress(const byte* p, int n, byte opcode, const WebSocketCompression& options)
+{
+	Array<byte> z;
+	{
+		Lock _(_mutex);
+		if (_zipClients == 0)
+			return z;
+		if (!_zip)
+		{
+			_zipBits = clamp(options.windowBits, 9, 15);
+			_zip = new WsDeflate(_zipBits, 15, options.memLevel, true, true);
+		}
+	}
+	Lock _(_zip->mutex);
+	if (_zip->compress(p, n, z))
+		return serverFrame(z.ptr(), z.length(), 0xc0 | opcode);
+	z.clear();
+	return z;
+}
+#else
+Array<byte> WsHub::compress(const byte*, int, byte, const WebSocketCompression&)
+{
+	return Array<byte>();
+}
+#endif
+
+WebSocketServer::WebSocketServer() : _compression(false)
 {
 	_requestStop = false;
+	_hub = NULL;
 }
 
-WebSocketServer::WebSocketServer(int port)
+WebSocketServer::WebSocketServer(int port) : _compression(false)
 {
 	bind(port);
 	_requestStop = false;
+	_hub = NULL;
+}
+
+WebSocketServer::~WebSocketServer()
+{
+	shutdown();
+	delete _hub;
+}
+
+WsHub* WebSocketServer::hub()
+{
+	Lock _(_hubMutex);
+	if (!_hub)
+		_hub = new WsHub();
+	return _hub;
+}
+
+void WebSocketServer::setSendQueue(int maxMessages, SlowClientPolicy policy)
+{
+	WsHub* h = hub();
+	Lock _(h->_mutex);
+	h->_maxQueue = maxMessages;
+	h->_policy = policy;
+}
+
+void WebSocketServer::subscribe(WebSocket& ws, const String& topic)
+{
+	hub()->subscribe(ws, topic);
+}
+
+void WebSocketServer::unsubscribe(WebSocket& ws, const String& topic)
+{
+	WsHub* h = hub();
+	Lock _(h->_mutex);
+	if (ws._outbox)
+		h->unsubscribe(ws._outbox, topic);
+}
+
+int WebSocketServer::publishFrame(const String& topic, const byte* p, int n, byte opcode)
+{
+	WsHub* h = hub();
+	Array<byte> zframe;
+	if (_compression.enabled && n >= _compression.threshold)
+		zframe = h->compress(p, n, opcode, _compression);
+	return h->publish(topic, serverFrame(p, n, 0x80 | opcode), zframe);
+}
+
+int WebSocketServer::publish(const String& topic, const String& message)
+{
+	return publishFrame(topic, (const byte*)*message, message.length(), 1);
+}
+
+int WebSocketServer::publish(const String& topic, const Array<byte>& message)
+{
+	return publishFrame(topic, message.ptr(), message.length(), 2);
+}
+
+int WebSocketServer::publish(const String& topic, const Var& message)
+{
+	return publish(topic, Json::encode(message));
+}
+
+int WebSocketServer::subscribers(const String& topic)
+{
+	WsHub* h = hub();
+	Lock _(h->_mutex);
+	const Array<WsOutbox*>* list = h->_topics.find(topic);
+	return list ? list->length() : 0;
+}
+
+WebSocketServer::HubStats WebSocketServer::hubStats()
+{
+	WsHub* h = hub();
+	Lock _(h->_mutex);
+	return h->_stats;
 }
 
 void WebSocketServer::serve(Socket client)
 {
-	String head = client.readLine();
-	int i = head.indexOf(' ');
-	if (i == -1)
-		return;
-	int j = head.indexOf(' ', i + 1);
-	if (j == -1)
+	HttpRequest request(client);
+	if (client.error() || !request.method())
 		return;
-	String method = head.substring(0, i);
-	String res = head.substring(i + 1, j);
 
-	String line;
-	Dic<String> headers;
-	while (line = client.readLine(), line != "\r")
-	{
-		line = line.trim();
-		int i = line.indexOf(':');
-		if (i<0) {
-			client.close();
-			return;
-		}
-		String name = line.substring(0, i);
-		String cname;
-		bool capitalize = true;
-		for (int i = 0; i < name.length(); i++)
-		{
-			cname << char(capitalize ? toupper(name[i]) : tolower(name[i]));
-			capitalize = !isalnum(name[i]);
-		}
+	DEBUG_LOG("%s\n\n\n", *request.headers().join("\n", ": "));
 
-		String value = (i < line.length() - 1) ? line.substring(i + 2) : "";
-		headers[cname] = value;
-	}
-
-	DEBUG_LOG("%s\n\n\n", *headers.join("\n", ": "));
-
-	process(client, headers);
+	process(client, request.headers());
 }
 
 void WebSocketServer::process(Socket& client, const Dic<String>& headers)
@@ -111,9 +773,24 @@ void WebSocketServer::process(Socket& client, const Dic<String>& headers)
 
 	if (headers.has("Sec-Websocket-Protocol"))
 		client << "Sec-Websocket-Protocol: chat\r\n";
-	client << "\r\n";
 
 	WebSocket ws(client, false);
+	ws._compression = _compression;
+#ifdef ASL_ZLIB
+	if (_compression.enabled && headers.has("Sec-Websocket-Extensions"))
+	{
+		WsDeflateParams p;
+		String extension = acceptDeflate(headers["Sec-Websocket-Extensions"], _compression, p);
+		if (extension)
+		{
+			client << "Sec-WebSocket-Extensions: " << extension << "\r\n";
+			ws._deflate = new WsDeflate(p.serverBits, p.clientBits, _compression.memLevel, p.serverNoTakeover,
+				p.clientNoTakeover);
+		}
+	}
+#endif
+	client << "\r\n";
+
 	{
 		Lock l(_mutex);
 		_clients << &ws;
@@ -123,33 +800,78 @@ void WebSocketServer::process(Socket& client, const Dic<String>& headers)
 		Lock l(_mutex);
 		_clients.removeOne(&ws);
 	}
+	if (_hub)
+		_hub->detach(ws);
 	client.close();
 }
 
 
 
-void WebSocketServer::serve(WebSocket& ws)
+void WebSocketServer::serve(WebSocket&)
 {
 }
 
-WebSocket::WebSocket()
+WebSocket::WebSocket() : _compression(false)
 {
 	_isClient = true;
 	_closed = true;
 	_code = 1000;
 	_socket.setEndian(Socket::BIGENDIAN);
 	_random.init();
+	_outbox = NULL;
+	_fragType = 2;
+	_fragDeflated = false;
 }
 
 WebSocket::WebSocket(const Socket& s, bool isclient):
 	_socket(s),
-	_isClient(isclient)
+	_isClient(isclient),
+	_compression(false)
 {
 	_closed = false;
 	_code = 1000;
 	_socket.setEndian(Socket::BIGENDIAN);
 	_socket.setBlocking(true);
+	_socket.setNoDelay(true);
 	_random.init();
+	_outbox = NULL;
+	_fragType = 2;
+	_fragDeflated = false;
+}
+
+WebSocket::WebSocket(const WebSocket& ws) :
+	_socket(ws._socket),
+	_buffer(ws._buffer),
+	_isClient(ws._isClient),
+	_closed(ws._closed),
+	_code(ws._code),
+	_random(ws._random),
+	_outbox(ws._outbox),
+	_compression(ws._compression),
+	_deflate(ws._deflate),
+	_fragType(ws._fragType),
+	_fragDeflated(ws._fragDeflated)
+{
+}
+
+WebSocket::~WebSocket()
+{
+}
+
+WebSocket& WebSocket::operator=(const WebSocket& ws)
+{
+	_socket = ws._socket;
+	_buffer = ws._buffer;
+	_isClient = ws._isClient;
+	_closed = ws._closed;
+	_code = ws._code;
+	_random = ws._random;
+	_outbox = ws._outbox;
+	_compression = ws._compression;
+	_deflate = ws._deflate;
+	_fragType = ws._fragType;
+	_fragDeflated = ws._fragDeflated;
+	return *this;
 }
 
 bool WebSocket::connect(const String& uri, int port)
@@ -185,6 +907,21 @@ bool WebSocket::connect(const String& uri, int port)
 
 	String key64 = encodeBase64(key, 16);
 
+	String extensions;
+#ifdef ASL_ZLIB
+	int bits = clamp(_compression.windowBits, 9, 15);
+	if (_compression.enabled)
+	{
+		extensions << "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits";
+		if (bits < 15)
+			extensions << "=" << bits << "; server_max_window_bits=" << bits;
+		if (!_compression.contextTakeover)
+			extensions << "; client_no_context_takeover; server_no_context_takeover";
+		extensions << "\r\n";
+	}
+#endif
+	_deflate = NULL;
+
 	_socket << String(200, "GET %s HTTP/1.1\r\n"
 		"Host: %s:%i\r\n"
 		"Upgrade: websocket\r\n"
@@ -192,7 +929,8 @@ bool WebSocket::connect(const String& uri, int port)
 		"Sec-WebSocket-Key: %s\r\n"
 		"Sec-WebSocket-Protocol: chat\r\n"
 		"Sec-WebSocket-Version: 13\r\n"
-		"Pragma: no-cache\r\n\r\n", *url.path, *url.host, url.port, *key64);
+		"%s"
+		"Pragma: no-cache\r\n\r\n", *url.path, *url.host, url.port, *key64, *extensions);
 
 	String line = _socket.readLine();
 	int i = line.indexOf(' ');
@@ -224,7 +962,7 @@ bool WebSocket::connect(const String& uri, int port)
 		}
 		String name = line.substring(0, i);
 		String value = (i < line.length() - 1) ? line.substring(i + 2) : "";
-		headers[name] = value;
+		headers[name.toLowerCase() == "sec-websocket-extensions" ? String("Sec-WebSocket-Extensions") : name] = value;
 	}
 
 	DEBUG_LOG("%s\n\n\n", *headers.join("\n", ": "));
@@ -233,114 +971,211 @@ bool WebSocket::connect(const String& uri, int port)
 	{
 		_socket.close();
 		return false;
+	}
+
+	if (headers.has("Sec-WebSocket-Extensions"))
+	{
+#ifdef ASL_ZLIB
+		WsDeflateParams p;
+		if (!_compression.enabled || !parseDeflate(headers["Sec-WebSocket-Extensions"], p) || p.clientBits < 0 ||
+			p.serverBits > bits || p.clientBits == 8)
+#endif
+		{
+			_socket.close();  // an extension that was not offered
+			return false;
+		}
+#ifdef ASL_ZLIB
+		_deflate = new WsDeflate(p.clientBits ? min(p.clientBits, bits) : bits, bits, _compression.memLevel,
+			p.clientNoTakeover, p.serverNoTakeover);
+#endif
 	}
 
 	_closed = false;
+	_socket.setNoDelay(true);
 
 	return true;
 }
 
 void WebSocket::close()
 {
-	_socket.close();
+	closeSocket();
 	_closed = true;
 }
 
+/*
+Closes the socket, first detaching it from the server's hub (if attached), so the hub thread does not write to it
+*/
+void WebSocket::closeSocket()
+{
+	if (_outbox)
+		_outbox->hub->detach(*this);
+	_socket.close();
+}
+
 bool WebSocket::closed()
 {
 	if (_closed)
 		return true;
 	if (_socket.disconnected()) {
 		_closed = true;
-		_socket.close();
+		closeSocket();
 		return true;
 	}
 	return false;
 }
 
+/*
+Reads the next frame. The payload of a data frame is appended to `data`, and control frames are processed here.
+Returns the first byte of the frame (FIN, RSV1 and opcode) or -1 if the connection is closed.
+*/
+int WebSocket::readFrame(Array<byte>& data)
+{
+	byte b0, mlen;
+	DEBUG_LOG("receive\n");
+	if (closed()) {
+		return -1;
+	}
+	DEBUG_LOG("avail %i\n", _socket.available());
+	_socket >> b0 >> mlen;
+	DEBUG_LOG("%i %i\n", b0, mlen);
+	if (closed()) {
+		return -1;
+	}
+	int opcode = b0 & 0x0f;
+	bool masked = !!(mlen & 0x80);
+	bool control = (opcode & 0x08) != 0;
+	Long size = mlen & 0x7f;
+	if (size == 126)
+	{
+		size = _socket.read<unsigned short>();
+	}
+	else if (size == 127)
+		size = _socket.read<Long>();
+
+	// RSV1 is only valid on the first frame of a message when compression was negotiated
+	if ((b0 & 0x30) || ((b0 & 0x40) && (!_deflate || control || opcode == 0)) || size < 0 || (control && size > 125))
+	{
+		_code = 1002;
+		close();
+		return -1;
+	}
+	if (!control && data.length() + size > _compression.maxMessageSize)
+	{
+		_code = 1009;
+		close();
+		return -1;
+	}
+	int len = (int)size;
+
+	byte key[4];
+	if (masked)
+		_socket.read(key, 4);
+
+	// data frames are read directly at the end of the message and unmasked in place
+
+	Array<byte> control_data;
+	Array<byte>& buffer = control ? control_data : data;
+	int start = buffer.length();
+	buffer.resize(start + len);
+	if (len > 0)
+		_socket.read(buffer.ptr() + start, len);
+
+	DEBUG_LOG("frame: op %i fin %i len %i\n", opcode, b0 >> 7, (int)len);
+
+	if (masked)
+		applyMask(buffer.ptr() + start, buffer.ptr() + start, len, key);
+
+	switch (opcode)
+	{
+	case 8: // connection close
+	{
+		if (buffer.length() >= 2) {
+			_code = (buffer[0] << 8) | buffer[1];
+			data = Array<byte>(buffer.ptr() + 2, buffer.length() - 2);
+		}
+		_closed = true;
+		closeSocket();
+		break;
+	}
+	case 9: // ping
+		send(buffer, buffer.length(), FRAME_PONG);
+		break;
+	}
+	return b0;
+}
+
 WebSocketMsg WebSocket::receive()
 {
 	WebSocketMsg msg;
-	bool haveMsg = false;
-	while (!haveMsg)
+#ifdef ASL_ZLIB
+	bool deflated = false;
+#endif
+	while (1)
 	{
-		Array<byte> buffer;
-		byte b0, mlen;
-		DEBUG_LOG("receive\n");
-		if (closed()) {
+		int b0 = readFrame(msg._data);
+		if (b0 < 0)
 			return msg.fix();
-		}
-		DEBUG_LOG("avail %i\n", _socket.available());
-		_socket >> b0 >> mlen;
-		DEBUG_LOG("%i %i\n", b0, mlen);
-		if (closed()) {
-			return msg.fix();
-		}
-		bool fin = !!(b0 & 0x80);
 		int opcode = b0 & 0x0f;
-		bool masked = !!(mlen & 0x80);
-		int len = mlen & 0x7f;
-		if (len == 126)
+#ifdef ASL_ZLIB
+		if (opcode == 1 || opcode == 2)
+			deflated = (b0 & 0x40) && _deflate;
+#endif
+		if (b0 & 0x80)
 		{
-			len = _socket.read<unsigned short>();
+			if (opcode & 0x08)
+				return msg.fix();
+			break;
 		}
-		else if (len == 127)
-			len = (int)_socket.read<Long>(); // what if length larger than int?
-
-		unsigned mask = 0;
-		if (masked)
-			_socket >> mask;
-
-		buffer.resize(buffer.length() + len);
-		if (len > 0)
-			_socket.read(buffer.ptr() + buffer.length() - len, len);
-
-		DEBUG_LOG("frame: op %i fin %i len %i\n", opcode, fin ? 1 : 0, (int)len);
+	}
 
-		if (masked)
+#ifdef ASL_ZLIB
+	if (deflated)
+	{
+		Array<byte> data;
+		if (!_deflate->decompress(msg._data.ptr(), msg._data.length(), data, _compression.maxMessageSize))
 		{
-			swapBytes(mask);
-			buffer.resize(buffer.length() + 4);
-			buffer.resize(buffer.length() - 4);
-			int n = buffer.length() / 4 + 1;
-			for (int i = 0; i < n; i++)
-			{
-				((unsigned*)buffer.ptr())[i] ^= mask;
-			}
+			_code = 1009;
+			close();
+			return WebSocketMsg().fix();
 		}
+		msg._data = data;
+	}
+#endif
+	return msg.fix();
+}
 
-		switch (opcode)
+WebSocket::FrameType WebSocket::receiveFragment(Array<byte>& data, bool& last)
+{
+	while (1)
+	{
+		data.clear();
+		int b0 = readFrame(data);
+		if (b0 < 0 || _closed)
+			return FRAME_CLOSE;
+		int opcode = b0 & 0x0f;
+		if (opcode & 0x08)
+			continue;
+		if (opcode != 0)
 		{
-		case 0: // continuation
-		case 1: // text
-		case 2: // binary
-			msg.append(buffer);
-			break;
-		case 8: // connection close
+			_fragType = opcode;
+			_fragDeflated = (b0 & 0x40) && _deflate;
+		}
+		last = (b0 & 0x80) != 0;
+#ifdef ASL_ZLIB
+		if (_fragDeflated)
 		{
-			if (buffer.length() >= 2) {
-				_code = (buffer[0] << 8) | buffer[1];
-				buffer.remove(0, 2);
-				msg = buffer;
+			Array<byte> fragment;
+			if (!_deflate->decompress(data.ptr(), data.length(), fragment, _compression.maxMessageSize, last))
+			{
+				_code = 1009;
+				close();
+				return FRAME_CLOSE;
 			}
-			haveMsg = true;
-			_closed = true;
-			_socket.close();
-			break;
-		}
-		case 9: // ping
-			send(buffer, buffer.length(), FRAME_PONG);
-			break;
-		case 10: // pong
-			buffer.clear();
-			break;
+			data = fragment;
 		}
-
-		if (fin)
-			haveMsg = true;
+#endif
+		return _fragType == 1 ? FRAME_TEXT : FRAME_BINARY;
 	}
-
-	return msg.fix();
 }
 
 void WebSocket::send(const Var& v)
@@ -353,36 +1188,110 @@ void WebSocket::send(const byte* p, int length, FrameType type)
 	if (length <= 0 || _closed)
 		return;
 	byte opcode = (type == FRAME_TEXT) ? 1 : (type == FRAME_BINARY) ? 2 : (type == FRAME_PONG) ? 10 : (type == FRAME_PING) ? 9 : 8;
-	byte b0 = 0x80 | opcode;
-	byte masked = _isClient ? 0x80 : 0;
-	StreamBuffer buf(StreamBuffer::BIGENDIAN);
-	buf << b0;
-	Long len = length;
-	if (len < 126)
-		buf << byte(masked | (byte)len);
-	else if (len < (1 << 16))
-		buf << byte(masked | (byte)126) << (unsigned short)len;
-	else
-		buf << byte(masked | (byte)127) << len;
-
-	unsigned mask = 0;
-	if (_isClient) {
-		mask = _random.get();
-		buf << mask;
-	}
-	Array<byte> data(p, length);
-	if (mask != 0){
-		swapBytes(mask);
-		data.resize(data.length() + 4);
-		data.resize(data.length() - 4);
-		int n = data.length() / 4 + 1;
-		for (int i = 0; i < n; i++)
+#ifdef ASL_ZLIB
+	if (_deflate && opcode <= 2 && length >= _compression.threshold)
+	{
+		WsDeflate& z = *_deflate;
+		Lock _(z.mutex); // the peer must receive messages in the order they were compressed
+		Array<byte> data;
+		if (z.compress(p, length, data))
+		{
+			sendFrame(data.ptr(), data.length(), 0xc0 | opcode); // RSV1 marks a compressed message
+			return;
+		}
+	}
+#endif
+	sendFrame(p, length, 0x80 | opcode);
+}
+
+void WebSocket::sendFragments(Producer& producer, FrameType type, int fragmentSize)
+{
+	if (_closed)
+		return;
+	byte opcode = (type == FRAME_TEXT) ? 1 : 2;
+	Array<byte> current(fragmentSize), next(fragmentSize);
+	int n = max(producer(current.ptr(), fragmentSize), 0);
+	if (_outbox) // the hub queues it whole, fragments of queued messages cannot be interleaved
+	{
+		Array<byte> message(current.ptr(), n);
+		while (n > 0)
+		{
+			n = max(producer(next.ptr(), fragmentSize), 0);
+			message.append(next.ptr(), n);
+		}
+		send(message.ptr(), message.length(), type);
+		return;
+	}
+#ifdef ASL_ZLIB
+	WsDeflate* z = (_deflate && n >= _compression.threshold) ? &*_deflate : NULL;
+	if (z)
+		z->mutex.lock();
+	Array<byte> zdata;
+#endif
+	bool first = true;
+	while (!_closed)
+	{
+		// the next fragment is produced before sending this one, so that the final one is sent with FIN
+		int m = n > 0 ? max(producer(next.ptr(), fragmentSize), 0) : 0;
+		byte head = (first ? opcode : 0) | (m == 0 ? 0x80 : 0);
+		const byte* p = current.ptr();
+		int length = n;
+#ifdef ASL_ZLIB
+		if (z && !z->compress(current.ptr(), n, zdata, m == 0))
 		{
-			((unsigned*)data.ptr())[i] ^= mask;
+			z->mutex.unlock();
+			z = NULL;
+			if (!first) // the message was started compressed and cannot go on uncompressed
+			{
+				_code = 1011;
+				close();
+				break;
+			}
 		}
+		if (z)
+		{
+			if (first)
+				head |= 0x40;
+			p = zdata.ptr();
+			length = zdata.length();
+		}
+#endif
+		sendFrame(p, length, head);
+		if (m == 0)
+			break;
+		swap(current, next);
+		n = m;
+		first = false;
+	}
+#ifdef ASL_ZLIB
+	if (z)
+		z->mutex.unlock();
+#endif
+}
+
+void WebSocket::sendFrame(const byte* p, int length, byte head)
+{
+	if (_outbox) // queued by the hub
+	{
+		_outbox->hub->send(*_outbox, serverFrame(p, length, head));
+		return;
+	}
+	StreamBuffer buf(StreamBuffer::BIGENDIAN);
+	frameHeader(buf, head, length, _isClient);
+
+	Array<byte> data;
+	if (_isClient) // client frames are masked while copying, server frames are sent from the caller's buffer
+	{
+		unsigned mask = _random.get();
+		byte* key = (byte*)&mask;
+		buf.append(key, 4);
+		data.resize(length);
+		applyMask(data.ptr(), p, length, key);
+		p = data.ptr();
 	}
+	IoVec parts[2] = { IoVec(buf.ptr(), buf.length()), IoVec(p, length) }; // frame header and payload in one write
 	if (!_closed || _socket.disconnected())
-		_socket << *buf << data;
+		_socket.write(parts, 2);
 }
 
 bool WebSocket::wait(double timeout)
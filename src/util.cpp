@@ -1,5 +1,6 @@
 #include <asl/util.h>
 #include <asl/String.h>
+#include <asl/hash.h>
 
 namespace asl {
 
@@ -73,6 +74,14 @@ void Random::init()
 
 Random random(true);
 
+static ULong hashSeedBase = ((ULong)random.get() << 32) ^ random.get() ^ (ULong)(size_t)&hashSeedBase;
+static AtomicCount hashSeedCount;
+
+ULong randomHashSeed()
+{
+	return hashMix(hashSeedBase + (ULong)(unsigned)++hashSeedCount * 0x9e3779b97f4a7c15ull);
+}
+
 double now()
 {
 #ifdef _WIN32
@@ -23,6 +23,28 @@ void testSmartObject();
 void testDate();
 void testVec3();
 void testUuid();
+void testSocket();
+void testSocketServer();
+void testHttpRouter();
+void testHttpFileCache();
+void testHttpKeepAlive();
+void testAsyncHttp();
+void testWebSocketHub();
+void testWebSocketMask();
+void testWebSocketDeflate();
+void testWebSocketFragments();
+void testPacketBatch();
+void testTaskPool();
+void testParallel();
+void testFuture();
+void testQueue();
+void testConcurrentQueue();
+void testLocks();
+void testFlatHashMap();
+void testHash();
+void testConcurrentHashMap();
+void testBTreeMap();
+void testHttpRequest();
 
 using namespace asl;
 
@@ -510,6 +532,28 @@ int main(int narg, char* argv[])
 	TEST(Date)
 	TEST(Vec3)
 	TEST(Uuid)
+	TEST(Socket)
+	TEST(SocketServer)
+	TEST(HttpRequest)
+	TEST(HttpRouter)
+	TEST(HttpFileCache)
+	TEST(HttpKeepAlive)
+	TEST(AsyncHttp)
+	TEST(WebSocketHub)
+	TEST(WebSocketMask)
+	TEST(WebSocketDeflate)
+	TEST(WebSocketFragments)
+	TEST(PacketBatch)
+	TEST(TaskPool)
+	TEST(Parallel)
+	TEST(Future)
+	TEST(Queue)
+	TEST(ConcurrentQueue)
+	TEST(Locks)
+	TEST(FlatHashMap)
+	TEST(Hash)
+	TEST(ConcurrentHashMap)
+	TEST(BTreeMap)
 	else
 		return EXIT_FAILURE;
 	
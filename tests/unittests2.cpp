@@ -206,6 +206,36 @@ void testHashMap()
 		ASL_ASSERT(dic[10-i] == i);
 	dic.clear();
 	ASL_ASSERT(dic.length() == 0);
+
+	// the map grows incrementally: all elements must be found and enumerated while being moved
+	HashMap<int, int> map(8), shared = map;
+	for(int i=0; i<20000; i++)
+	{
+		map[i] = i;
+		if(i % 3 == 0)
+			map.remove(i / 2);
+		if(i % 997 == 1)
+		{
+			int count = 0;
+			foreach2(int k, int v, map)
+			{
+				ASL_ASSERT(k == v && map.has(k));
+				count++;
+			}
+			ASL_ASSERT(count == map.length() && map.has(i) && !map.has(i + 1));
+			HashMap<int, int> copy = map.clone();
+			ASL_ASSERT(copy.length() == map.length() && copy.has(i) && map.get(i, -1) == i);
+		}
+	}
+	ASL_ASSERT(shared.length() == map.length() && shared[19999] == 19999 && !shared.has(3));
+
+	HashMap<String, int> big;
+	big.reserve(50000);
+	for(int i=0; i<50000; i++)
+		big[String(i)] = i;
+	ASL_ASSERT(big.length() == 50000 && big["49999"] == 49999);
+	big.clear();
+	ASL_ASSERT(big.length() == 0 && !big.has("1"));
 }
 
 String join1(const Dic<String>& a)
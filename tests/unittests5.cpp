@@ -0,0 +1,1597 @@
+#include <asl/Socket.h>
+#include <asl/SocketServer.h>
+#include <asl/Thread.h>
+#include <asl/parallel.h>
+#include <asl/Future.h>
+#include <asl/Queue.h>
+#include <asl/ConcurrentQueue.h>
+#include <asl/ConcurrentHashMap.h>
+#include <asl/FlatHashMap.h>
+#include <asl/BTreeMap.h>
+#include <asl/Set.h>
+#include <asl/File.h>
+#include <asl/Http.h>
+#include <asl/HttpRouter.h>
+#include <asl/HttpServer.h>
+#include <asl/AsyncHttp.h>
+#include <asl/WebSocket.h>
+#include <asl/JSON.h>
+#include <asl/Directory.h>
+#include <stdio.h>
+
+using namespace asl;
+
+struct EchoServer : public SocketServer
+{
+	~EchoServer() { shutdown(); }
+	int port() { return _sockets[0].localAddress().port(); }
+
+	int onInput(Socket client)
+	{
+		String line = client.readLine();
+		if (client.error())
+			return CLIENT_CLOSE;
+		client << line << "\n";
+		return CLIENT_KEEP;
+	}
+};
+
+struct BusyServer : public SocketServer
+{
+	Semaphore done;
+	~BusyServer() { shutdown(); }
+	int port() { return _sockets[0].localAddress().port(); }
+
+	void serve(Socket client)
+	{
+		client << "hello\n";
+		done.wait();
+	}
+	void reject(Socket client)
+	{
+		client << "busy\n";
+	}
+};
+
+static void testEcho(EchoServer& server)
+{
+	Array<Socket> clients;
+	for (int i = 0; i < 3; i++)
+	{
+		Socket client;
+		ASL_ASSERT(client.connect(InetAddress("127.0.0.1", server.port())));
+		clients << client;
+	}
+	for (int k = 0; k < 3; k++)
+	{
+		for (int i = 0; i < clients.length(); i++)
+			clients[i] << String(0, "msg %i %i\n", i, k);
+		for (int i = 0; i < clients.length(); i++)
+			ASL_ASSERT(clients[i].readLine() == String(0, "msg %i %i", i, k));
+	}
+	foreach(Socket& client, clients)
+		client.close();
+}
+
+void testSocket()
+{
+	Socket server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.listen();
+	Socket client;
+	ASL_ASSERT(client.connect(InetAddress("127.0.0.1", server.localAddress().port())));
+	Socket peer = server.accept();
+
+	String text;
+	for (int i = 0; i < 500; i++)
+		text << String(0, "line %i\r\n", i);
+	client << text << "ABCD" << 12345 << "tail\n";
+
+	for (int i = 0; i < 499; i++)
+		ASL_ASSERT(peer.readLine() == String(0, "line %i\r", i));
+	int n;
+	const char* line = peer.readLineView(n);
+	ASL_ASSERT(line && String(line, n) == "line 499\r");
+	const byte* p = peer.peek(4);
+	ASL_ASSERT(p && memcmp(p, "ABCD", 4) == 0);
+	peer.skip(4);
+	ASL_ASSERT(peer.read<int>() == 12345);
+	ASL_ASSERT(peer.available() == 5);
+	ASL_ASSERT(peer.readLine() == "tail");
+	ASL_ASSERT(!peer.error());
+
+	TextFile("sendfile.txt").put("0123456789abcdefghij");
+	ASL_ASSERT(client.sendFile("sendfile.txt") == 20);
+	ASL_ASSERT(client.sendFile("sendfile.txt", 10, 5) == 5);
+	ASL_ASSERT(client.sendFile("nonexistent.txt") == -1);
+	char buffer[26] = {0};
+	ASL_ASSERT(peer.read(buffer, 25) == 25);
+	ASL_ASSERT(String(buffer) == "0123456789abcdefghijabcde");
+	File("sendfile.txt").remove();
+
+	String digits = "0123456789";
+	Array<IoVec> parts;
+	for (int i = 0; i < 100; i++)
+		parts << IoVec(*digits + i % 10, 1);
+	client.setNoDelay(true);
+	ASL_ASSERT(client.write(parts.ptr(), parts.length()) == 100);
+	Array<byte> data = peer.read(100);
+	ASL_ASSERT(data.length() == 100 && data[0] == '0' && data[57] == '7' && data[99] == '9');
+	client.close();
+	ASL_ASSERT(peer.waitInput(1) && peer.disconnected());
+}
+
+void testHttpRequest()
+{
+	Socket server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.listen();
+	Socket client;
+	ASL_ASSERT(client.connect(InetAddress("127.0.0.1", server.localAddress().port())));
+	Socket peer = server.accept();
+
+	client << "\r\nPOST /api/items/32?x=1&y=a+b#top HTTP/1.1\r\n"
+		"Host: localhost\r\n"
+		"content-type:  text/plain \r\n"
+		"X-Long: one\r\n"
+		"  two\r\n"
+		"Content-Length: 5\r\n"
+		"\r\n"
+		"hello"
+		"GET /index.html HTTP/1.1\r\n"
+		"Connection: close\r\n\r\n";
+
+	HttpRequest request(peer);
+	ASL_ASSERT(request.method() == "POST");
+	ASL_ASSERT(request.is("POST", "/api/items/*"));
+	ASL_ASSERT(request.suffix() == "32");
+	ASL_ASSERT(request.path() == "/api/items/32");
+	ASL_ASSERT(request.resource() == "/api/items/32?x=1&y=a+b#top");
+	ASL_ASSERT(request.querystring() == "x=1&y=a+b");
+	ASL_ASSERT(request.query("y") == "a b");
+	ASL_ASSERT(request.parts().length() == 3 && request.parts()[2] == "32");
+	ASL_ASSERT(request.header("Content-Type") == "text/plain");
+	ASL_ASSERT(request.header("Host") == "localhost");
+	ASL_ASSERT(request.header("X-Long") == "onetwo");
+	ASL_ASSERT(!request.hasHeader("Accept"));
+	ASL_ASSERT(request.text() == "hello");
+	ASL_ASSERT(request.headers().length() == 4);
+	ASL_ASSERT(request.headers()["Content-Type"] == "text/plain");
+
+	HttpRequest request2(peer);
+	ASL_ASSERT(request2.method() == "GET");
+	ASL_ASSERT(request2.path() == "/index.html");
+	ASL_ASSERT(request2.querystring() == "");
+	ASL_ASSERT(request2.header("connection") == "close");
+	ASL_ASSERT(!peer.error());
+}
+
+void testSocketServer()
+{
+	{
+		EchoServer server;
+		ASL_ASSERT(server.bind("127.0.0.1", 0));
+		server.setEventDriven(1);
+		server.start(true);
+		sleep(0.1);
+		ASL_ASSERT(server.eventDriven());
+		testEcho(server);
+		server.stop();
+	}
+	{
+		EchoServer server;
+		ASL_ASSERT(server.bind("127.0.0.1", 0));
+		server.setEventDriven(1);
+		server.setThreadPool(2);
+		server.start(true);
+		sleep(0.1);
+		ASL_ASSERT(server.pooled());
+		testEcho(server);
+		server.stop();
+	}
+
+	// one worker and a queue of one: a third client must be rejected
+
+	BusyServer server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.setThreadPool(1, 1, SocketServer::OVERLOAD_REJECT);
+	server.start(true);
+	sleep(0.1);
+	Socket client1, client2, client3;
+	ASL_ASSERT(client1.connect(InetAddress("127.0.0.1", server.port())));
+	ASL_ASSERT(client1.readLine() == "hello");
+	ASL_ASSERT(client2.connect(InetAddress("127.0.0.1", server.port())));
+	sleep(0.1);
+	ASL_ASSERT(client3.connect(InetAddress("127.0.0.1", server.port())));
+	ASL_ASSERT(client3.readLine() == "busy");
+	server.done.post();
+	ASL_ASSERT(client2.readLine() == "hello");
+	server.done.post();
+	server.stop();
+}
+
+static void routeUser(HttpRequest& request, HttpResponse& response)
+{
+	response.put("user " + request.param("id"));
+}
+
+static void routeMe(HttpRequest&, HttpResponse& response)
+{
+	response.put(String("me"));
+}
+
+struct PhotoHandler : public HttpRouter::Handler
+{
+	void operator()(HttpRequest& request, HttpResponse& response)
+	{
+		response.put("photo " + request.param("id") + " " + request.suffix());
+	}
+};
+
+void testHttpRouter()
+{
+	HttpRouter router;
+	ASL_ASSERT(router.empty());
+	router.add("GET", "/api/users/:id", routeUser);
+	router.add("GET", "/api/users/me", routeMe);
+	router.add("*", "/api/users/:id/photos/*", new PhotoHandler);
+	router.add("PUT", "/api/users/:id", routeUser);
+	ASL_ASSERT(!router.add("GET", "/api/users/:name/groups", routeUser));
+	ASL_ASSERT(!router.add("GET", "/api/users/me", routeUser));
+	ASL_ASSERT(!router.empty());
+
+	Socket server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.listen();
+	Socket client;
+	ASL_ASSERT(client.connect(InetAddress("127.0.0.1", server.localAddress().port())));
+	Socket peer = server.accept();
+
+	client << "GET /api/users/32?x=1 HTTP/1.1\r\n\r\n"
+		"GET /api/users/me HTTP/1.1\r\n\r\n"
+		"POST /api/users/7/photos/2019/a.png HTTP/1.1\r\n\r\n"
+		"POST /api/users/32 HTTP/1.1\r\n\r\n"
+		"GET /api/groups/1 HTTP/1.1\r\n\r\n"
+		"GET /api/users/ HTTP/1.1\r\n\r\n";
+
+	{
+		HttpRequest request(peer);
+		HttpResponse response(request);
+		ASL_ASSERT(router.dispatch(request, response));
+		ASL_ASSERT(response.text() == "user 32");
+		int n;
+		const char* id = request.param("id", n);
+		ASL_ASSERT(id && n == 2 && memcmp(id, "32", 2) == 0);
+		ASL_ASSERT(request.param("name") == "" && !request.param("name", n));
+	}
+	{
+		HttpRequest request(peer);
+		HttpResponse response(request);
+		ASL_ASSERT(router.dispatch(request, response));
+		ASL_ASSERT(response.text() == "me");
+	}
+	{
+		HttpRequest request(peer);
+		HttpResponse response(request);
+		ASL_ASSERT(router.dispatch(request, response));
+		ASL_ASSERT(response.text() == "photo 7 2019/a.png");
+	}
+	{
+		HttpRequest request(peer);
+		HttpResponse response(request);
+		ASL_ASSERT(!router.dispatch(request, response));
+		ASL_ASSERT(response.code() == 405);
+		ASL_ASSERT(response.header("Allow") == "GET, PUT");
+	}
+	{
+		HttpRequest request(peer);
+		HttpResponse response(request);
+		ASL_ASSERT(!router.dispatch(request, response));
+		ASL_ASSERT(response.code() != 405);
+	}
+	{
+		HttpRequest request(peer);
+		HttpResponse response(request);
+		ASL_ASSERT(!router.dispatch(request, response));
+		ASL_ASSERT(response.code() != 405);
+	}
+}
+
+struct FileServer : public HttpServer
+{
+	int port() { return _sockets[0].localAddress().port(); }
+};
+
+void testHttpFileCache()
+{
+	String www = Directory::createTemp();
+	TextFile(www + "/a.txt").put("aaaa");
+	TextFile(www + "/b.html").put("<p>bbbbbbbb</p>");
+	TextFile(www + "/b.html.gz").put("zipped");
+
+	FileServer server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.setRoot(www);
+	server.setFileCache(24, 20);
+	server.start(true);
+	sleep(0.1);
+	String url = String(0, "http://127.0.0.1:%i/", server.port());
+
+	HttpResponse res = Http::get(url + "a.txt");
+	ASL_ASSERT(res.code() == 200 && res.text() == "aaaa");
+	ASL_ASSERT(res.header("Content-Type") == "text/plain" && res.header("Content-Length") == "4");
+	String etag = res.header("ETag");
+	ASL_ASSERT(etag != "" && res.header("Last-Modified") != "");
+	res = Http::get(url + "a.txt");
+	ASL_ASSERT(res.code() == 200 && res.text() == "aaaa" && res.header("ETag") == etag);
+	res = Http::get(url + "a.txt", Dic<>("If-None-Match", etag));
+	ASL_ASSERT(res.code() == 304);
+
+	res = Http::get(url + "b.html", Dic<>("Accept-Encoding", "gzip, deflate"));
+	ASL_ASSERT(res.header("Content-Encoding") == "gzip" && res.text() == "zipped");
+	String gzipEtag = res.header("ETag");
+
+	HttpServer::FileCacheStats stats = server.fileCacheStats();
+	ASL_ASSERT(stats.hits == 2 && stats.misses == 2 && stats.files == 1 && stats.evictions == 1);
+
+	res = Http::get(url + "b.html");
+	ASL_ASSERT(res.header("Content-Type") == "text/html" && res.text() == "<p>bbbbbbbb</p>");
+	ASL_ASSERT(!res.hasHeader("Content-Encoding") && res.header("ETag") != gzipEtag);
+	res = Http::get(url + "b.html", Dic<>("If-None-Match", gzipEtag));
+	ASL_ASSERT(res.code() == 200);
+
+	sleep(1.1);
+	TextFile(www + "/b.html").put("<p>new</p>");
+	File(www + "/b.html").setLastModified(Date::now() + 10.0);
+	res = Http::get(url + "b.html");
+	ASL_ASSERT(res.text() == "<p>new</p>");
+	stats = server.fileCacheStats();
+	ASL_ASSERT(stats.hits == 4 && stats.misses == 3 && stats.bytes > 0 && stats.bytes <= 24);
+	ASL_ASSERT(stats.hitRatio() == 4.0 / 7);
+
+	// a regenerated .gz file is also noticed
+	sleep(1.1);
+	TextFile(www + "/b.html.gz").put("rezipped");
+	File(www + "/b.html.gz").setLastModified(Date::now() + 20.0);
+	res = Http::get(url + "b.html", Dic<>("Accept-Encoding", "gzip"));
+	ASL_ASSERT(res.header("Content-Encoding") == "gzip" && res.text() == "rezipped");
+
+	server.stop();
+	File(www + "/a.txt").remove();
+	File(www + "/b.html").remove();
+	File(www + "/b.html.gz").remove();
+	Directory::remove(www);
+}
+
+struct OneShotServer : public SocketServer
+{
+	int port() { return _sockets[0].localAddress().port(); }
+
+	void serve(Socket client) // answers one request and closes
+	{
+		HttpRequest request(client);
+		client << "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\none";
+	}
+};
+
+struct HelloServer : public HttpServer
+{
+	int port() { return _sockets[0].localAddress().port(); }
+
+	void serve(HttpRequest& request, HttpResponse& response)
+	{
+		response.put("hello " + request.path());
+	}
+};
+
+void testHttpKeepAlive()
+{
+	HelloServer server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.start(true);
+	OneShotServer server2;
+	ASL_ASSERT(server2.bind("127.0.0.1", 0));
+	server2.start(true);
+	sleep(0.1);
+
+	Http::setKeepAlive(2, 10);
+	String url = String(0, "http://127.0.0.1:%i/", server.port());
+	for (int i = 0; i < 5; i++)
+	{
+		HttpResponse res = Http::get(url + String(i));
+		ASL_ASSERT(res.code() == 200 && res.text() == "hello /" + String(i));
+	}
+	ASL_ASSERT(Http::post(url + "x", String("data")).text() == "hello /x");
+	Http::PoolStats stats = Http::poolStats();
+	ASL_ASSERT(stats.connections == 1 && stats.reused == 5 && stats.idle == 1);
+
+	url = String(0, "http://127.0.0.1:%i/", server2.port());
+	ASL_ASSERT(Http::get(url).text() == "one");
+	sleep(0.1);
+	ASL_ASSERT(Http::get(url).text() == "one");
+	stats = Http::poolStats();
+	ASL_ASSERT(stats.connections == 3 && stats.retries == 1 && stats.idle == 2);
+
+	Http::setKeepAlive(0);
+	ASL_ASSERT(Http::poolStats().idle == 0);
+	ASL_ASSERT(Http::get(url).text() == "one");
+	ASL_ASSERT(Http::poolStats().connections == 4);
+
+	// a request head split across two reads
+
+	Socket split;
+	ASL_ASSERT(split.connect(InetAddress("127.0.0.1", server.port())));
+	split << "GET /abc HTTP/1.1\r\nHo";
+	sleep(0.05);
+	split << "st: localhost\r\nConnection: close\r\n\r\n";
+	String reply;
+	while (!reply.contains("hello /abc") && split.waitInput(2))
+		reply << String(split.read());
+	ASL_ASSERT(reply.startsWith("HTTP/1.1 200") && reply.endsWith("\r\n\r\nhello /abc"));
+
+	// request heads are accepted up to the server's limit
+
+	url = String(0, "http://127.0.0.1:%i/", server.port());
+	ASL_ASSERT(Http::get(url + "big", Dic<>("Cookie", String('c', 30000))).text() == "hello /big");
+	ASL_ASSERT(Http::get(url + "big", Dic<>("Cookie", String('c', 70000))).code() == 0);
+	server.stop();
+	server2.stop();
+
+	// an event-driven server with one I/O thread keeps serving others while a request arrives in pieces
+
+	HelloServer server3;
+	ASL_ASSERT(server3.bind("127.0.0.1", 0));
+	server3.setEventDriven(1);
+	server3.start(true);
+	sleep(0.1);
+	Socket slow;
+	ASL_ASSERT(slow.connect(InetAddress("127.0.0.1", server3.port())));
+	slow << "POST /slow HTTP/1.1\r\nContent-Len";
+	sleep(0.05);
+	slow << "gth: 4\r\n\r\nab";
+	sleep(0.05);
+	url = String(0, "http://127.0.0.1:%i/", server3.port());
+	ASL_ASSERT(Http::get(url + "fast").text() == "hello /fast");
+	slow << "cd";
+	reply = "";
+	while (!reply.contains("hello /slow") && slow.waitInput(2))
+		reply << String(slow.read());
+	ASL_ASSERT(reply.startsWith("HTTP/1.1 200") && reply.endsWith("\r\n\r\nhello /slow"));
+
+	// and while a request with a chunked or large body arrives
+
+	Socket chunked, large;
+	ASL_ASSERT(chunked.connect(InetAddress("127.0.0.1", server3.port())));
+	ASL_ASSERT(large.connect(InetAddress("127.0.0.1", server3.port())));
+	chunked << "POST /chunked HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel";
+	large << "POST /large HTTP/1.1\r\nContent-Length: 100000\r\n\r\n" + String('x', 50000);
+	sleep(0.05);
+	ASL_ASSERT(Http::get(url + "fast").text() == "hello /fast");
+	chunked << "lo\r\n0\r\n\r\n";
+	large << String('x', 50000);
+	reply = "";
+	while (!reply.contains("hello /chunked") && chunked.waitInput(2))
+		reply << String(chunked.read());
+	ASL_ASSERT(reply.startsWith("HTTP/1.1 200") && reply.endsWith("\r\n\r\nhello /chunked"));
+	reply = "";
+	while (!reply.contains("hello /large") && large.waitInput(2))
+		reply << String(large.read());
+	ASL_ASSERT(reply.startsWith("HTTP/1.1 200") && reply.endsWith("\r\n\r\nhello /large"));
+	server3.stop();
+
+	// idle keep-alive clients do not hold the threads of a pool
+
+	HelloServer server4;
+	ASL_ASSERT(server4.bind("127.0.0.1", 0));
+	server4.setThreadPool(2);
+	server4.start(true);
+	sleep(0.1);
+	ASL_ASSERT(server4.eventDriven());
+	Array<Socket> idle;
+	for (int i = 0; i < 3; i++)
+	{
+		idle << Socket();
+		ASL_ASSERT(idle[i].connect(InetAddress("127.0.0.1", server4.port())));
+		idle[i] << "GET /idle HTTP/1.1\r\nHost: localhost\r\n\r\n";
+		reply = "";
+		while (!reply.contains("hello /idle") && idle[i].waitInput(2))
+			reply << String(idle[i].read());
+		ASL_ASSERT(reply.endsWith("\r\n\r\nhello /idle"));
+	}
+	url = String(0, "http://127.0.0.1:%i/", server4.port());
+	ASL_ASSERT(Http::get(url + "busy").text() == "hello /busy");
+	server4.stop();
+}
+
+struct RawHttpServer : public SocketServer
+{
+	int port() { return _sockets[0].localAddress().port(); }
+
+	void serve(Socket client)
+	{
+		HttpRequest request(client);
+		String path = request.path();
+		if (path == "/slow")
+		{
+			sleep(0.3);
+			client << "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nslow";
+		}
+		else if (path == "/chunked")
+		{
+			client << "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel";
+			sleep(0.05);
+			client << "lo\r\n";
+			sleep(0.05);
+			client << "6\r\n world\r\n0\r\n\r\n";
+		}
+		else if (path == "/continue")
+		{
+			client << "HTTP/1.1 100 Continue\r\n\r\n";
+			sleep(0.05);
+			client << "HTTP/1.1 103 Early Hints\r\nLink: </a.css>\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\ndone";
+		}
+		else if (path == "/bighead")
+		{
+			client << "HTTP/1.1 200 OK\r\nSet-Cookie: a=" + String('c', 40000) + "\r\n";
+			sleep(0.05);
+			client << "Content-Security-Policy: " + String('p', 30000) + "\r\nContent-Length: 2\r\n\r\nok";
+		}
+		else if (path == "/close")
+		{
+			client << "HTTP/1.0 200 OK\r\n\r\nuntil ";
+			sleep(0.05);
+			client << "close";
+		}
+		else
+			client << "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+	}
+};
+
+static AtomicCount asyncCalls;
+
+static void onAsyncResponse(HttpResponse& response)
+{
+	if (response.code() == 200)
+		++asyncCalls;
+}
+
+void testAsyncHttp()
+{
+	RawHttpServer server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.start(true);
+	sleep(0.1);
+	String url = String(0, "http://127.0.0.1:%i/", server.port());
+
+	AsyncHttp http;
+	AsyncHttp::Call chunked = http.get(url + "chunked");
+	AsyncHttp::Call closed = http.get(url + "close");
+	AsyncHttp::Call missing = http.get(url + "x");
+	AsyncHttp::Call late = http.get(url + "slow", 0.1);
+	ASL_ASSERT(chunked.wait().code() == 200 && chunked.response().text() == "hello world");
+	ASL_ASSERT(closed.wait().text() == "until close");
+	ASL_ASSERT(missing.wait().code() == 404);
+	ASL_ASSERT(late.wait().code() == 0 && late.timedOut());
+	ASL_ASSERT(http.get("http://127.0.0.1:1/").wait().code() == 0);
+
+	// a large request to a server that does not read still times out
+
+	Socket sink;
+	ASL_ASSERT(sink.bind("127.0.0.1", 0));
+	sink.listen();
+	Array<byte> big(16 * 1024 * 1024);
+	memset(big.ptr(), 'x', big.length());
+	double t1 = now();
+	AsyncHttp::Call stuck = http.request(HttpRequest("POST", String(0, "http://127.0.0.1:%i/", sink.localAddress().port()), big), 0.2);
+	ASL_ASSERT(stuck.wait(5) && stuck.timedOut() && now() - t1 < 1);
+
+	// 6 requests of 0.3 s, 3 at a time
+
+	http.setMaxConcurrent(3);
+	double t0 = now();
+	Array<AsyncHttp::Call> calls;
+	for (int i = 0; i < 6; i++)
+		calls << http.request(HttpRequest("GET", url + "slow"), 5.0, onAsyncResponse);
+	sleep(0.1);
+	ASL_ASSERT(http.pending() == 6);
+	ASL_ASSERT(!calls[0].done());
+	http.wait();
+	double t = now() - t0;
+	ASL_ASSERT(t > 0.55 && t < 1.5);
+	ASL_ASSERT(asyncCalls == 6);
+	foreach(AsyncHttp::Call& call, calls)
+		ASL_ASSERT(call.done() && call.response().text() == "slow");
+
+	// interim 1xx responses are skipped
+
+	HttpResponse res = Http::get(url + "continue");
+	ASL_ASSERT(res.code() == 200 && res.text() == "done");
+	ASL_ASSERT(http.get(url + "continue").wait().text() == "done");
+
+	// response heads larger than the socket buffer, up to the configured size
+
+	res = Http::get(url + "bighead");
+	ASL_ASSERT(res.text() == "ok" && res.header("Set-Cookie").length() == 40002);
+	ASL_ASSERT(res.header("Content-Security-Policy").length() == 30000);
+	ASL_ASSERT(http.get(url + "bighead").wait().text() == "ok");
+	Http::setMaxHeadSize(50000);
+	ASL_ASSERT(Http::get(url + "bighead").code() == 0);
+	Http::setMaxHeadSize(256 * 1024);
+	server.stop();
+}
+
+struct NewsServer : public WebSocketServer
+{
+	int port() { return _sockets[0].localAddress().port(); }
+
+	void serve(WebSocket& ws)
+	{
+		subscribe(ws, "news");
+		while (!ws.closed())
+		{
+			if (!ws.wait(0.1))
+				continue;
+			String msg = ws.receive();
+			if (msg == "big")
+				subscribe(ws, "big");
+			else if (msg == "quiet")
+				unsubscribe(ws, "news");
+			else if (msg == "locked")
+			{
+				Lock _(mutex());
+				subscribe(ws, "other");
+			}
+			else if (msg == "bye") // the queued messages must still be sent after returning
+			{
+				ws.send(String('z', 1000000));
+				ws.send("bye");
+				return;
+			}
+			ws.send("ok " + msg);
+		}
+	}
+};
+
+void testWebSocketHub()
+{
+	NewsServer server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.start(true);
+	sleep(0.1);
+
+	Array<WebSocket> clients;
+	for (int i = 0; i < 3; i++)
+	{
+		WebSocket ws;
+		ASL_ASSERT(ws.connect(String(0, "ws://127.0.0.1:%i", server.port())));
+		ws.send("hi");
+		ASL_ASSERT(String(*ws.receive()) == "ok hi");
+		clients << ws;
+	}
+	ASL_ASSERT(server.subscribers("news") == 3);
+	for (int k = 0; k < 10; k++)
+		ASL_ASSERT(server.publish("news", String(0, "item %i", k)) == 3);
+	foreach(WebSocket& ws, clients)
+		for (int k = 0; k < 10; k++)
+			ASL_ASSERT(String(*ws.receive()) == String(0, "item %i", k));
+
+	clients[2].send("quiet");
+	ASL_ASSERT(String(*clients[2].receive()) == "ok quiet");
+	ASL_ASSERT(server.publish("news", Var("x", 1)) == 2);
+	Var v = clients[0].receive();
+	ASL_ASSERT(v["x"] == 1);
+	ASL_ASSERT(server.publish("nobody", "x") == 0);
+
+	// a client that does not read: its queue fills and messages are dropped, then it is disconnected
+
+	WebSocket& slow = clients[1];
+	ASL_ASSERT(String(*slow.receive()) == "{\"x\":1}");
+	slow.send("big");
+	ASL_ASSERT(String(*slow.receive()) == "ok big");
+	server.setSendQueue(8, WebSocketServer::SLOW_DROP);
+	Array<byte> big(65536);
+	for (int i = 0; i < 400; i++)
+		server.publish("big", big);
+	WebSocketServer::HubStats stats = server.hubStats();
+	ASL_ASSERT(stats.dropped > 0 && stats.disconnected == 0);
+	server.setSendQueue(8, WebSocketServer::SLOW_DISCONNECT);
+	for (int i = 0; i < 400 && server.hubStats().disconnected == 0; i++)
+		server.publish("big", big);
+	ASL_ASSERT(server.hubStats().disconnected == 1);
+	for (int i = 0; i < 20 && server.subscribers("big") > 0; i++)
+		sleep(0.1);
+	ASL_ASSERT(server.subscribers("big") == 0 && server.subscribers("news") == 1);
+	ASL_ASSERT(server.publish("news", "last") == 1);
+	ASL_ASSERT(String(*clients[0].receive()) == "last");
+
+	clients[0].send("locked");
+	ASL_ASSERT(String(*clients[0].receive()) == "ok locked");
+	ASL_ASSERT(server.subscribers("other") == 1);
+	clients[0].send("bye");
+	sleep(0.2);
+	ASL_ASSERT(String(*clients[0].receive()).length() == 1000000);
+	ASL_ASSERT(String(*clients[0].receive()) == "bye");
+	ASL_ASSERT(server.subscribers("other") == 0);
+	server.stop();
+}
+
+void testWebSocketMask()
+{
+	byte key[4] = { 0x12, 0x9a, 0x3c, 0xf0 };
+	Array<byte> data(300), masked(300);
+	for (int i = 0; i < data.length(); i++)
+		data[i] = (byte)(i * 7 + 1);
+	for (int offset = 0; offset < 4; offset++)
+	{
+		for (int n = 0; n <= 260; n += (n < 40 ? 1 : 13))
+		{
+			WebSocket::applyMask(masked.ptr() + offset, data.ptr() + offset, n, key);
+			for (int i = 0; i < n; i++)
+				ASL_ASSERT(masked[offset + i] == (data[offset + i] ^ key[i & 3]));
+			WebSocket::applyMask(masked.ptr() + offset, masked.ptr() + offset, n, key);
+			ASL_ASSERT(memcmp(masked.ptr() + offset, data.ptr() + offset, n) == 0);
+		}
+	}
+
+	NewsServer server;
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.start(true);
+	sleep(0.1);
+	WebSocket ws;
+	ASL_ASSERT(ws.connect(String(0, "ws://127.0.0.1:%i", server.port())));
+	int sizes[] = { 1, 125, 126, 1000, 65535, 65536, 300001 };
+	for (int k = 0; k < 7; k++)
+	{
+		String msg(' ', sizes[k]);
+		for (int i = 0; i < sizes[k]; i++)
+			msg[i] = 'a' + i % 26;
+		ws.send(msg);
+		ASL_ASSERT(String(*ws.receive()) == "ok " + msg);
+	}
+	ws.close();
+	server.stop();
+}
+
+void testWebSocketDeflate()
+{
+#ifdef ASL_ZLIB
+	bool zlib = true;
+#else
+	bool zlib = false;
+#endif
+	NewsServer server;
+	server.setCompression(WebSocketCompression());
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.start(true);
+	sleep(0.1);
+	String url = String(0, "ws://127.0.0.1:%i", server.port());
+
+	Var item = Var("id", 1)("title", "Some news about something")("tags", Var::array({ "world", "science" }));
+	Array<Var> items;
+	for (int i = 0; i < 50; i++)
+		items << item;
+	String json = Json::encode(items);
+
+	WebSocketCompression noContext;
+	noContext.contextTakeover = false;
+	noContext.windowBits = 10;
+	WebSocket plain, deflate, small;
+	deflate.setCompression(WebSocketCompression());
+	small.setCompression(noContext);
+	ASL_ASSERT(plain.connect(url) && deflate.connect(url) && small.connect(url));
+	ASL_ASSERT(!plain.compressed() && deflate.compressed() == zlib && small.compressed() == zlib);
+
+	WebSocket* clients[] = { &plain, &deflate, &small };
+	for (int k = 0; k < 3; k++)
+	{
+		WebSocket& ws = *clients[k];
+		for (int i = 0; i < 3; i++)
+		{
+			ws.send(json);
+			ASL_ASSERT(String(*ws.receive()) == "ok " + json);
+		}
+		ws.send("short");
+		ASL_ASSERT(String(*ws.receive()) == "ok short");
+	}
+
+	// published messages are compressed once for all compressed subscribers
+
+	for (int i = 0; i < 5; i++)
+		ASL_ASSERT(server.publish("news", json) == 3);
+	for (int k = 0; k < 3; k++)
+		for (int i = 0; i < 5; i++)
+			ASL_ASSERT(String(*clients[k]->receive()) == json);
+	for (int k = 0; k < 3; k++)
+	{
+		clients[k]->send(json);
+		ASL_ASSERT(String(*clients[k]->receive()) == "ok " + json);
+	}
+	for (int k = 0; k < 3; k++)
+		clients[k]->close();
+	server.stop();
+}
+
+struct FragmentServer : public WebSocketServer
+{
+	int port() { return _sockets[0].localAddress().port(); }
+
+	void serve(WebSocket& ws)
+	{
+		Array<byte> data;
+		bool last = false;
+		int frames = 0, bytes = 0, sum = 0;
+		while (!ws.closed())
+		{
+			if (!ws.wait(0.1))
+				continue;
+			WebSocket::FrameType type = ws.receiveFragment(data, last);
+			if (type == WebSocket::FRAME_CLOSE)
+				break;
+			frames++;
+			bytes += data.length();
+			foreach(byte b, data)
+				sum += b;
+			if (!last)
+				continue;
+			if (type == WebSocket::FRAME_TEXT && String((const char*)data.ptr(), data.length()) == "download")
+			{
+				int parts = 0;
+				ws.sendFragmented([&](byte* p, int n) {
+					if (parts++ == 5)
+						return 0;
+					memset(p, 'a' + parts, n);
+					return n;
+				}, WebSocket::FRAME_TEXT, 3000);
+			}
+			else
+				ws.send(String(0, "%i %i %i %s", frames, bytes, sum, type == WebSocket::FRAME_TEXT ? "text" : "binary"));
+			frames = bytes = sum = 0;
+		}
+	}
+};
+
+static int countDown = 0;
+
+struct RawWebSocket : public WebSocket
+{
+	void sendRaw(const String& text, byte head) { sendFrame((const byte*)*text, text.length(), head); }
+};
+
+static int produceDigits(byte* p, int n)
+{
+	if (countDown-- == 0)
+		return 0;
+	for (int i = 0; i < n; i++)
+		p[i] = '0' + i % 10;
+	return n;
+}
+
+void testWebSocketFragments()
+{
+#ifdef ASL_ZLIB
+	bool zlib = true;
+#else
+	bool zlib = false;
+#endif
+	FragmentServer server;
+	server.setCompression(WebSocketCompression());
+	ASL_ASSERT(server.bind("127.0.0.1", 0));
+	server.start(true);
+	sleep(0.1);
+
+	for (int k = 0; k < 2; k++)
+	{
+		WebSocket ws;
+		if (k == 1)
+			ws.setCompression(WebSocketCompression());
+		ASL_ASSERT(ws.connect(String(0, "ws://127.0.0.1:%i", server.port())));
+		ASL_ASSERT(ws.compressed() == (zlib && k == 1));
+
+		// fragments are received by the server one by one
+
+		int parts = 0;
+		ws.sendFragmented([&](byte* p, int n) {
+			if (parts == 10)
+				return 0;
+			p[0] = (byte)parts++;
+			memset(p + 1, 0, n - 1);
+			return n;
+		}, WebSocket::FRAME_BINARY, 1000);
+		ASL_ASSERT(String(*ws.receive()) == "10 10000 45 binary");
+
+		countDown = 3;
+		ws.sendFragmented(produceDigits, WebSocket::FRAME_TEXT, 200);
+		ASL_ASSERT(String(*ws.receive()) == "3 600 31500 text");
+
+		countDown = 0;
+		ws.sendFragmented(produceDigits, WebSocket::FRAME_TEXT);
+		ASL_ASSERT(String(*ws.receive()) == "1 0 0 text");
+
+		ws.send("hello");
+		ASL_ASSERT(String(*ws.receive()) == "1 5 532 text");
+
+		// a fragmented message received whole or by fragments
+
+		ws.send("download");
+		String text = *ws.receive();
+		ASL_ASSERT(text.length() == 15000 && text[0] == 'b' && text[14999] == 'f');
+
+		ws.send("download");
+		Array<byte> data;
+		bool last = false;
+		for (int i = 0; i < 5; i++)
+		{
+			ASL_ASSERT(!last && ws.receiveFragment(data, last) == WebSocket::FRAME_TEXT);
+			ASL_ASSERT(data.length() == 3000 && data[0] == 'b' + i && data[2999] == 'b' + i);
+		}
+		ASL_ASSERT(last);
+		ws.close();
+	}
+
+	// messages larger than maxMessageSize and frames with unexpected RSV bits close the connection
+
+	WebSocket ws;
+	WebSocketCompression limit(false);
+	limit.maxMessageSize = 10000;
+	ws.setCompression(limit);
+	ASL_ASSERT(ws.connect(String(0, "ws://127.0.0.1:%i", server.port())));
+	ws.send("download");
+	ws.receive();
+	ASL_ASSERT(ws.closed() && ws.code() == 1009);
+
+	RawWebSocket raw;
+	ASL_ASSERT(raw.connect(String(0, "ws://127.0.0.1:%i", server.port())) && !raw.compressed());
+	raw.sendRaw("hello", 0xc1);
+	ASL_ASSERT(raw.wait(2) && raw.receive().length() == 0 && raw.closed());
+	server.stop();
+}
+
+void testPacketBatch()
+{
+	PacketSocket receiver, sender;
+	ASL_ASSERT(receiver.bind("127.0.0.1", 0));
+	ASL_ASSERT(sender.bind("127.0.0.1", 0));
+#ifdef __linux__
+	ASL_ASSERT(receiver.enableTimestamps());
+#endif
+	InetAddress to = receiver.localAddress();
+
+	PacketBatch out(20, 100);
+	for (int i = 0; i < 20; i++)
+	{
+		String text(0, "packet %i", i);
+		ASL_ASSERT(out.add(to, *text, text.length()));
+	}
+	ASL_ASSERT(!out.add(to, "x", 1));
+	ASL_ASSERT(out.length() == 20);
+	double t0 = now();
+	ASL_ASSERT(sender.sendBatch(out) == 20);
+
+	PacketBatch in(32, 100);
+	int received = 0;
+	while (received < 20)
+	{
+		int n = receiver.readBatch(in);
+		ASL_ASSERT(n > 0 && n == in.length());
+		for (int i = 0; i < n; i++)
+		{
+			ASL_ASSERT(String((const char*)in.data(i), in.size(i)) == String(0, "packet %i", received + i));
+			ASL_ASSERT(in.address(i).port() == sender.localAddress().port());
+#ifdef __linux__
+			ASL_ASSERT(fabs(in.timestamp(i) - t0) < 1);
+#endif
+		}
+		received += n;
+	}
+	ASL_ASSERT(received == 20);
+
+	PacketBatch big(2, 10);
+	ASL_ASSERT(!big.add(to, "more than ten bytes", 19));
+	ASL_ASSERT(big.add(to, "0123456789", 10));
+	ASL_ASSERT(sender.sendBatch(big) == 1);
+	ASL_ASSERT(receiver.readBatch(in) == 1 && in.size(0) == 10);
+}
+
+static int taskFib(int n)
+{
+	if (n < 16)
+		return n < 2 ? n : taskFib(n - 1) + taskFib(n - 2);
+	int a = 0;
+	TaskGroup group;
+	group.spawn([&]() { a = taskFib(n - 1); });
+	int b = taskFib(n - 2);
+	group.sync();
+	return a + b;
+}
+
+void testTaskPool()
+{
+	ASL_ASSERT(TaskPool::global().threads() >= 1);
+
+	Array<int> hits(100000);
+	for (int i = 0; i < hits.length(); i++)
+		hits[i] = 0;
+	Thread::parallel_for(0, hits.length(), [&](int i) {
+		hits[i]++;
+	});
+	int sum = 0;
+	foreach(int h, hits)
+		sum += h;
+	ASL_ASSERT(sum == hits.length() && hits.indexOf(0) < 0);
+
+	AtomicCount inner;
+	Thread::parallel_for(0, 64, [&](int) {
+		Thread::parallel_for(0, 1000, [&](int) { ++inner; });
+	});
+	ASL_ASSERT(inner == 64000);
+
+	ASL_ASSERT(taskFib(25) == 75025);
+
+	AtomicCount a, b, c;
+	Thread::parallel_invoke([&]() { ++a; }, [&]() { ++b; }, [&]() { ++c; });
+	ASL_ASSERT(a == 1 && b == 1 && c == 1);
+
+	TaskPool pool(3);
+	ASL_ASSERT(pool.threads() == 3);
+	AtomicCount n;
+	pool.parallel_for(0, 1000, [&](int) { ++n; }, 7);
+	ASL_ASSERT(n == 1000);
+
+	Semaphore done;
+	AtomicCount bg;
+	Thread::parallel_for(0, 10, [&](int) { ++bg; done.post(); }, false);
+	for (int i = 0; i < 10; i++)
+		done.wait();
+	ASL_ASSERT(bg == 10);
+}
+
+void testParallel()
+{
+	const int n = 200000;
+	Array<int> a(n);
+	for (int i = 0; i < n; i++)
+		a[i] = asl::random(-1000, 1000);
+
+	Long sum = 0;
+	int top = a[0];
+	Array<int> scan(n);
+	for (int i = 0; i < n; i++)
+	{
+		sum += a[i];
+		top = max(top, a[i]);
+		scan[i] = (i > 0 ? scan[i - 1] : 0) + a[i];
+	}
+	ASL_ASSERT(parallel_reduce(a, 0, [](int x, int y) { return x + y; }) == (int)sum);
+	ASL_ASSERT(parallel_reduce(a, -5000, [](int x, int y) { return max(x, y); }) == top);
+	ASL_ASSERT(parallel_reduce(Array<int>(), 7, [](int x, int y) { return x + y; }) == 7);
+	ASL_ASSERT(parallel_scan(a, [](int x, int y) { return x + y; }) == scan);
+
+	Array<int> twice = parallel_map(a, [](int x) { return 2 * x; });
+	ASL_ASSERT(twice.length() == n && twice[0] == 2 * a[0] && twice[n - 1] == 2 * a[n - 1]);
+	Array<String> texts = parallel_map(a, [](int x) { return String(x); });
+	ASL_ASSERT(texts.length() == n && texts[n - 1] == String(a[n - 1]));
+	Array<double> halves = parallel_map(a, [](int x) { return x / 2.0; });
+	ASL_ASSERT(halves[1] == a[1] / 2.0);
+
+	Array<int> positive = parallel_filter(a, [](int x) { return x > 0; });
+	Array<int> positive1;
+	foreach(int x, a)
+		if (x > 0)
+			positive1 << x;
+	ASL_ASSERT(positive == positive1);
+
+	Array<int> sorted = a.clone();
+	parallel_sort(sorted);
+	Array<int> sorted1 = a.clone().sort();
+	ASL_ASSERT(sorted == sorted1);
+
+	parallel_sort(sorted, [](int x, int y) { return x > y; });
+	for (int i = 1; i < n; i++)
+		ASL_ASSERT(sorted[i - 1] >= sorted[i]);
+
+	Array<String> words;
+	for (int i = 0; i < 20000; i++)
+		words << String(0, "w%05i", (i * 7919) % 20000);
+	parallel_sort(words);
+	ASL_ASSERT(words[0] == "w00000" && words[19999] == "w19999");
+}
+
+void testFuture()
+{
+	Future<int> a = async([]() { return 6 * 7; });
+	ASL_ASSERT(a.wait() == 42 && a.ready());
+
+	Future<String> b = a.then([](int x) { return String(x) + "!"; });
+	Future<int> c = b.then([](const String& s) { return s.length(); });
+	ASL_ASSERT(c.wait(5.0) && c.value() == 3 && b.value() == "42!");
+
+	Promise<int> never;
+	Future<int> pending = never.future();
+	double t1 = now();
+	ASL_ASSERT(!pending.wait(0.05));
+	ASL_ASSERT(now() - t1 >= 0.04 && !pending.ready());
+
+	Promise<int> p;
+	auto setter = [=]() {
+		sleep(0.02);
+		p.set(5);
+	};
+	Thread thread(setter);
+	ASL_ASSERT(p.future().wait() == 5);
+	ASL_ASSERT(!p.set(6) && p.future().value() == 5);
+	thread.join();
+
+	Array<Future<int> > parts;
+	for (int i = 0; i < 10; i++)
+		parts << async([=]() { return i * i; });
+	Array<int> squares = whenAll(parts).wait();
+	ASL_ASSERT(squares.length() == 10 && squares[3] == 9 && squares[9] == 81);
+	ASL_ASSERT(whenAll(Array<Future<int> >()).wait().length() == 0);
+
+	Array<Future<int> > racers;
+	racers << pending << a;
+	ASL_ASSERT(whenAny(racers).wait() == 1);
+
+	AtomicCount nested;
+	Future<int> outer = async([&]() {
+		Future<int> inner = async([&]() { ++nested; return 1; });
+		return inner.wait() + 1;
+	});
+	ASL_ASSERT(outer.wait() == 2 && nested == 1);
+
+	// futures of void
+
+	AtomicCount steps;
+	Future<void> first = async([&]() { ++steps; });
+	Future<void> second = first.then([&]() { ++steps; });
+	Future<int> third = second.then([&]() { return ++steps; });
+	Future<void> fourth = third.then([&](int n) { if (n == 3) ++steps; });
+	fourth.wait();
+	ASL_ASSERT(first.ready() && steps == 4 && third.value() == 3);
+
+	Promise<void> signal;
+	Future<void> signaled = signal.future();
+	ASL_ASSERT(!signaled.wait(0.01));
+	ASL_ASSERT(signal.set() && !signal.set() && signaled.wait(1.0));
+
+	Array<Future<void> > tasks;
+	for (int i = 0; i < 8; i++)
+		tasks << async([&]() { ++steps; });
+	whenAll(tasks).wait();
+	ASL_ASSERT(steps == 12);
+	ASL_ASSERT(whenAll(Array<Future<void> >()).ready());
+}
+
+void testQueue()
+{
+	Queue<int> queue;
+	queue << 1 << 2;
+	int x1, x2;
+	queue >> x1 >> x2;
+	ASL_ASSERT(x1 == 1 && x2 == 2 && queue.length() == 0);
+
+	for (int i = 0; i < 100; i++)
+	{
+		queue.put(i);
+		if (i % 3 == 0)
+			queue.get();
+	}
+	ASL_ASSERT(queue.length() == 66 && queue.first() == 34 && queue.last() == 99 && queue[1] == 35);
+	queue.putFirst(-1);
+	ASL_ASSERT(queue.get() == -1 && queue.getLast() == 99 && queue.length() == 65);
+
+	Queue<String> names;
+	names << "a" << "b";
+	Queue<String> copy = names;
+	names.get();
+	ASL_ASSERT(copy.length() == 2 && copy.first() == "a" && names.first() == "b");
+	names.clear();
+	ASL_ASSERT(names.length() == 0);
+}
+
+void testConcurrentQueue()
+{
+	ConcurrentQueue<int> q(5);
+	ASL_ASSERT(q.capacity() == 8);
+	for (int i = 0; i < 8; i++)
+		ASL_ASSERT(q.tryPut(i));
+	ASL_ASSERT(!q.tryPut(8) && q.length() == 8);
+	int x = -1;
+	ASL_ASSERT(q.tryGet(x) && x == 0);
+
+	SpscQueue<String> s(4);
+	ASL_ASSERT(s.tryPut("a") && s.tryPut("b"));
+	String y;
+	ASL_ASSERT(s.tryGet(y) && y == "a" && s.length() == 1);
+
+	const int P = 3, N = 20000;
+	BlockingQueue<int> items(64);
+	AtomicCount count;
+	Long sum = 0;
+	Mutex mutex;
+	auto producer = [&]() {
+		for (int i = 1; i <= N; i++)
+			items.put(i);
+	};
+	auto consumer = [&]() {
+		Array<int> batch;
+		Long local = 0;
+		int n;
+		while ((n = items.drain(batch, 16, 0.5)) > 0)
+		{
+			for (int i = 0; i < n; i++)
+				local += batch[i];
+			batch.clear();
+		}
+		Lock _(mutex);
+		sum += local;
+	};
+	Array<Thread> threads;
+	for (int i = 0; i < P; i++)
+		threads << Thread(producer) << Thread(consumer);
+	foreach(Thread& t, threads)
+		t.join();
+	ASL_ASSERT(sum == (Long)P * N * (N + 1) / 2);
+
+	BlockingQueue<int, SpscQueue<int> > one(2);
+	double t1 = now();
+	ASL_ASSERT(!one.get(x, 0.05) && now() - t1 >= 0.04);
+	ASL_ASSERT(one.put(1, 0) && one.put(2, 0) && !one.put(3, 0.01));
+	ASL_ASSERT(one.get() == 1);
+}
+
+struct Snapshot
+{
+	int a, b;
+};
+
+void testLocks()
+{
+	const int T = 4, N = 20000;
+	Mutex mutex;
+	SpinLock spin;
+	ReadWriteLock rw;
+	int counter1 = 0, counter2 = 0, counter3 = 0;
+	AtomicCount reads, bad;
+	SeqLock<Snapshot> snap;
+	auto worker = [&]() {
+		for (int i = 0; i < N; i++)
+		{
+			{
+				Lock _(mutex);
+				counter1++;
+			}
+			{
+				ScopedLock<SpinLock> _(spin);
+				counter2++;
+			}
+			if (i % 10 == 0)
+			{
+				WriteLock _(rw);
+				counter3++;
+			}
+			else
+			{
+				ReadLock _(rw);
+				if (counter3 >= 0)
+					++reads;
+			}
+			if (i % 100 == 0)
+			{
+				Snapshot s = { i, -i };
+				snap.set(s);
+			}
+			Snapshot s = snap.get();
+			if (s.a != -s.b)
+				++bad;
+		}
+	};
+	Array<Thread> threads;
+	for (int i = 0; i < T; i++)
+		threads << Thread(worker);
+	foreach(Thread& t, threads)
+		t.join();
+	ASL_ASSERT(counter1 == T * N && counter2 == T * N);
+	ASL_ASSERT(counter3 == T * N / 10 && reads == T * N * 9 / 10);
+	ASL_ASSERT(bad == 0);
+
+	ASL_ASSERT(mutex.trylock() && !mutex.trylock());
+	mutex.unlock();
+	ASL_ASSERT(spin.trylock() && !spin.trylock());
+	spin.unlock();
+
+	Condition changed(mutex);
+	bool ready = false;
+	mutex.lock();
+	double t1 = now();
+	ASL_ASSERT(changed.wait(0.05));
+	ASL_ASSERT(now() - t1 >= 0.04);
+	auto signaler = [&]() {
+		sleep(0.01);
+		Lock _(mutex);
+		ready = true;
+		changed.signal();
+	};
+	Thread thread(signaler);
+	while (!ready)
+		changed.wait();
+	mutex.unlock();
+	thread.join();
+}
+
+void testFlatHashMap()
+{
+	FlatHashMap<String, int> map;
+	ASL_ASSERT(map.length() == 0 && !map.has("a") && map.find("a") == 0);
+	for (int i = 0; i < 1000; i++)
+		map[String(i)] = i;
+	ASL_ASSERT(map.length() == 1000);
+	for (int i = 0; i < 1000; i++)
+		ASL_ASSERT(map[String(i)] == i);
+	ASL_ASSERT(*map.find("500") == 500 && map.get("x", -1) == -1);
+	ASL_ASSERT(map["new"] == 0 && map.length() == 1001);
+
+	for (int i = 0; i < 1000; i += 2)
+		map.remove(String(i));
+	map.remove("none");
+	ASL_ASSERT(map.length() == 501 && !map.has("2") && map.has("3"));
+
+	int count = 0, sum = 0;
+	foreach2(String& k, int v, map)
+	{
+		if (k != "new")
+			ASL_ASSERT(myatoi(k) == v);
+		count++;
+		sum += v;
+	}
+	ASL_ASSERT(count == 501 && sum == 250000);
+
+	// removals followed by insertions reuse deleted slots
+	for (int j = 0; j < 20; j++)
+	{
+		for (int i = 0; i < 1000; i += 2)
+			map[String(i)] = j;
+		for (int i = 0; i < 1000; i += 2)
+			map.remove(String(i));
+	}
+	ASL_ASSERT(map.length() == 501 && map.has("999"));
+
+	FlatHashMap<String, int> shared = map, copy = map.clone();
+	shared["shared"] = 1;
+	ASL_ASSERT(map.has("shared") && !copy.has("shared") && copy.length() == 501);
+
+	// copies keep sharing the contents when the table grows
+	for (int i = 0; i < 2000; i++)
+		shared[String(i + 1000)] = i;
+	ASL_ASSERT(map.length() == 2502 && map[String(2999)] == 1999 && copy.length() == 501);
+
+	map.clear();
+	ASL_ASSERT(map.length() == 0 && !map.has("3"));
+
+	FlatHashMap<int, String> numbers(100);
+	for (int i = -50; i < 50; i++)
+		numbers[i * 16] = i;
+	ASL_ASSERT(numbers.length() == 100 && numbers[-800] == "-50" && numbers[784] == "49");
+}
+
+struct GridCell
+{
+	short x, y;
+	bool operator==(const GridCell& b) const { return x == b.x && y == b.y; }
+};
+
+ULong hash64(const GridCell& c, ULong seed)
+{
+	return hash64((int)c.x << 16 | (unsigned short)c.y, seed);
+}
+
+struct OldKey
+{
+	int id;
+	bool operator==(const OldKey& b) const { return id == b.id; }
+};
+
+int hash(const OldKey& k)
+{
+	return k.id * 31;
+}
+
+void testHash()
+{
+	// every length hashes differently, and equal contents equally
+	byte data[200];
+	for (int i = 0; i < 200; i++)
+		data[i] = (byte)(i * 7 + 1);
+	Set<ULong> hashes;
+	for (int n = 0; n <= 200; n++)
+	{
+		ULong h = hashBytes(data, n);
+		Array<byte> copy(n);
+		for (int i = 0; i < n; i++)
+			copy[i] = data[i];
+		ASL_ASSERT(hash64(copy) == h && hashBytes(data, n, 1) != h);
+		hashes << h;
+	}
+	ASL_ASSERT(hashes.length() == 201);
+
+	// changing any byte changes the hash
+	for (int i = 0; i < 100; i++)
+	{
+		ULong h = hashBytes(data, 100);
+		data[i] ^= 4;
+		ASL_ASSERT(hashBytes(data, 100) != h);
+		data[i] ^= 4;
+	}
+
+	ASL_ASSERT(hash64(String("abc")) == hashBytes("abc", 3));
+	ASL_ASSERT(hash64(-0.0) == hash64(0.0) && hash64(1.0) != hash64(2.0));
+	ASL_ASSERT(hash64((int*)0x100000000ull) != hash64((int*)0x200000000ull));
+	ASL_ASSERT(hash64(5) != hash64(5, 1) && Hasher<int>(7)(5) == hash64(5, 7));
+
+	// low bits of consecutive integers are well spread
+	Array<int> bins(64);
+	for (int i = 0; i < 64; i++)
+		bins[i] = 0;
+	for (int i = 0; i < 6400; i++)
+		bins[hash64(i * 64) & 63]++;
+	for (int i = 0; i < 64; i++)
+		ASL_ASSERT(bins[i] > 50 && bins[i] < 150);
+
+	RandomHasher<String> r1, r2;
+	ASL_ASSERT(r1.seed != r2.seed && r1("key") != r2("key"));
+
+	HashMap<String, int, RandomHasher<String> > map;
+	for (int i = 0; i < 5000; i++)
+		map[String(i)] = i;
+	HashMap<String, int, RandomHasher<String> > copy = map.clone();
+	ASL_ASSERT(copy.length() == 5000 && copy["4999"] == 4999 && map["123"] == 123);
+
+	Set<int, RandomHasher<int> > s1, s2;
+	for (int i = 0; i < 100; i++)
+	{
+		s1 << i;
+		s2 << 99 - i;
+	}
+	ASL_ASSERT(s1 == s2);
+	s2 << 100;
+	ASL_ASSERT(s1 != s2);
+
+	HashMap<GridCell, int> cells;
+	FlatHashMap<OldKey, int> old;
+	HashMap<byte*, int> pointers;
+	for (int i = 0; i < 100; i++)
+	{
+		GridCell c = { (short)i, (short)-i };
+		OldKey k = { i };
+		cells[c] = i;
+		old[k] = i;
+		pointers[data + i] = i;
+	}
+	GridCell c = { 42, -42 };
+	OldKey k = { 42 };
+	ASL_ASSERT(cells[c] == 42 && cells.length() == 100 && old[k] == 42 && pointers[data + 42] == 42);
+}
+
+void testConcurrentHashMap()
+{
+	const int T = 4, N = 5000;
+	ConcurrentHashMap<String, int> map;
+	ConcurrentHashMap<int, int> counts(4);
+	AtomicCount inserted, missing;
+	auto worker = [&]() {
+		for (int i = 0; i < N; i++)
+		{
+			String key(i % 1000);
+			if (map.getOrInsert(key, i % 1000) != i % 1000)
+				++missing;
+			counts.compute(i % 100, [](int& n) { n++; });
+			int x;
+			if (!map.get(key, x) || x != i % 1000)
+				++missing;
+			if (i % 7 == 0 && map.remove(String(0, "none%i", i)))
+				++missing;
+			map.set(String(2000 + i), i);
+			if (map.remove(String(2000 + i)))
+				++inserted;
+		}
+	};
+	Array<Thread> threads;
+	for (int i = 0; i < T; i++)
+		threads << Thread(worker);
+	foreach(Thread& t, threads)
+		t.join();
+
+	ASL_ASSERT(missing == 0 && inserted > 0);
+	ASL_ASSERT(map.length() == 1000 && map.has("999") && !map.has("1000") && map.get("500", -1) == 500);
+	int total = 0;
+	counts.forEach([&](int, int n) { total += n; });
+	ASL_ASSERT(total == T * N && counts.get(42, 0) == T * N / 100);
+	ASL_ASSERT(counts.compute(1000, [](int& n) { n += 5; }) == 5);
+
+	HashMap<String, int> copy = map.snapshot();
+	map.clear();
+	ASL_ASSERT(copy.length() == 1000 && copy["123"] == 123 && map.length() == 0);
+}
+
+void testBTreeMap()
+{
+	BTreeMap<int, int> tree;
+	Map<int, int> ref;
+	Random rnd;
+	for (int i = 0; i < 30000; i++)
+	{
+		int k = rnd(5000), op = rnd(3);
+		if (op < 2)
+		{
+			tree[k] = i;
+			ref[k] = i;
+		}
+		else
+			ASL_ASSERT(tree.remove(k) == ref.remove(k));
+	}
+	ASL_ASSERT(tree.length() == ref.length());
+	Array<int> keys = ref.keys();
+	int j = 0;
+	foreach2(int k, int v, tree)
+	{
+		ASL_ASSERT(k == keys[j] && v == ref[k]);
+		j++;
+	}
+	ASL_ASSERT(j == keys.length() && tree.keys() == keys);
+	ASL_ASSERT(tree.has(keys[10]) && *tree.find(keys[10]) == ref[keys[10]] && tree.get(-1, -5) == -5);
+
+	// ranges
+	int count = 0, last = -1;
+	foreach2(int k, int v, tree.range(1000, 2000))
+	{
+		ASL_ASSERT(k >= 1000 && k < 2000 && k > last && v == ref[k]);
+		last = k;
+		count++;
+	}
+	int expected = 0;
+	foreach(int k, keys)
+		if (k >= 1000 && k < 2000)
+			expected++;
+	ASL_ASSERT(count == expected);
+	BTreeMap<int, int>::Enumerator e = tree.upperBound(keys[100]);
+	ASL_ASSERT(e && ~e == keys[101]);
+	e = tree.lowerBound(keys[100]);
+	ASL_ASSERT(e && ~e == keys[100]);
+	ASL_ASSERT(!tree.lowerBound(5000) && !tree.range(10, 10).all());
+
+	// sequential insertion and removal
+	BTreeMap<String, int> dic;
+	for (int i = 0; i < 20000; i++)
+		dic[String(0, "%06i", i)] = i;
+	ASL_ASSERT(dic.length() == 20000 && dic["012345"] == 12345);
+	BTreeMap<String, int> copy = dic.clone(), shared = dic;
+	for (int i = 0; i < 20000; i += 2)
+		dic.remove(String(0, "%06i", i));
+	ASL_ASSERT(dic.length() == 10000 && shared.length() == 10000 && copy.length() == 20000);
+	for (int i = 19999; i >= 0; i -= 2)
+		ASL_ASSERT(dic.remove(String(0, "%06i", i)));
+	ASL_ASSERT(dic.length() == 0 && !dic.all());
+	dic["x"] = 1;
+	ASL_ASSERT(dic.length() == 1 && dic["x"] == 1);
+
+	// bulk loading
+	Map<String, int> sorted;
+	for (int i = 0; i < 5000; i++)
+		sorted[String(i)] = i;
+	BTreeMap<String, int> loaded = sorted;
+	ASL_ASSERT(loaded.length() == 5000 && loaded["4321"] == 4321 && loaded.keys() == sorted.keys());
+	loaded.remove("4321");
+	loaded["zz"] = 1;
+	ASL_ASSERT(loaded.length() == 5000 && !loaded.has("4321"));
+
+	Array<int> k2, v2;
+	for (int i = 0; i < 1000; i++)
+	{
+		k2 << i * 3;
+		v2 << i;
+	}
+	tree.loadSorted(k2, v2);
+	ASL_ASSERT(tree.length() == 1000 && tree[2997] == 999 && !tree.has(1));
+	tree.clear();
+	ASL_ASSERT(tree.length() == 0 && !tree.has(3));
+}